@@ -9,6 +9,53 @@
 #include "m_pd.h"
 #include <math.h>
 #include <string.h> // for memcpy
+#include <stdio.h>
+#include <stdlib.h> // for malloc in the render threads
+#include <stdint.h>
+#include <pthread.h> // for streaming renders to disk
+
+/*
+ The sample kernels below are shared by the in-memory (array) path and the
+ streaming (soundfile) path. They are kept out of line so that both paths
+ run the very same machine code; otherwise -ffast-math is free to compile
+ two inlined copies differently and the results would not be bit-identical.
+ */
+
+#if defined(__GNUC__)
+#define BED_KERNEL __attribute__((noinline))
+#else
+#define BED_KERNEL
+#endif
+
+/* Number of t_float values between consecutive array samples */
+
+#define WORD_STRIDE ((int)(sizeof(t_word) / sizeof(t_float)))
+
+/* Biquad state and coefficients for the filter method */
+
+typedef struct _bedbiquad
+{
+	float b0, b1, b2, a1, a2; // normalized coefficients
+	float x1, x2, y1, y2; // previous inputs and outputs
+} t_bedbiquad;
+
+/* The edit operations that can be queued for a soundfile target */
+
+#define BED_NORMALIZE (0)
+#define BED_FADEIN (1)
+#define BED_FILTER (2)
+#define BED_CUT (3)
+
+typedef struct _bedop
+{
+	int o_type; // one of the operations above
+	float o_a; // fade time, filter frequency or cut start
+	float o_b; // filter resonance or cut end
+} t_bedop;
+
+/* A streaming render that runs in its own thread */
+
+typedef struct _bedjob t_bedjob;
 
 /* The class pointer */
 
@@ -32,6 +79,13 @@ typedef struct _bed
 	long		undo_resize; // flag that the undo process will resize the array
 	long		undo_cut; // flag to undo a cut
 	float		b_sr; // sampling rate
+	t_canvas	*b_canvas; // canvas for resolving relative file names
+	t_symbol	*b_file; // soundfile target, or NULL when editing an array
+	t_bedop		*b_ops; // edits queued for the soundfile target
+	int			b_nops; // number of queued edits
+	t_bedjob	*b_job; // render in progress, if any
+	t_clock		*b_clock; // polls the render for completion
+	t_outlet	*b_done; // bangs when a render has finished
 } t_bed;
 
 /* Function prototypes */
@@ -50,6 +104,19 @@ void bed_paste(t_bed *x, t_symbol *destname);
 void bed_undo(t_bed *x);
 void bed_free(t_bed *x);
 void bed_bufname(t_bed *x, t_symbol *name);
+void bed_file(t_bed *x, t_symbol *name);
+void bed_render(t_bed *x, t_symbol *name);
+void bed_clear(t_bed *x);
+void bed_poll(t_bed *x);
+int bed_queue(t_bed *x, int type, float a, float b);
+
+/* Sample kernels */
+
+void bed_peak(const t_float *samples, long n, int stride, float *maxamp);
+void bed_scale(t_float *samples, long n, int stride, float rescale);
+void bed_fade(t_float *samples, long start, long n, int stride, long fadeframes);
+void bed_biquad_init(t_bedbiquad *f, float sr, float freq, float res);
+void bed_biquad_run(t_bedbiquad *f, t_float *samples, long n, int stride);
 
 /*
  The object setup function.
@@ -82,6 +149,9 @@ void bed_setup(void)
 	class_addmethod(c, (t_method)bed_paste, gensym("paste"), A_SYMBOL, 0);
 	class_addmethod(c, (t_method)bed_bufname, gensym("bufname"), A_SYMBOL, 0);
 	class_addmethod(c, (t_method)bed_undo, gensym("undo"), 0); //need to remove A_CANT
+	class_addmethod(c, (t_method)bed_file, gensym("file"), A_SYMBOL, 0);
+	class_addmethod(c, (t_method)bed_render, gensym("render"), A_SYMBOL, 0);
+	class_addmethod(c, (t_method)bed_clear, gensym("clear"), 0);
 
 	post("bed from \"Designing Audio Objects\" by Eric Lyon");
 }
@@ -94,6 +164,13 @@ void *bed_new(t_symbol *myname)
 	x->b_name = myname;
 	x->undo_samples = NULL;
 	x->can_undo = 0;
+	x->b_canvas = canvas_getcurrent();
+	x->b_file = NULL;
+	x->b_ops = NULL;
+	x->b_nops = 0;
+	x->b_job = NULL;
+	x->b_clock = clock_new(x, (t_method)bed_poll);
+	x->b_done = outlet_new(&x->obj, gensym("bang"));
 	return x;
 }
 
@@ -101,6 +178,19 @@ void *bed_new(t_symbol *myname)
 
 void bed_info(t_bed *x)
 {
+	int i;
+	if(x->b_file){
+		post("my soundfile is: %s", x->b_file->s_name);
+		post("queued edits: %d", x->b_nops);
+		for(i = 0; i < x->b_nops; i++){
+			post("  %d: %s %g %g", i + 1,
+				x->b_ops[i].o_type == BED_NORMALIZE ? "normalize" :
+				x->b_ops[i].o_type == BED_FADEIN ? "fadein" :
+				x->b_ops[i].o_type == BED_FILTER ? "filter" : "cut",
+				x->b_ops[i].o_a, x->b_ops[i].o_b);
+		}
+		return;
+	}
 	if(! attach_array(x)){
 		return;
 	}
@@ -113,6 +203,10 @@ void bed_info(t_bed *x)
 void bed_bufname(t_bed *x, t_symbol *name)
 {
 	x->b_name = name;
+
+	/* Edit the array from now on, not the soundfile */
+
+	x->b_file = NULL;
 }
 
 /* The undo method */
@@ -126,6 +220,19 @@ void bed_undo(t_bed *x)
 	long offset; // skip time into the array
 	long oldsize; // Pd bookkeeping
 
+	/* For a soundfile target, undo drops the most recently queued edit */
+
+	if(x->b_file){
+		if(! x->b_nops){
+			post("bed: nothing to undo");
+			return;
+		}
+		x->b_ops = (t_bedop *)resizebytes(x->b_ops, x->b_nops * sizeof(t_bedop),
+			(x->b_nops - 1) * sizeof(t_bedop));
+		x->b_nops--;
+		return;
+	}
+
 	if(! x->can_undo){
 		post("bed: nothing to undo");
 		return;
@@ -227,7 +334,13 @@ void bed_normalize(t_bed *x)
 	float rescale;
 	long oldsize; // size of undo_samples in bytes
 	long chunksize; // size of memory alloc in bytes
-	int i;
+
+	/* A soundfile target only records the edit for the next render */
+
+	if(x->b_file){
+		bed_queue(x, BED_NORMALIZE, 0, 0);
+		return;
+	}
 
 	/* Attach the array and check that it is valid */
 
@@ -238,11 +351,7 @@ void bed_normalize(t_bed *x)
 
 	/* Calculate the maximum amplitude */
 
-	for(i = 0; i < x->b_frames; i++){
-		if(maxamp < fabs(x->b_samples[i].w_float) ){ //note change
-			maxamp = fabs(x->b_samples[i].w_float);
-		}
-	}
+	bed_peak(&x->b_samples[0].w_float, x->b_frames, WORD_STRIDE, &maxamp);
 	/* Generate the rescale factor */
 
 	if(maxamp > 0.000001){
@@ -288,9 +397,7 @@ void bed_normalize(t_bed *x)
 
 	/* Perform the normalization */
 
-	for(i = 0; i < x->b_frames; i++){
-		x->b_samples[i].w_float *= rescale;
-	}
+	bed_scale(&x->b_samples[0].w_float, x->b_frames, WORD_STRIDE, rescale);
 
 	/* Re-attach the array */
 
@@ -310,6 +417,15 @@ void bed_normalize(t_bed *x)
 
 void bed_set_filter(t_bed *x, t_floatarg freq, t_floatarg res) {
 
+	t_bedbiquad filter;
+
+	if (x->b_file) {
+		bed_queue(x, BED_FILTER, freq, res);
+		return;
+	}
+	if (! attach_array(x)) {
+		return;
+	}
 	if (freq <= 0 || freq >= x->b_sr / 2) {
         post("bed: frequency must be between 0 and %f Hz", x->b_sr / 2);
         return;
@@ -333,13 +449,26 @@ void bed_set_filter(t_bed *x, t_floatarg freq, t_floatarg res) {
         return;
     } else {
         x->can_undo = 1;
+        x->undo_cut = 0;
         x->undo_start = 0;
         x->undo_frames = x->b_frames;
+        x->undo_resize = 0;
         memcpy(x->undo_samples, x->b_samples, chunksize);  
     }
 
+    // Apply filter to each sample
+    bed_biquad_init(&filter, x->b_sr, freq, res);
+    bed_biquad_run(&filter, &x->b_samples[0].w_float, x->b_frames, WORD_STRIDE);
+
+    garray_redraw(x->buffy);
+}
+
+/* Compute the coefficients of the resonant lowpass and clear its history */
+
+BED_KERNEL void bed_biquad_init(t_bedbiquad *f, float sr, float freq, float res)
+{
     // Biquad filter variables
-    float omega = 2.0f * M_PI * freq / x->b_sr;
+    float omega = 2.0f * M_PI * freq / sr;
     float alpha = sin(omega) / (2.0f * res);
     float cos_omega = cos(omega);
 
@@ -352,28 +481,79 @@ void bed_set_filter(t_bed *x, t_floatarg freq, t_floatarg res) {
     float b2 = (1.0f - cos_omega) / 2.0f;
 
     // Normalize
-    b0 /= a0;
-    b1 /= a0;
-    b2 /= a0;
-    a1 /= a0;
-    a2 /= a0;
+    f->b0 = b0 / a0;
+    f->b1 = b1 / a0;
+    f->b2 = b2 / a0;
+    f->a1 = a1 / a0;
+    f->a2 = a2 / a0;
+
+    // Previous input and output values
+    f->x1 = f->x2 = 0.0f;
+    f->y1 = f->y2 = 0.0f;
+}
 
-    // Temp variables to hold previous input and output values
-    float prev_x1 = 0.0f, prev_x2 = 0.0f;
-    float prev_y1 = 0.0f, prev_y2 = 0.0f;
+/*
+ Run the filter over n samples spaced stride apart. The history is kept in
+ the filter so a signal can be processed in consecutive pieces.
+ */
 
-    // Apply filter to each sample
-    for (int i = 0; i < x->b_frames; i++) {
-        float input = x->b_samples[i].w_float;
+BED_KERNEL void bed_biquad_run(t_bedbiquad *f, t_float *samples, long n, int stride)
+{
+    float b0 = f->b0, b1 = f->b1, b2 = f->b2, a1 = f->a1, a2 = f->a2;
+    float prev_x1 = f->x1, prev_x2 = f->x2;
+    float prev_y1 = f->y1, prev_y2 = f->y2;
+    long i;
+
+    for (i = 0; i < n; i++) {
+        float input = samples[i * stride];
         float output = b0 * input + b1 * prev_x1 + b2 * prev_x2 - a1 * prev_y1 - a2 * prev_y2;
-		x->b_samples[i].w_float = output;
-		prev_x2 = prev_x1;
+        samples[i * stride] = output;
+        prev_x2 = prev_x1;
         prev_x1 = input;
         prev_y2 = prev_y1;
         prev_y1 = output;
     }
+    f->x1 = prev_x1;
+    f->x2 = prev_x2;
+    f->y1 = prev_y1;
+    f->y2 = prev_y2;
+}
 
-    garray_redraw(x->buffy);
+/* Find the largest absolute sample value, starting from *maxamp */
+
+BED_KERNEL void bed_peak(const t_float *samples, long n, int stride, float *maxamp)
+{
+	float peak = *maxamp;
+	long i;
+	for(i = 0; i < n; i++){
+		if(peak < fabs(samples[i * stride]) ){
+			peak = fabs(samples[i * stride]);
+		}
+	}
+	*maxamp = peak;
+}
+
+/* Multiply n samples by a constant */
+
+BED_KERNEL void bed_scale(t_float *samples, long n, int stride, float rescale)
+{
+	long i;
+	for(i = 0; i < n; i++){
+		samples[i * stride] *= rescale;
+	}
+}
+
+/*
+ Apply a linear fade-in to n samples, the first of which is frame number
+ start of a fade that lasts fadeframes.
+ */
+
+BED_KERNEL void bed_fade(t_float *samples, long start, long n, int stride, long fadeframes)
+{
+	long i;
+	for(i = 0; i < n; i++){
+		samples[i * stride] *= (float)(start + i) / (float) fadeframes;
+	}
 }
 
 
@@ -391,6 +571,11 @@ void bed_cut(t_bed *x, t_floatarg start, t_floatarg end)
 	t_word *local_samples;
 	long local_frames;
 
+	if(x->b_file){
+		bed_queue(x, BED_CUT, start, end);
+		return;
+	}
+
 	if(! attach_array(x)){
 		return;
 	}
@@ -503,6 +688,11 @@ void bed_paste(t_bed *x, t_symbol *destname)
 	int destbuf_b_frames; // frame count for destination array
 	t_word *destbuf_b_samples; // destination array sample pointer
 
+	if(x->b_file){
+		post("bed: paste needs an array target, not a soundfile");
+		return;
+	}
+
 	if(x->can_undo){
 
 		/* Attach the main array */
@@ -560,7 +750,11 @@ void bed_fadein(t_bed *x, t_floatarg fadetime)
 	long oldsize; // previous bytesize of undo_samples
 	long chunksize; // size of memory alloc in bytes
 	long fadeframes; // frames to fade for
-	int i,j;
+
+	if(x->b_file){
+		bed_queue(x, BED_FADEIN, fadetime, 0);
+		return;
+	}
 
 	if(! attach_array(x)){
 		return;
@@ -600,9 +794,7 @@ void bed_fadein(t_bed *x, t_floatarg fadetime)
 
 	/* Perform a linear fadein */
 
-	for(i = 0; i < fadeframes; i++){
-		x->b_samples[i].w_float *= (float)i / (float) fadeframes;
-	}
+	bed_fade(&x->b_samples[0].w_float, 0, fadeframes, WORD_STRIDE, fadeframes);
 
 	/* Redraw the array */
 
@@ -681,9 +873,837 @@ int attach_any_array(t_garray **dest_array, t_symbol *b_name)
 	return b_valid;
 }
 
+/*
+ Streaming renders to a soundfile
+
+ After a "file" message, normalize, fadein, filter and cut are queued instead
+ of applied, and "render <path>" streams the soundfile through the queued
+ edits into a 32-bit float WAV file one chunk at a time, so the take never has
+ to fit in memory. The render runs in its own thread. A reader thread fills
+ one of a pair of chunk buffers while the render thread processes the other,
+ and a writer thread does the same on the output side. bed bangs its outlet
+ when the render is finished.
+
+ Every normalize needs the peak of the signal as it reaches that edit, so it
+ costs one extra read-only pass over the file through the edits before it.
+ The sample kernels are the same ones the array methods use, so a mono file
+ comes out bit-identical to reading it into an array and editing it there
+ (at the same sample rate).
+ */
+
+#define CHUNK_FRAMES (65536)
+
+/* Sample formats that can be read from WAV files */
+
+#define FMT_PCM16 (0)
+#define FMT_PCM24 (1)
+#define FMT_PCM32 (2)
+#define FMT_FLOAT32 (3)
+
+/* An open WAV file, positioned at the start of its samples */
+
+typedef struct _bedsf
+{
+	FILE *fd;
+	int channels;
+	int format; // one of the formats above
+	int bytespersamp;
+	float sr;
+	long frames;
+} t_bedsf;
+
+/* A pair of chunk buffers handed back and forth between two threads */
+
+typedef struct _bedqueue
+{
+	char *q_buf[2]; // the chunk buffers
+	long q_frames[2]; // frames held in each buffer
+	int q_head; // buffer the consumer works on next
+	int q_count; // buffers filled and not yet consumed
+	int q_eof; // the producer has nothing more to give
+	int q_abort; // the consumer has given up
+	pthread_mutex_t q_mutex;
+	pthread_cond_t q_cond;
+} t_bedqueue;
+
+/* One queued edit, prepared for streaming */
+
+typedef struct _bedstage
+{
+	t_bedop s_op; // the edit as queued
+	long s_pos; // frames that have entered this stage so far
+	long s_start; // fade length, or first frame to cut
+	long s_end; // one past the last frame to cut
+	float *s_gain; // per-channel normalize factor; 0 skips the channel
+	t_bedbiquad *s_filter; // per-channel filter state
+} t_bedstage;
+
+struct _bedjob
+{
+	char j_inpath[MAXPDSTRING]; // soundfile to read
+	char j_outpath[MAXPDSTRING]; // WAV file to write
+	t_bedsf j_in; // format of the input
+	int j_nstages; // number of edits
+	t_bedstage *j_stages; // the edits in order
+	long j_outframes; // length of the result
+	pthread_t j_thread; // the render thread
+	pthread_mutex_t j_mutex; // protects the flags below
+	int j_done; // render thread has finished
+	int j_cancel; // the object is going away
+	int j_lowamp; // a normalize was skipped because the signal was silent
+	char j_error[MAXPDSTRING + 64]; // set if the render failed
+};
+
+/* Arguments for the reader and writer threads */
+
+typedef struct _bedio
+{
+	t_bedsf *io_sf;
+	t_bedqueue *io_queue;
+	int io_failed;
+} t_bedio;
+
+void *bed_render_thread(void *z);
+void bed_queue_free(t_bedqueue *q);
+
+/* Little-endian helpers for the WAV header */
+
+static unsigned long bed_le32(const unsigned char *p)
+{
+	return (unsigned long)p[0] | ((unsigned long)p[1] << 8) |
+		((unsigned long)p[2] << 16) | ((unsigned long)p[3] << 24);
+}
+
+static unsigned int bed_le16(const unsigned char *p)
+{
+	return p[0] | (p[1] << 8);
+}
+
+static void bed_putle32(unsigned char *p, unsigned long v)
+{
+	p[0] = v; p[1] = v >> 8; p[2] = v >> 16; p[3] = v >> 24;
+}
+
+static void bed_putle16(unsigned char *p, unsigned int v)
+{
+	p[0] = v; p[1] = v >> 8;
+}
+
+/*
+ Open a WAV file and leave it positioned at its first sample. Returns 0 and
+ sets *err on failure.
+ */
+
+int bed_sfopen(const char *path, t_bedsf *sf, const char **err)
+{
+	unsigned char hdr[12], ck[8], fmt[40];
+	unsigned long size;
+	int gotfmt = 0, tag = 0, bits = 0;
+
+	if(!(sf->fd = sys_fopen(path, "rb"))){
+		*err = "can't open";
+		return 0;
+	}
+	*err = "not a WAV file";
+	if(fread(hdr, 1, 12, sf->fd) != 12 || memcmp(hdr, "RIFF", 4) ||
+		memcmp(hdr + 8, "WAVE", 4)){
+		goto fail;
+	}
+	while(fread(ck, 1, 8, sf->fd) == 8){
+		size = bed_le32(ck + 4);
+		if(!memcmp(ck, "fmt ", 4)){
+			if(size < 16 || size > sizeof(fmt) ||
+				fread(fmt, 1, size, sf->fd) != size){
+				goto fail;
+			}
+			tag = bed_le16(fmt);
+			sf->channels = bed_le16(fmt + 2);
+			sf->sr = bed_le32(fmt + 4);
+			bits = bed_le16(fmt + 14);
+
+			/* WAVE_FORMAT_EXTENSIBLE keeps the real tag in the subformat */
+
+			if(tag == 0xfffe && size >= 26){
+				tag = bed_le16(fmt + 24);
+			}
+			if(size & 1){
+				fgetc(sf->fd);
+			}
+			gotfmt = 1;
+		}
+		else if(!memcmp(ck, "data", 4)){
+			if(!gotfmt){
+				goto fail;
+			}
+			*err = "unsupported sample format";
+			if(tag == 1 && bits == 16){
+				sf->format = FMT_PCM16;
+			} else if(tag == 1 && bits == 24){
+				sf->format = FMT_PCM24;
+			} else if(tag == 1 && bits == 32){
+				sf->format = FMT_PCM32;
+			} else if(tag == 3 && bits == 32){
+				sf->format = FMT_FLOAT32;
+			} else {
+				goto fail;
+			}
+			if(sf->channels < 1 || sf->sr <= 0){
+				goto fail;
+			}
+			sf->bytespersamp = bits / 8;
+			sf->frames = size / (sf->channels * sf->bytespersamp);
+			return 1;
+		}
+		else if(fseek(sf->fd, size + (size & 1), SEEK_CUR) < 0){
+			goto fail;
+		}
+	}
+fail:
+	fclose(sf->fd);
+	sf->fd = NULL;
+	return 0;
+}
+
+/* Convert n interleaved samples from the file's format to t_float */
+
+void bed_sfconvert(const t_bedsf *sf, const unsigned char *in, t_float *out, long n)
+{
+	long i;
+	union { float f; uint32_t i; } u;
+	switch(sf->format){
+	case FMT_PCM16:
+		for(i = 0; i < n; i++, in += 2){
+			out[i] = (t_float)(int16_t)bed_le16(in) * (1.0f / 32768.0f);
+		}
+		break;
+	case FMT_PCM24:
+		for(i = 0; i < n; i++, in += 3){
+			out[i] = (t_float)((int32_t)(((uint32_t)in[0] << 8) |
+				((uint32_t)in[1] << 16) | ((uint32_t)in[2] << 24)) >> 8) *
+				(1.0f / 8388608.0f);
+		}
+		break;
+	case FMT_PCM32:
+		for(i = 0; i < n; i++, in += 4){
+			out[i] = (t_float)(int32_t)bed_le32(in) * (1.0f / 2147483648.0f);
+		}
+		break;
+	default:
+		for(i = 0; i < n; i++, in += 4){
+			u.i = bed_le32(in);
+			out[i] = u.f;
+		}
+		break;
+	}
+}
+
+/* Set up a queue, with buffers of bufsize bytes. On failure nothing is
+ left allocated and the queue must not be freed. */
+
+int bed_queue_init(t_bedqueue *q, size_t bufsize)
+{
+	q->q_buf[0] = malloc(bufsize);
+	q->q_buf[1] = malloc(bufsize);
+	q->q_head = q->q_count = q->q_eof = q->q_abort = 0;
+	pthread_mutex_init(&q->q_mutex, 0);
+	pthread_cond_init(&q->q_cond, 0);
+	if(!q->q_buf[0] || !q->q_buf[1]){
+		bed_queue_free(q);
+		return 0;
+	}
+	return 1;
+}
+
+void bed_queue_free(t_bedqueue *q)
+{
+	free(q->q_buf[0]);
+	free(q->q_buf[1]);
+	pthread_mutex_destroy(&q->q_mutex);
+	pthread_cond_destroy(&q->q_cond);
+}
+
+/* Producer side: wait for an empty buffer. Returns -1 if the consumer quit. */
+
+int bed_queue_getempty(t_bedqueue *q)
+{
+	int slot;
+	pthread_mutex_lock(&q->q_mutex);
+	while(q->q_count == 2 && !q->q_abort){
+		pthread_cond_wait(&q->q_cond, &q->q_mutex);
+	}
+	slot = q->q_abort ? -1 : (q->q_head + q->q_count) % 2;
+	pthread_mutex_unlock(&q->q_mutex);
+	return slot;
+}
+
+/* Producer side: hand a filled buffer over, or signal the end with slot -1 */
+
+void bed_queue_put(t_bedqueue *q, int slot, long frames)
+{
+	pthread_mutex_lock(&q->q_mutex);
+	if(slot < 0){
+		q->q_eof = 1;
+	} else {
+		q->q_frames[slot] = frames;
+		q->q_count++;
+	}
+	pthread_cond_broadcast(&q->q_cond);
+	pthread_mutex_unlock(&q->q_mutex);
+}
+
+/* Consumer side: wait for a filled buffer. Returns -1 at the end. */
+
+int bed_queue_getfull(t_bedqueue *q)
+{
+	int slot;
+	pthread_mutex_lock(&q->q_mutex);
+	while(!q->q_count && !q->q_eof){
+		pthread_cond_wait(&q->q_cond, &q->q_mutex);
+	}
+	slot = q->q_count ? q->q_head : -1;
+	pthread_mutex_unlock(&q->q_mutex);
+	return slot;
+}
+
+/* Consumer side: give a buffer back, or give up altogether with slot -1 */
+
+void bed_queue_release(t_bedqueue *q, int slot)
+{
+	pthread_mutex_lock(&q->q_mutex);
+	if(slot < 0){
+		q->q_abort = 1;
+	} else {
+		q->q_head = (q->q_head + 1) % 2;
+		q->q_count--;
+	}
+	pthread_cond_broadcast(&q->q_cond);
+	pthread_mutex_unlock(&q->q_mutex);
+}
+
+/* The reader thread: file -> chunks of t_float */
+
+void *bed_reader_thread(void *z)
+{
+	t_bedio *io = (t_bedio *)z;
+	t_bedsf *sf = io->io_sf;
+	long remaining = sf->frames, frames, got;
+	size_t framebytes = sf->channels * sf->bytespersamp;
+	unsigned char *raw = malloc(CHUNK_FRAMES * framebytes);
+	int slot;
+
+	if(!raw){
+		io->io_failed = 1;
+	}
+	while(raw && remaining > 0 && (slot = bed_queue_getempty(io->io_queue)) >= 0){
+		frames = remaining < CHUNK_FRAMES ? remaining : CHUNK_FRAMES;
+		got = fread(raw, framebytes, frames, sf->fd);
+		if(got < frames){
+			io->io_failed = 1;
+			remaining = 0;
+		} else {
+			remaining -= frames;
+		}
+		bed_sfconvert(sf, raw, (t_float *)io->io_queue->q_buf[slot], got * sf->channels);
+		bed_queue_put(io->io_queue, slot, got);
+	}
+	bed_queue_put(io->io_queue, -1, 0);
+	free(raw);
+	return 0;
+}
+
+/* The writer thread: chunks of 32-bit float bytes -> file */
+
+void *bed_writer_thread(void *z)
+{
+	t_bedio *io = (t_bedio *)z;
+	size_t framebytes = io->io_sf->channels * sizeof(float);
+	long frames;
+	int slot;
+
+	while((slot = bed_queue_getfull(io->io_queue)) >= 0){
+		frames = io->io_queue->q_frames[slot];
+		if(fwrite(io->io_queue->q_buf[slot], framebytes, frames, io->io_sf->fd) < (size_t)frames){
+			io->io_failed = 1;
+			bed_queue_release(io->io_queue, -1);
+			break;
+		}
+		bed_queue_release(io->io_queue, slot);
+	}
+	return 0;
+}
+
+/* Write the header of a 32-bit float WAV file */
+
+int bed_write_header(FILE *fd, int channels, float sr, long frames)
+{
+	unsigned char h[44];
+	unsigned long datasize = (unsigned long)frames * channels * sizeof(float);
+	memcpy(h, "RIFF", 4);
+	bed_putle32(h + 4, 36 + datasize);
+	memcpy(h + 8, "WAVEfmt ", 8);
+	bed_putle32(h + 16, 16);
+	bed_putle16(h + 20, 3); // WAVE_FORMAT_IEEE_FLOAT
+	bed_putle16(h + 22, channels);
+	bed_putle32(h + 24, (unsigned long)sr);
+	bed_putle32(h + 28, (unsigned long)sr * channels * sizeof(float));
+	bed_putle16(h + 32, channels * sizeof(float));
+	bed_putle16(h + 34, 32);
+	memcpy(h + 36, "data", 4);
+	bed_putle32(h + 40, datasize);
+	return (fwrite(h, 1, 44, fd) == 44);
+}
+
+/*
+ Run one chunk of n frames through a stage. Returns the number of frames
+ left in the chunk, which is less than n when part of it was cut.
+ */
+
+long bed_stage_run(t_bedstage *st, t_float *buf, long n, int nch)
+{
+	long lo, hi, m, cut = 0;
+	int c;
+	switch(st->s_op.o_type){
+	case BED_NORMALIZE:
+		for(c = 0; c < nch; c++){
+			if(st->s_gain[c] != 0){
+				bed_scale(buf + c, n, nch, st->s_gain[c]);
+			}
+		}
+		break;
+	case BED_FADEIN:
+		if(st->s_pos < st->s_start){
+			m = st->s_start - st->s_pos;
+			if(m > n){
+				m = n;
+			}
+			for(c = 0; c < nch; c++){
+				bed_fade(buf + c, st->s_pos, m, nch, st->s_start);
+			}
+		}
+		break;
+	case BED_FILTER:
+		for(c = 0; c < nch; c++){
+			bed_biquad_run(&st->s_filter[c], buf + c, n, nch);
+		}
+		break;
+	case BED_CUT:
+		lo = st->s_start > st->s_pos ? st->s_start : st->s_pos;
+		hi = st->s_end < st->s_pos + n ? st->s_end : st->s_pos + n;
+		if(lo < hi){
+			memmove(buf + (lo - st->s_pos) * nch, buf + (hi - st->s_pos) * nch,
+				(st->s_pos + n - hi) * nch * sizeof(t_float));
+			cut = hi - lo;
+		}
+		break;
+	}
+	st->s_pos += n;
+	return n - cut;
+}
+
+/*
+ One pass over the input through the first nstages edits. With out set, the
+ result is converted to 32-bit float and written there; otherwise the peak
+ of each channel is collected into peaks. Returns 0 on failure.
+ */
+
+int bed_render_pass(t_bedjob *job, int nstages, float *peaks, t_bedsf *out)
+{
+	t_bedsf in;
+	t_bedqueue inq, outq;
+	t_bedio reader, writer;
+	pthread_t readthread, writethread;
+	const char *err;
+	int nch = job->j_in.channels, ok = 1, slot, outslot, i, c, cancel;
+	long n, k;
+	t_float *buf;
+	union { float f; uint32_t i; } u;
+	unsigned char *bytes;
+
+	if(!bed_sfopen(job->j_inpath, &in, &err)){
+		snprintf(job->j_error, sizeof(job->j_error), "%s: %s", job->j_inpath, err);
+		return 0;
+	}
+
+	/* Reset the stages for this pass */
+
+	for(i = 0; i < nstages; i++){
+		job->j_stages[i].s_pos = 0;
+		if(job->j_stages[i].s_op.o_type == BED_FILTER){
+			for(c = 0; c < nch; c++){
+				bed_biquad_init(&job->j_stages[i].s_filter[c], in.sr,
+					job->j_stages[i].s_op.o_a, job->j_stages[i].s_op.o_b);
+			}
+		}
+	}
+
+	if(!bed_queue_init(&inq, CHUNK_FRAMES * nch * sizeof(t_float))){
+		snprintf(job->j_error, sizeof(job->j_error), "out of memory");
+		fclose(in.fd);
+		return 0;
+	}
+	if(out && !bed_queue_init(&outq, CHUNK_FRAMES * nch * sizeof(float))){
+		snprintf(job->j_error, sizeof(job->j_error), "out of memory");
+		bed_queue_free(&inq);
+		fclose(in.fd);
+		return 0;
+	}
+	reader.io_sf = &in;
+	reader.io_queue = &inq;
+	reader.io_failed = 0;
+	if(pthread_create(&readthread, 0, bed_reader_thread, &reader)){
+		snprintf(job->j_error, sizeof(job->j_error), "can't start reader thread");
+		if(out){
+			bed_queue_free(&outq);
+		}
+		bed_queue_free(&inq);
+		fclose(in.fd);
+		return 0;
+	}
+	if(out){
+		writer.io_sf = out;
+		writer.io_queue = &outq;
+		writer.io_failed = 0;
+		if(pthread_create(&writethread, 0, bed_writer_thread, &writer)){
+			snprintf(job->j_error, sizeof(job->j_error), "can't start writer thread");
+			bed_queue_release(&inq, -1);
+			pthread_join(readthread, 0);
+			bed_queue_free(&outq);
+			bed_queue_free(&inq);
+			fclose(in.fd);
+			return 0;
+		}
+	}
+
+	while((slot = bed_queue_getfull(&inq)) >= 0){
+		pthread_mutex_lock(&job->j_mutex);
+		cancel = job->j_cancel;
+		pthread_mutex_unlock(&job->j_mutex);
+		if(cancel){
+			ok = 0;
+			break;
+		}
+		buf = (t_float *)inq.q_buf[slot];
+		n = inq.q_frames[slot];
+		for(i = 0; i < nstages && n > 0; i++){
+			n = bed_stage_run(&job->j_stages[i], buf, n, nch);
+		}
+		if(out){
+			if((outslot = bed_queue_getempty(&outq)) < 0){
+				ok = 0;
+				break;
+			}
+			bytes = (unsigned char *)outq.q_buf[outslot];
+			for(k = 0; k < n * nch; k++, bytes += 4){
+				u.f = buf[k];
+				bed_putle32(bytes, u.i);
+			}
+			bed_queue_put(&outq, outslot, n);
+		} else {
+			for(c = 0; c < nch; c++){
+				bed_peak(buf + c, n, nch, &peaks[c]);
+			}
+		}
+		bed_queue_release(&inq, slot);
+	}
+
+	/* Stop the reader if we quit early, then wait for both threads */
+
+	if(slot >= 0){
+		bed_queue_release(&inq, -1);
+	}
+	pthread_join(readthread, 0);
+	if(out){
+		bed_queue_put(&outq, -1, 0);
+		pthread_join(writethread, 0);
+		if(writer.io_failed){
+			snprintf(job->j_error, sizeof(job->j_error), "%s: write failed", job->j_outpath);
+			ok = 0;
+		}
+		bed_queue_free(&outq);
+	}
+	if(reader.io_failed && ok){
+		snprintf(job->j_error, sizeof(job->j_error), "%s: read failed", job->j_inpath);
+		ok = 0;
+	}
+	bed_queue_free(&inq);
+	fclose(in.fd);
+	return ok;
+}
+
+/* The render thread: a peak pass per normalize, then the real thing */
+
+void *bed_render_thread(void *z)
+{
+	t_bedjob *job = (t_bedjob *)z;
+	int nch = job->j_in.channels, i, c, ok = 1;
+	float *peaks = malloc(nch * sizeof(float));
+	t_bedsf out;
+
+	if(!peaks){
+		snprintf(job->j_error, sizeof(job->j_error), "out of memory");
+		ok = 0;
+	}
+	for(i = 0; ok && i < job->j_nstages; i++){
+		if(job->j_stages[i].s_op.o_type != BED_NORMALIZE){
+			continue;
+		}
+		for(c = 0; c < nch; c++){
+			peaks[c] = 0.0;
+		}
+		if(!(ok = bed_render_pass(job, i, peaks, NULL))){
+			break;
+		}
+		for(c = 0; c < nch; c++){
+			if(peaks[c] > 0.000001){
+				job->j_stages[i].s_gain[c] = 1.0 / peaks[c];
+			} else {
+				job->j_stages[i].s_gain[c] = 0;
+				job->j_lowamp = 1;
+			}
+		}
+	}
+	if(ok){
+		out.channels = nch;
+		if(!(out.fd = sys_fopen(job->j_outpath, "wb"))){
+			snprintf(job->j_error, sizeof(job->j_error), "%s: can't create", job->j_outpath);
+		}
+		else {
+			if(!bed_write_header(out.fd, nch, job->j_in.sr, job->j_outframes)){
+				snprintf(job->j_error, sizeof(job->j_error), "%s: write failed", job->j_outpath);
+			} else {
+				bed_render_pass(job, job->j_nstages, NULL, &out);
+			}
+			if(fclose(out.fd) && !job->j_error[0]){
+				snprintf(job->j_error, sizeof(job->j_error), "%s: write failed", job->j_outpath);
+			}
+		}
+	}
+	free(peaks);
+	pthread_mutex_lock(&job->j_mutex);
+	job->j_done = 1;
+	pthread_mutex_unlock(&job->j_mutex);
+	return 0;
+}
+
+/* Free a job and its stages */
+
+void bed_job_free(t_bedjob *job)
+{
+	int i, nch = job->j_in.channels;
+	for(i = 0; i < job->j_nstages; i++){
+		if(job->j_stages[i].s_gain){
+			freebytes(job->j_stages[i].s_gain, nch * sizeof(float));
+		}
+		if(job->j_stages[i].s_filter){
+			freebytes(job->j_stages[i].s_filter, nch * sizeof(t_bedbiquad));
+		}
+	}
+	if(job->j_stages){
+		freebytes(job->j_stages, job->j_nstages * sizeof(t_bedstage));
+	}
+	pthread_mutex_destroy(&job->j_mutex);
+	freebytes(job, sizeof(t_bedjob));
+}
+
+/* Queue an edit for the soundfile target */
+
+int bed_queue(t_bed *x, int type, float a, float b)
+{
+	x->b_ops = (t_bedop *)resizebytes(x->b_ops, x->b_nops * sizeof(t_bedop),
+		(x->b_nops + 1) * sizeof(t_bedop));
+	if(x->b_ops == NULL){
+		post("bed: cannot allocate memory for edit");
+		x->b_nops = 0;
+		return 0;
+	}
+	x->b_ops[x->b_nops].o_type = type;
+	x->b_ops[x->b_nops].o_a = a;
+	x->b_ops[x->b_nops].o_b = b;
+	x->b_nops++;
+	return 1;
+}
+
+/* The file method: edit a soundfile instead of an array */
+
+void bed_file(t_bed *x, t_symbol *name)
+{
+	char path[MAXPDSTRING];
+	const char *err;
+	t_bedsf sf;
+
+	canvas_makefilename(x->b_canvas, name->s_name, path, MAXPDSTRING);
+	if(!bed_sfopen(path, &sf, &err)){
+		pd_error(x, "bed: %s: %s", path, err);
+		return;
+	}
+	fclose(sf.fd);
+
+	/* Edits queued for the previous file don't apply to this one */
+
+	bed_clear(x);
+	x->b_file = name;
+}
+
+/* The clear method: forget the queued edits */
+
+void bed_clear(t_bed *x)
+{
+	if(x->b_ops){
+		freebytes(x->b_ops, x->b_nops * sizeof(t_bedop));
+	}
+	x->b_ops = NULL;
+	x->b_nops = 0;
+}
+
+/* The render method: check the queued edits and start the render thread */
+
+void bed_render(t_bed *x, t_symbol *name)
+{
+	t_bedjob *job;
+	t_bedstage *st;
+	const char *err;
+	long len, fadeframes, startframe, endframe;
+	float sr;
+	int i, nch;
+
+	if(! x->b_file){
+		post("bed: render needs a soundfile, set one with the file message");
+		return;
+	}
+	if(x->b_job){
+		post("bed: render already in progress");
+		return;
+	}
+	job = (t_bedjob *)getbytes(sizeof(t_bedjob));
+	pthread_mutex_init(&job->j_mutex, 0);
+	canvas_makefilename(x->b_canvas, x->b_file->s_name, job->j_inpath, MAXPDSTRING);
+	canvas_makefilename(x->b_canvas, name->s_name, job->j_outpath, MAXPDSTRING);
+	if(!strcmp(job->j_inpath, job->j_outpath)){
+		pd_error(x, "bed: can't render %s onto itself", job->j_inpath);
+		bed_job_free(job);
+		return;
+	}
+
+	/* Read the header to check the edits against the length of the file */
+
+	if(!bed_sfopen(job->j_inpath, &job->j_in, &err)){
+		pd_error(x, "bed: %s: %s", job->j_inpath, err);
+		bed_job_free(job);
+		return;
+	}
+	fclose(job->j_in.fd);
+	job->j_in.fd = NULL;
+	nch = job->j_in.channels;
+	sr = job->j_in.sr;
+	len = job->j_in.frames;
+
+	job->j_stages = (t_bedstage *)getbytes(x->b_nops * sizeof(t_bedstage));
+	job->j_nstages = x->b_nops;
+	for(i = 0; i < x->b_nops; i++){
+		st = &job->j_stages[i];
+		st->s_op = x->b_ops[i];
+		switch(st->s_op.o_type){
+		case BED_NORMALIZE:
+			st->s_gain = (float *)getbytes(nch * sizeof(float));
+			break;
+		case BED_FADEIN:
+			fadeframes = st->s_op.o_a * 0.001 * sr;
+			if(st->s_op.o_a <= 0 || fadeframes > len){
+				post("bed: bad fade time: %f", st->s_op.o_a);
+				bed_job_free(job);
+				return;
+			}
+			st->s_start = fadeframes;
+			break;
+		case BED_FILTER:
+			if(st->s_op.o_a <= 0 || st->s_op.o_a >= sr / 2){
+				post("bed: frequency must be between 0 and %f Hz", sr / 2);
+				bed_job_free(job);
+				return;
+			}
+			if(st->s_op.o_b <= 0){
+				post("bed: resonance must be positive");
+				bed_job_free(job);
+				return;
+			}
+			st->s_filter = (t_bedbiquad *)getbytes(nch * sizeof(t_bedbiquad));
+			break;
+		case BED_CUT:
+			startframe = st->s_op.o_a * 0.001 * sr;
+			endframe = st->s_op.o_b * 0.001 * sr;
+			if(endframe - startframe <= 0 || startframe < 0 || endframe > len){
+				post("bed: bad cut data: %f %f", st->s_op.o_a, st->s_op.o_b);
+				bed_job_free(job);
+				return;
+			}
+			st->s_start = startframe;
+			st->s_end = endframe;
+			len -= endframe - startframe;
+			break;
+		}
+	}
+	job->j_outframes = len;
+	if((double)len * nch * sizeof(float) > 0xffffffffUL - 36){
+		pd_error(x, "bed: %s: result too large for a WAV file", job->j_outpath);
+		bed_job_free(job);
+		return;
+	}
+
+	if(pthread_create(&job->j_thread, 0, bed_render_thread, job)){
+		pd_error(x, "bed: couldn't start render thread");
+		bed_job_free(job);
+		return;
+	}
+	x->b_job = job;
+	clock_delay(x->b_clock, 50);
+}
+
+/* Check on the render thread from Pd's scheduler */
+
+void bed_poll(t_bed *x)
+{
+	t_bedjob *job = x->b_job;
+	int done;
+
+	if(!job){
+		return;
+	}
+	pthread_mutex_lock(&job->j_mutex);
+	done = job->j_done;
+	pthread_mutex_unlock(&job->j_mutex);
+	if(!done){
+		clock_delay(x->b_clock, 50);
+		return;
+	}
+	pthread_join(job->j_thread, 0);
+	x->b_job = NULL;
+	if(job->j_lowamp){
+		post("bed: amplitude is too low to rescale, normalize skipped");
+	}
+	if(job->j_error[0]){
+		pd_error(x, "bed: %s", job->j_error);
+		bed_job_free(job);
+		return;
+	}
+	post("bed: rendered %s (%ld frames)", job->j_outpath, job->j_outframes);
+	bed_job_free(job);
+	outlet_bang(x->b_done);
+}
+
 /* The free routine */
 
 void bed_free(t_bed *x)
 {
+	/* Stop a render in progress before the object goes away */
+
+	if(x->b_job){
+		pthread_mutex_lock(&x->b_job->j_mutex);
+		x->b_job->j_cancel = 1;
+		pthread_mutex_unlock(&x->b_job->j_mutex);
+		pthread_join(x->b_job->j_thread, 0);
+		bed_job_free(x->b_job);
+	}
+	clock_free(x->b_clock);
+	bed_clear(x);
 	freebytes(x->undo_samples, x->undo_frames * sizeof(t_word));
 }
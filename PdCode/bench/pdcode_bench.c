@@ -0,0 +1,228 @@
+/*
+    pdcode_bench: time the course externals inside libpd.
+
+    For every signal external in the table below and every requested block
+    size, a throwaway patch is written that drives the object's signal inlets
+    from [osc~] inside a [block~ N] canvas.  The patch is run headless for a
+    fixed number of samples, and the time of an identical patch without the
+    object is subtracted, leaving the cost of the external itself.  Results
+    are reported in nanoseconds per output sample.
+
+    usage: pdcode_bench [-d extdir] [-s seconds] [-b 64,256,1024] [-c] [name...]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "z_libpd.h"
+
+#define SR 48000
+#define MAXBLOCKS 16
+
+typedef struct _benchspec
+{
+    const char *b_name;     /* class name */
+    const char *b_args;     /* creation arguments */
+    int b_nsigin;           /* number of signal inlets to drive */
+} t_benchspec;
+
+static const t_benchspec benchspecs[] =
+{
+    {"cleaner~",    "",                 3},
+    {"dynstoch~",   "",                 1},
+    {"mirror~",     "",                 1},
+    {"moogvcf~",    "",                 3},
+    {"multy~",      "",                 2},
+    {"oscil~",      "440 8192 sine 4",  1},
+    {"ramp~",       "",                 2},
+    {"retroseq~",   "",                 1},
+    {"scrubber~",   "",                 4},
+    {"vdelay~",     "500 100 0.5",      3},
+    {"vpdelay~",    "500 100 0.5",      3},
+    {"windowvec~",  "",                 1},
+};
+
+#define NSPECS (sizeof(benchspecs)/sizeof(benchspecs[0]))
+
+static char patchdir[] = "/tmp/pdcode_benchXXXXXX";
+static int printerrors, createfailed;
+
+static void bench_print(const char *s)
+{
+    if (strstr(s, "couldn't create"))
+        createfailed = 1;
+    if (printerrors)
+        fprintf(stderr, "%s", s);
+}
+
+static double bench_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (ts.tv_sec * 1e9 + ts.tv_nsec);
+}
+
+    /* write a patch containing [block~ blocksize], an [osc~] and, if spec is
+    nonzero, the object under test with nsigin inlets fed by the oscillator. */
+static int bench_writepatch(const char *filename, const t_benchspec *spec,
+    int blocksize)
+{
+    char path[1024];
+    FILE *fd;
+    int i;
+    snprintf(path, sizeof(path), "%s/%s", patchdir, filename);
+    if (!(fd = fopen(path, "w")))
+    {
+        perror(path);
+        return (-1);
+    }
+    fprintf(fd, "#N canvas 0 0 450 300 12;\n");
+    fprintf(fd, "#X obj 10 10 block~ %d;\n", blocksize);
+    fprintf(fd, "#X obj 10 40 osc~ 220;\n");
+    if (spec)
+    {
+        fprintf(fd, "#X obj 10 70 %s %s;\n", spec->b_name, spec->b_args);
+        for (i = 0; i < spec->b_nsigin; i++)
+            fprintf(fd, "#X connect 1 0 2 %d;\n", i);
+    }
+    fclose(fd);
+    return (0);
+}
+
+    /* run a patch for nsamples and return the elapsed time in nanoseconds */
+static double bench_runpatch(const char *filename, int nsamples)
+{
+    static float inbuf[1], outbuf[1];
+    int ticks = nsamples / libpd_blocksize(), i;
+    void *patch = libpd_openfile(filename, patchdir);
+    double start, elapsed;
+    if (!patch)
+        return (-1);
+        /* one warm-up second so that table allocation and first-block
+        setup in the objects do not end up in the measurement */
+    for (i = 0; i < SR / libpd_blocksize(); i++)
+        libpd_process_float(1, inbuf, outbuf);
+    start = bench_now();
+    for (i = 0; i < ticks; i++)
+        libpd_process_float(1, inbuf, outbuf);
+    elapsed = bench_now() - start;
+    libpd_closefile(patch);
+    return (elapsed);
+}
+
+    /* open a probe patch so that Pd loads the external and see whether
+    Pd complains.  (libpd is linked -Bsymbolic, so we can't look at its
+    class tables from here.) */
+static int bench_cancreate(const t_benchspec *spec)
+{
+    void *patch;
+    createfailed = 0;
+    if (bench_writepatch("probe.pd", spec, 64) < 0 ||
+        !(patch = libpd_openfile("probe.pd", patchdir)))
+            return (0);
+    libpd_closefile(patch);
+    return (!createfailed);
+}
+
+static int bench_parseblocks(char *s, int *blocks)
+{
+    int n = 0;
+    char *tok;
+    for (tok = strtok(s, ","); tok && n < MAXBLOCKS; tok = strtok(0, ","))
+    {
+        int b = atoi(tok);
+        if (b < 64 || (b & (b - 1)))
+        {
+            fprintf(stderr, "block size %s: must be a power of two >= 64\n",
+                tok);
+            return (0);
+        }
+        blocks[n++] = b;
+    }
+    return (n);
+}
+
+int main(int argc, char **argv)
+{
+    char blockarg[] = "64,256,1024", *extdir = "..";
+    int blocks[MAXBLOCKS], nblocks, csv = 0, ch, nsamples;
+    double seconds = 2;
+    unsigned int i;
+    int j;
+
+    nblocks = bench_parseblocks(blockarg, blocks);
+    while ((ch = getopt(argc, argv, "d:s:b:cv")) != -1)
+    {
+        switch (ch)
+        {
+        case 'd': extdir = optarg; break;
+        case 's': seconds = atof(optarg); break;
+        case 'b':
+            if (!(nblocks = bench_parseblocks(optarg, blocks)))
+                return (1);
+            break;
+        case 'c': csv = 1; break;
+        case 'v': printerrors = 1; break;
+        default:
+            fprintf(stderr, "usage: %s [-d extdir] [-s seconds] "
+                "[-b 64,256,1024] [-c] [-v] [name...]\n", argv[0]);
+            return (1);
+        }
+    }
+    if (!mkdtemp(patchdir))
+    {
+        perror(patchdir);
+        return (1);
+    }
+    nsamples = seconds * SR;
+
+    libpd_set_printhook(bench_print);
+    libpd_init();
+    libpd_add_to_search_path(extdir);
+    libpd_init_audio(0, 0, SR);
+    libpd_start_message(1);
+    libpd_add_float(1.0f);
+    libpd_finish_message("pd", "dsp");
+
+    if (csv)
+        printf("object,blocksize,ns_per_sample\n");
+    else printf("%-12s %8s %14s\n", "object", "block", "ns/sample");
+    for (i = 0; i < NSPECS; i++)
+    {
+        const t_benchspec *spec = &benchspecs[i];
+        if (optind < argc)
+        {
+            int wanted = 0, k;
+            for (k = optind; k < argc; k++)
+                if (!strcmp(argv[k], spec->b_name))
+                    wanted = 1;
+            if (!wanted)
+                continue;
+        }
+        if (!bench_cancreate(spec))
+        {
+            fprintf(stderr, "%s: couldn't load from %s; skipping\n",
+                spec->b_name, extdir);
+            continue;
+        }
+        for (j = 0; j < nblocks; j++)
+        {
+            double base, withobj, ns;
+            if (bench_writepatch("base.pd", 0, blocks[j]) < 0 ||
+                bench_writepatch("obj.pd", spec, blocks[j]) < 0)
+                    return (1);
+            base = bench_runpatch("base.pd", nsamples);
+            withobj = bench_runpatch("obj.pd", nsamples);
+            ns = (withobj - base) / nsamples;
+            if (ns < 0)
+                ns = 0;
+            if (csv)
+                printf("%s,%d,%.3f\n", spec->b_name, blocks[j], ns);
+            else printf("%-12s %8d %14.3f\n", spec->b_name, blocks[j], ns);
+            fflush(stdout);
+        }
+    }
+    return (0);
+}
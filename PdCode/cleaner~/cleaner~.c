@@ -10,14 +10,14 @@
 #include "stdlib.h" 
 #include "math.h" 
 #include "string.h"
+#include "../common/pdcode_arena.h" // scratch shared by the spectral objects
 
 /* The object structure */
 
 typedef struct _cleaner {
 	t_object obj;
 	t_float x_f;
-	float *mag;
-	float *phase;
+	t_pdcode_arena *arena; // holds the magnitude and phase vectors
 	long vecsize;
 } t_cleaner;
 
@@ -53,7 +53,7 @@ void *cleaner_new(void)
     outlet_new(&x->obj, gensym("signal"));
 	outlet_new(&x->obj, gensym("signal"));
 	x->vecsize = 0;
-	x->mag = NULL;
+	x->arena = pdcode_arena_new();
 	return x;
 }
 
@@ -68,18 +68,35 @@ t_int *cleaner_perform(t_int *w)
 	t_float *multiplier = (t_float *) (w[5]);
 	t_float *real_out = (t_float *) (w[6]);
 	t_float *imag_out = (t_float *) (w[7]);
-	float *phase = x->phase;
-	float *mag = x->mag;
 	
 	/* With ifft~ inside a block~ we only operate on 1/2 of the vector */
 	
 	int n = w[8] / 2; 
+	
+	/* 
+	 The magnitude and phase vectors are scratch space, rewritten on
+	 every frame, so they come from the arena shared with other spectral
+	 objects rather than from private memory.
+	 */
+	
+	float *mag = pdcode_arena_get(x->arena);
+	float *phase;
 	float maxamp = 0.0;
 	float mult; // store first value of *multiplier
 	float threshold; // locally generated threshold
 	int i;
 	float a, b; // variables for Polar/Cartesian conversions
 	
+	/* No arena memory: output silence rather than write through NULL */
+	
+	if(!mag){
+		for(i = 0; i <= n; i++){
+			real_out[i] = imag_out[i] = 0.0;
+		}
+		return w + 9;
+	}
+	phase = mag + pdcode_arena_round(n + 1);
+	
 	/* Convert incoming complex spectrum to polar */
 	
 	for (i = 0; i <= n; i++) {
@@ -138,48 +155,24 @@ t_int *cleaner_perform(t_int *w)
 
 void cleaner_free(t_cleaner *x)
 {
-	long bytesize = x->vecsize * sizeof(float);
-	if(x->mag != NULL){
-		freebytes(x->mag,bytesize);
-		freebytes(x->phase,bytesize);
-	}
+	pdcode_arena_free(x->arena);
 }
 
 /* The DSP method */
 
 void cleaner_dsp(t_cleaner *x, t_signal **sp)
 {
-	/*
-	 For demonstration purposes, we use C library functions 
-	 for memory allocation here. In general, it is recommended 
-	 to use the Pd memory functions, as shown in earlier chapters.
-	 */
-	
-	long bytesize; // bytesize for magnitude and phase vectors
-	long old_bytesize; // old bytesize for magnitude and phase vectors
-	
 	/* 
-	 If the vector size has changed, either allocate, or resize memory.
-	 On the first pass, x->vecsize will have been initialized to zero. 
+	 Make sure the shared arena can hold a magnitude and a phase
+	 vector of N/2 + 1 bins each for this block size.
 	 */
 
-	if(x->vecsize != sp[0]->s_n){
-		old_bytesize = x->vecsize * sizeof(float);
-		x->vecsize = sp[0]->s_n;
-		bytesize = x->vecsize * sizeof(float);
-		if(x->mag == NULL){
-			x->phase = (float *) getbytes(bytesize);
-			x->mag = (float *) getbytes(bytesize);
-		}
-		else {
-			x->phase = (float *) resizebytes(x->phase, old_bytesize, bytesize);
-			x->mag = (float *) resizebytes(x->mag, old_bytesize, bytesize);
-		}
-
-		/* Zero out the phase and magnitude vectors */
-
-		memset(x->phase, 0, bytesize);
-		memset(x->mag, 0, bytesize);
+	x->vecsize = sp[0]->s_n;
+	if(!pdcode_arena_reserve(x->arena, 2 * pdcode_arena_round(x->vecsize / 2 + 1))){
+		pd_error(x, "cleaner~: out of memory for block size %ld", x->vecsize);
+		dsp_add_zero(sp[4]->s_vec, sp[0]->s_n);
+		dsp_add_zero(sp[5]->s_vec, sp[0]->s_n);
+		return;
 	}
 	dsp_add(cleaner_perform, 8, x, sp[0]->s_vec, sp[1]->s_vec, sp[2]->s_vec, sp[3]->s_vec, 
 			sp[4]->s_vec, sp[5]->s_vec, sp[0]->s_n);
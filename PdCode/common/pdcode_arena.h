@@ -0,0 +1,151 @@
+/*
+ pdcode_arena.h - a shared scratch arena for the spectral externals
+
+ FFT-domain objects such as cleaner~ need a few frame-sized work vectors
+ that only live for the duration of one perform call. Rather than every
+ instance keeping its own copy, all of them borrow one aligned block of
+ memory, so a stack of spectral effects on large frames touches the same
+ few cache lines instead of a fresh set per object.
+
+ The arena is a small Pd object bound to the symbol "#pdcode_arena", so it
+ is found and shared by every external that includes this header, even
+ though each one is a separate binary. It is reference counted and freed
+ when the last user goes away.
+
+ Usage:
+   new routine:   x->arena = pdcode_arena_new();
+   dsp method:    if(!pdcode_arena_reserve(x->arena, floats_needed)) ...
+   perform:       float *scratch = pdcode_arena_get(x->arena);
+   free routine:  pdcode_arena_free(x->arena);
+
+ The pointer must be fetched in the perform routine, not kept from the dsp
+ method, since another object's reserve may move the memory. Contents do
+ not survive from one perform call to the next. Only use the arena for
+ scratch that is fully rewritten each time; state that carries over from
+ frame to frame (running phases, delay lines) must stay private.
+
+ The arena never shrinks, and a failed reserve leaves the old memory in
+ place, so once an object's reserve has succeeded its perform routine can
+ rely on the arena; if the reserve fails, the dsp method should report it
+ and not add the perform routine.
+ */
+
+#ifndef PDCODE_ARENA_H
+#define PDCODE_ARENA_H
+
+#include "m_pd.h"
+#include <string.h>
+
+/* Bump this if the structure below changes */
+
+#define PDCODE_ARENA_VERSION 1
+
+/* Alignment of the memory handed out, in bytes */
+
+#define PDCODE_ARENA_ALIGN 64
+
+typedef struct _pdcode_arena
+{
+	t_pd a_pd; // so the arena can be bound to a symbol
+	int a_version; // layout version, see above
+	int a_refcount; // number of objects using the arena
+	long a_size; // usable size in floats
+	char *a_raw; // memory as allocated
+	long a_rawbytes; // size of a_raw in bytes
+	float *a_mem; // aligned start of the memory
+} t_pdcode_arena;
+
+/* Round a float count up so that consecutive slices stay aligned */
+
+static long pdcode_arena_round(long nfloats)
+{
+	long chunk = PDCODE_ARENA_ALIGN / sizeof(float);
+	return (nfloats + chunk - 1) / chunk * chunk;
+}
+
+/* Find the shared arena, creating it on first use, and take a reference */
+
+static t_pdcode_arena *pdcode_arena_new(void)
+{
+	t_symbol *s = gensym("#pdcode_arena");
+	t_pdcode_arena *a = (t_pdcode_arena *)s->s_thing;
+	static t_class *arena_class;
+
+	if(a && !strcmp(class_getname(a->a_pd), "pdcode_arena")){
+		if(a->a_version != PDCODE_ARENA_VERSION){
+			post("pdcode_arena: version mismatch, using a private arena");
+		}
+		else {
+			a->a_refcount++;
+			return a;
+		}
+	}
+	if(!arena_class){
+		arena_class = class_new(gensym("pdcode_arena"), 0, 0,
+			sizeof(t_pdcode_arena), CLASS_PD, 0);
+	}
+	a = (t_pdcode_arena *)pd_new(arena_class);
+	a->a_version = PDCODE_ARENA_VERSION;
+	a->a_refcount = 1;
+	a->a_size = 0;
+	a->a_raw = NULL;
+	a->a_rawbytes = 0;
+	a->a_mem = NULL;
+	if(!s->s_thing){
+		pd_bind(&a->a_pd, s);
+	}
+	return a;
+}
+
+/* Make sure the arena holds at least nfloats; call from the dsp method.
+ Returns 1 on success, 0 if the memory couldn't be had */
+
+static int pdcode_arena_reserve(t_pdcode_arena *a, long nfloats)
+{
+	long bytes;
+	char *raw;
+	if(nfloats <= a->a_size){
+		return 1;
+	}
+	nfloats = pdcode_arena_round(nfloats);
+	bytes = nfloats * sizeof(float) + PDCODE_ARENA_ALIGN;
+	raw = (char *)getbytes(bytes);
+	if(!raw){
+		return 0; // keep the old memory for the objects already using it
+	}
+	if(a->a_raw){
+		freebytes(a->a_raw, a->a_rawbytes);
+	}
+	a->a_raw = raw;
+	a->a_rawbytes = bytes;
+	a->a_size = nfloats;
+	a->a_mem = (float *)(((size_t)a->a_raw + PDCODE_ARENA_ALIGN - 1) &
+		~(size_t)(PDCODE_ARENA_ALIGN - 1));
+	return 1;
+}
+
+/* The arena's memory; call from the perform routine */
+
+static float *pdcode_arena_get(t_pdcode_arena *a)
+{
+	return a->a_mem;
+}
+
+/* Drop a reference, freeing the arena with the last one */
+
+static void pdcode_arena_free(t_pdcode_arena *a)
+{
+	t_symbol *s = gensym("#pdcode_arena");
+	if(--a->a_refcount > 0){
+		return;
+	}
+	if(s->s_thing == &a->a_pd){
+		pd_unbind(&a->a_pd, s);
+	}
+	if(a->a_raw){
+		freebytes(a->a_raw, a->a_rawbytes);
+	}
+	pd_free(&a->a_pd);
+}
+
+#endif /* PDCODE_ARENA_H */
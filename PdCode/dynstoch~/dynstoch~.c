@@ -54,6 +54,14 @@ typedef struct _dynstoch
     int use_second_order;    // Toggle for second order mode
 } t_dynstoch;
 
+/* Indices of the modulation inlets, left to right after the main inlet */
+
+#define MOD_MINFREQ (0)
+#define MOD_MAXFREQ (1)
+#define MOD_XDEV (2)
+#define MOD_YDEV (3)
+#define MOD_INLETS (4)
+
 /* The class declaration */
 
 static t_class *dynstoch_class;
@@ -62,12 +70,14 @@ static t_class *dynstoch_class;
 
 void *dynstoch_new(t_symbol *s, short argc, t_atom *argv);
 t_int *dynstoch_perform(t_int *w);
+t_int *dynstoch_perform_mod(t_int *w);
 void dynstoch_dsp(t_dynstoch *x, t_signal **sp, short *count);
 float dynstoch_rand(float min, float max);
 void dynstoch_initwave(t_dynstoch *x);
 void dynstoch_transpose(t_dynstoch *x, t_floatarg tfac);
 void dynstoch_setfreq(t_dynstoch *x, t_floatarg freq);
 void dynstoch_freqbounds(t_dynstoch *x, t_floatarg minf, t_floatarg maxf);
+void dynstoch_modulate(t_dynstoch *x, t_float **mod, int i);
 void dynstoch_free(t_dynstoch *x);
 void dynstoch_tilde_setup(void);
 
@@ -86,8 +96,12 @@ void dynstoch_y_deviation(t_dynstoch *x, t_floatarg ydev);
 void dynstoch_tilde_setup(void)
 {
 	t_class *c;
+	/* 
+	 CLASS_NOPROMOTESIG hands us unconnected modulation inlets as scalars
+	 instead of filled vectors, so the DSP method can tell them apart
+	 */
 	dynstoch_class = class_new(gensym("dynstoch~"),(t_newmethod)dynstoch_new,(t_method)dynstoch_free,
-		sizeof(t_dynstoch),0,A_GIMME,0);
+		sizeof(t_dynstoch),CLASS_NOPROMOTESIG,A_GIMME,0);
 	c = dynstoch_class;
 	CLASS_MAINSIGNALIN(dynstoch_class, t_dynstoch, x_f);
 	class_addmethod(c, (t_method)dynstoch_dsp, gensym("dsp"), A_CANT, 0);	
@@ -122,6 +136,12 @@ void *dynstoch_new(t_symbol *s, short argc, t_atom *argv)
 	int i;
 	
     t_dynstoch *x = (t_dynstoch *) pd_new(dynstoch_class);
+	
+	/* Modulation inlets: min frequency, max frequency, x and y deviation */
+	
+	for(i = 0; i < MOD_INLETS; i++){
+		inlet_new(&x->obj, &x->obj.ob_pd, gensym("signal"), gensym("signal"));
+	}
     outlet_new(&x->obj, gensym("signal"));
     outlet_new(&x->obj, gensym("signal"));
 	
@@ -355,6 +375,39 @@ void dynstoch_freqbounds(t_dynstoch *x, t_floatarg minf, t_floatarg maxf)
 	x->minsamps = x->sr / maxf;
 }
 
+/* 
+ Read the connected modulation inlets at sample i. This is called at the end
+ of each waveform period, just before the nudge, so the new bounds and
+ deviations shape the next period. Unconnected inlets keep the values set
+ by messages.
+ */
+
+void dynstoch_modulate(t_dynstoch *x, t_float **mod, int i)
+{
+	float minf, maxf;
+	if(mod[MOD_MINFREQ]){
+		minf = mod[MOD_MINFREQ][i];
+		if(minf > 0){
+			x->maxsamps = x->sr / minf;
+		}
+	}
+	if(mod[MOD_MAXFREQ]){
+		maxf = mod[MOD_MAXFREQ][i];
+		if(maxf > 0){
+			x->minsamps = x->sr / maxf;
+		}
+	}
+	if(x->minsamps > x->maxsamps){
+		x->minsamps = x->maxsamps;
+	}
+	if(mod[MOD_XDEV]){
+		x->x_devo = mod[MOD_XDEV][i];
+	}
+	if(mod[MOD_YDEV]){
+		x->y_devo = mod[MOD_YDEV][i];
+	}
+}
+
 /* The initwave method */
 
 void dynstoch_initwave(t_dynstoch *x)
@@ -445,6 +498,81 @@ t_int *dynstoch_perform(t_int *w)
 	return w + 5;
 }
 
+/* 
+ The perform routine used when any modulation inlet has a signal connected.
+ It is the same as dynstoch_perform(), except that the modulation inputs are
+ read at the sample where each period ends. Pointers for unconnected inlets
+ are null. Inputs are only read at the current sample, before that sample is
+ written, so it is safe for Pd to share an input vector with an output.
+ */
+
+t_int *dynstoch_perform_mod(t_int *w)
+{
+	t_dynstoch *x = (t_dynstoch *) (w[1]);
+	float *output = (t_float *)(w[2]);
+	float *frequency = (t_float *)(w[3]);
+	t_float *mod[MOD_INLETS];
+	int n = w[8];
+	int i;
+	float frac;
+	int current_segment = x->current_segment;
+	float segpoints = x->segment_durs[x->current_segment];
+	float *extremities = x->extremities;
+	float e1, e2;
+	float sample;
+	mod[MOD_MINFREQ] = (t_float *)(w[4]);
+	mod[MOD_MAXFREQ] = (t_float *)(w[5]);
+	mod[MOD_XDEV] = (t_float *)(w[6]);
+	mod[MOD_YDEV] = (t_float *)(w[7]);
+	e1 = extremities[current_segment];
+	e2 = extremities[current_segment + 1];
+	for(i = 0; i < n; i++){
+		if(x->countdown <= 0){
+			// last point
+			++current_segment;
+			if(current_segment == x->extremities_count){
+				
+				/* 
+				 End of the period: pick up the modulation inputs,
+				 then nudge the waveform and start again. 
+				 */
+				
+				dynstoch_modulate(x, mod, i);
+				dynstoch_nudge(x);
+				current_segment = 0;
+			}
+			
+			/* Advance to the next extremities point */
+			
+			else {
+				e1 = extremities[current_segment];
+				e2 = extremities[current_segment + 1];
+				segpoints = x->segment_durs[current_segment];
+				x->countdown_points = segpoints; // coerced to long
+				x->countdown = x->countdown_points;
+			}
+		}
+
+		frac = (float)x->countdown / (float)x->countdown_points;
+		sample = e1 + frac * (e2 - e1);
+		
+		/* Keep sample values legal */
+		
+		if(fabs(sample) < 0.000001){
+			sample = 0.0;
+		}
+		if(fabs(sample) > 2.0){
+			sample = 0.0;
+		}
+		*output++ = sample;
+		*frequency++ = x->freq;
+		x->countdown--;
+		++x->counter;
+	}
+	x->current_segment = current_segment;
+	return w + 9;
+}
+
 /* The free memory function */
 
 void dynstoch_free(t_dynstoch *x)
@@ -460,6 +588,19 @@ void dynstoch_free(t_dynstoch *x)
 
 void dynstoch_dsp(t_dynstoch *x, t_signal **sp, short *count)
 {
+	t_sample *mod[MOD_INLETS];
+	int i, connected, modulated = 0;
+	
+	/* 
+	 Unconnected modulation inlets arrive as scalars (CLASS_NOPROMOTESIG).
+	 Only connected ones are passed on to the perform routine.
+	 */
+	
+	for(i = 0; i < MOD_INLETS; i++){
+		connected = !sp[i + 1]->s_isscalar;
+		mod[i] = connected ? sp[i + 1]->s_vec : 0;
+		modulated |= connected;
+	}
 	if(sp[0]->s_sr){
 		x->sr = sp[0]->s_sr;
 		x->maxsamps = x->sr / x->minfreq;
@@ -469,9 +610,19 @@ void dynstoch_dsp(t_dynstoch *x, t_signal **sp, short *count)
 			x->firsttime = 0;
 		}
 		
-		/* Skip "extra" input vector  provided by MAINSIGNALIN() */
+		/* 
+		 Skip "extra" input vector provided by MAINSIGNALIN() and the
+		 modulation inputs; the outputs follow them. Choose the plain
+		 routine when nothing is connected so it costs nothing extra.
+		 */
 		
-		dsp_add(dynstoch_perform, 4, x, sp[1]->s_vec, sp[2]->s_vec, sp[0]->s_n);
+		if(modulated){
+			dsp_add(dynstoch_perform_mod, 8, x, sp[5]->s_vec, sp[6]->s_vec,
+				mod[MOD_MINFREQ], mod[MOD_MAXFREQ], mod[MOD_XDEV], mod[MOD_YDEV],
+				sp[0]->s_n);
+		} else {
+			dsp_add(dynstoch_perform, 4, x, sp[5]->s_vec, sp[6]->s_vec, sp[0]->s_n);
+		}
 	}
 }
 
@@ -14,6 +14,14 @@
 
 #define MAX_SEQUENCE 1024
 
+/* Segments of the envelope rendered on the envelope outlet */
+
+#define ENV_ATTACK 0
+#define ENV_DECAY 1
+#define ENV_SUSTAIN 2
+#define ENV_RELEASE 3
+#define ENV_DONE 4
+
 /* The class pointer */
 
 static t_class *retroseq_class;
@@ -51,6 +59,12 @@ typedef struct _retroseq
 	t_atom *pseq_list; // holds permuted lists	
 	short manual_override; // toggle manual override
 	short trigger_sent; // user sent a bang
+	int env_segment; // current envelope segment
+	int env_remaining; // samples left in the current segment
+	float env_value; // current envelope value
+	float env_increment; // per-sample change in the current segment
+	float env_targets[4]; // value at the end of each segment
+	int env_lengths[4]; // length of each segment in samples
 } t_retroseq;
 
 /* Function prototypes */
@@ -64,6 +78,8 @@ void retroseq_tempo(t_retroseq *x, t_symbol *msg, short argc, t_atom *argv);
 void retroseq_durlist(t_retroseq *x, t_symbol *msg, short argc, t_atom *argv);
 void retroseq_freqlist(t_retroseq *x, t_symbol *msg, short argc, t_atom *argv);
 void retroseq_send_adsr(t_retroseq *x);
+void retroseq_compute_adsr(t_retroseq *x, int d_position);
+void retroseq_start_envelope(t_retroseq *x, int d_position);
 void retroseq_adsr(t_retroseq *x, t_symbol *msg, short argc, t_atom *argv);
 void retroseq_sustain_amplitude(t_retroseq * x, t_symbol *msg, short argc, t_atom *argv);
 void retroseq_elastic_sustain(t_retroseq * x, t_symbol *msg, short argc, t_atom *argv);
@@ -122,6 +138,14 @@ void *retroseq_new(t_symbol *s, short argc, t_atom *argv)
     x->bang_outlet = outlet_new(&x->obj, gensym("bang"));
     x->f_plist_outlet = outlet_new(&x->obj, gensym("list"));
 	x->d_plist_outlet = outlet_new(&x->obj, gensym("list"));
+
+	/*
+	 The envelope outlet renders the same ADSR as the list outlet,
+	 sample-accurately and without the help of vline~. It comes last
+	 so that existing patches keep their connections.
+	 */
+
+	outlet_new(&x->obj, gensym("signal"));
 	
 	/* 
 	 In case the sampling rate is zero, we temporarily
@@ -200,6 +224,15 @@ void *retroseq_new(t_symbol *s, short argc, t_atom *argv)
 	x->adsr[2] = 100;
 	x->adsr[3] = 50;
 	x->sustain_amplitude = 0.7;
+	x->manual_override = 0;
+	x->trigger_sent = 0;
+
+	/* The envelope is silent until the first note */
+
+	x->env_segment = ENV_DONE;
+	x->env_value = 0.0;
+	x->env_increment = 0.0;
+	x->env_remaining = 0;
 	x->current_value = x->f_sequence[0];
 	x->counter = x->d_sequence[0] * x->sr/ 1000.0 ;	
 	
@@ -460,14 +493,39 @@ void retroseq_durlist( t_retroseq *x, t_symbol *msg, short argc, t_atom *argv)
 /* The send ADSR method */
 
 void retroseq_send_adsr(t_retroseq *x)
+{
+	t_atom *adsr_list = x->adsr_list;
+	float *adsr_out = x->adsr_out;
+	int i;
+
+	/* Calculate the envelope for the current note */
+
+	retroseq_compute_adsr(x, x->d_position);
+
+	/* Build the ADSR output list */
+	
+	for(i = 0; i < 10; i++){ // build list
+		SETFLOAT(adsr_list+i,adsr_out[i]);
+	}
+	
+	/* Send the ADSR data list to the ADSR list outlet */
+	
+	outlet_list(x->list_outlet,NULL,10,adsr_list); // send list through outlet
+}
+
+/*
+ The ADSR calculation, shared by the list outlet and the envelope
+ outlet. The result in adsr_out is a list of value/time pairs in the
+ form vline~ expects, with the times in milliseconds.
+ */
+
+void retroseq_compute_adsr(t_retroseq *x, int d_position)
 {
 	/* Dereference object components */
 	
-	t_atom *adsr_list = x->adsr_list;
 	float *adsr = x->adsr;
 	float *adsr_out = x->adsr_out;
 	short elastic_sustain = x->elastic_sustain;
-	int d_position = x->d_position;
 	float *d_sequence = x->d_sequence;
 	float tempo = x->tempo;
 	
@@ -476,7 +534,6 @@ void retroseq_send_adsr(t_retroseq *x)
 	float note_duration_ms;
 	float duration_sum;	
 	float rescale ;
-	int i;
 	
 	/* 
 	 Read the current duration from the duration sequence
@@ -543,16 +600,56 @@ void retroseq_send_adsr(t_retroseq *x)
 			adsr_out[9] *= rescale;
 		}
 	}
-	
-	/* Build the ADSR output list */
-	
-	for(i = 0; i < 10; i++){ // build list
-		SETFLOAT(adsr_list+i,adsr_out[i]);
+}
+
+/* Start the envelope outlet on a new note */
+
+void retroseq_start_envelope(t_retroseq *x, int d_position)
+{
+	float *adsr_out = x->adsr_out;
+	float ms_to_samples = x->sr / 1000.0;
+	int i;
+
+	retroseq_compute_adsr(x, d_position);
+
+	/* Convert the four segments from value/time pairs to samples */
+
+	for(i = 0; i < 4; i++){
+		x->env_targets[i] = adsr_out[2 + 2 * i];
+		x->env_lengths[i] = adsr_out[3 + 2 * i] * ms_to_samples;
+		if(x->env_lengths[i] < 1){
+			x->env_lengths[i] = 1;
+		}
 	}
-	
-	/* Send the ADSR data list to the ADSR list outlet */
-	
-	outlet_list(x->list_outlet,NULL,10,adsr_list); // send list through outlet
+
+	/* Like vline~, jump to zero and ramp from there */
+
+	x->env_value = adsr_out[0];
+	x->env_segment = ENV_ATTACK;
+	x->env_remaining = x->env_lengths[ENV_ATTACK];
+	x->env_increment = (x->env_targets[ENV_ATTACK] - x->env_value) / x->env_remaining;
+}
+
+/*
+ Advance the envelope by one sample, moving on to the next segment when the
+ current one runs out, and return its value. Both perform loops call this on
+ their local copies of the envelope state.
+ */
+
+static float retroseq_advance_envelope(int *segment, int *remaining, float *value,
+	float *increment, float *targets, int *lengths)
+{
+	if(*segment < ENV_DONE){
+		*value += *increment;
+		if(! --*remaining){
+			*value = targets[*segment];
+			if(++*segment < ENV_DONE){
+				*remaining = lengths[*segment];
+				*increment = (targets[*segment] - *value) / *remaining;
+			}
+		}
+	}
+	return *value;
 }
 
 
@@ -628,7 +725,8 @@ t_int *retroseq_perform(t_int *w)
 {
 	t_retroseq *x = (t_retroseq *) (w[1]);
 	float *out = (t_float *)(w[2]);
-	int n = w[3];
+	float *env_out = (t_float *)(w[3]);
+	int n = w[4];
 	int f_sequence_length = x->f_sequence_length;
 	int d_sequence_length = x->d_sequence_length;
 	int counter = x->counter;
@@ -640,6 +738,12 @@ t_int *retroseq_perform(t_int *w)
 	float duration_factor = x->duration_factor;
 	short manual_override = x->manual_override;
 	short trigger_sent = x->trigger_sent;
+	int env_segment = x->env_segment;
+	int env_remaining = x->env_remaining;
+	float env_value = x->env_value;
+	float env_increment = x->env_increment;
+	float *env_targets = x->env_targets;
+	int *env_lengths = x->env_lengths;
 	
 	/* The manual override DSP loop */
 	
@@ -671,11 +775,24 @@ t_int *retroseq_perform(t_int *w)
 				 */
 				
 				clock_delay(x->list_clock,0);
+				
+				/* Start the envelope on this very sample */
+				
+				retroseq_start_envelope(x, d_position);
+				env_segment = x->env_segment;
+				env_remaining = x->env_remaining;
+				env_value = x->env_value;
+				env_increment = x->env_increment;
 			}
 			
-			/* Send the current envelope value as a signal */
+			/* Send the current sequence value as a signal */
 			
 			*out++ = current_value;
+			
+			/* Advance the envelope */
+			
+			*env_out++ = retroseq_advance_envelope(&env_segment, &env_remaining,
+				&env_value, &env_increment, env_targets, env_lengths);
 		}
 	} 
 	else {
@@ -707,8 +824,18 @@ t_int *retroseq_perform(t_int *w)
 
 				
 				clock_delay(x->list_clock,0); 
+				
+				/* Start the envelope on this very sample */
+				
+				retroseq_start_envelope(x, d_position);
+				env_segment = x->env_segment;
+				env_remaining = x->env_remaining;
+				env_value = x->env_value;
+				env_increment = x->env_increment;
 			}
 			*out++ = current_value;
+			*env_out++ = retroseq_advance_envelope(&env_segment, &env_remaining,
+				&env_value, &env_increment, env_targets, env_lengths);
 		}
 	}
 	
@@ -719,10 +846,14 @@ t_int *retroseq_perform(t_int *w)
 	x->counter = counter;
 	x->f_position = f_position;
 	x->d_position = d_position;	
+	x->env_segment = env_segment;
+	x->env_remaining = env_remaining;
+	x->env_value = env_value;
+	x->env_increment = env_increment;
 	
 	/* Return the next address on the DSP chain */
 	
-	return w + 4;
+	return w + 5;
 }
 
 /* The DSP method */
@@ -753,10 +884,11 @@ void retroseq_dsp(t_retroseq *x, t_signal **sp, short *count)
 	
 	/* 
 	 Attach retroseq~ to the DSP chain. Note that we skip the
-	 automatically generated signal inlet. 
+	 automatically generated signal inlet. The envelope outlet
+	 is sp[2].
 	 */
 	
-	dsp_add(retroseq_perform, 3, x, sp[1]->s_vec, sp[0]->s_n);
+	dsp_add(retroseq_perform, 4, x, sp[1]->s_vec, sp[2]->s_vec, sp[0]->s_n);
 }
 
 
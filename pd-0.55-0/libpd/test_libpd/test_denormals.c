@@ -0,0 +1,152 @@
+/*
+    test_denormals: check that recursive filters and feedback loops decay
+    to silence without ever producing denormal numbers.  An impulse is sent
+    through lop~, hip~, biquad~, vcf~, bp~, rpole~ and a delay line with
+    feedback, and we listen for a minute -- first with denormals flushed in
+    hardware (where the filters leave out their own checks) and then again
+    after "pd flush-denormals 0" (where they fall back on them).  Exits
+    nonzero if any output sample is denormal or a filter fails to reach
+    silence.  We also check that the flushing mode is really in force when
+    the hardware can do it: the caller's floating-point state is left alone,
+    and an eighth channel, a biquad~ whose state we set to a huge value,
+    shows which perform routine was picked, since only the one for checking
+    in software clips the output sample by sample.
+*/
+
+#include <stdio.h>
+#include <math.h>
+#include <float.h>
+#include <time.h>
+#include "z_libpd.h"
+
+#define NCHANS 7
+#define NOUT (NCHANS + 1)   /* last one is the probe */
+#define SRATE 44100
+#define SECONDS 60
+#define TICKS (SECONDS * SRATE / 64)
+
+static const char *chans[NCHANS] =
+    {"lop~", "hip~", "biquad~", "vcf~", "bp~", "rpole~", "delay feedback"};
+
+int dsp_flushing(void);     /* from d_ugen.c, not part of the API */
+
+void pdprint(const char *s) {
+    printf("%s", s);
+}
+
+    /* run one impulse through the patch; returns the number of failures */
+static int run(const char *mode) {
+    float inbuf[64], outbuf[64 * NOUT];
+    int denormals[NCHANS] = {0}, i, j, failures = 0;
+    clock_t start;
+
+    for (i = 0; i < 64; i++)
+        inbuf[i] = 0;
+    libpd_float("impulse", 1);
+    libpd_process_float(1, inbuf, outbuf);
+    libpd_float("impulse", 0);
+    start = clock();
+    for (i = 1; i < TICKS; i++)
+    {
+        libpd_process_float(1, inbuf, outbuf);
+        for (j = 0; j < 64 * NOUT; j++)
+            if (j % NOUT < NCHANS && fpclassify(outbuf[j]) == FP_SUBNORMAL)
+                denormals[j % NOUT]++;
+    }
+    printf("%s: %.3f s for %d s of audio\n", mode,
+        (double)(clock() - start) / CLOCKS_PER_SEC, SECONDS);
+    for (j = 0; j < NCHANS; j++)
+    {
+        int silent = 1;
+        for (i = j; i < 64 * NOUT; i += NOUT)
+            if (outbuf[i] != 0)
+                silent = 0;
+        if (denormals[j] || !silent)
+        {
+            printf("    FAIL %s: %d denormal samples, %s at the end\n",
+                chans[j], denormals[j], (silent ? "silent" : "not silent"));
+            failures++;
+        }
+    }
+    return (failures);
+}
+
+    /* check that DSP runs flushed or not as it should; returns the number
+    of failures */
+static int probe(const char *mode, int flushed) {
+    float inbuf[64] = {0}, outbuf[64 * NOUT];
+    volatile float tiny = FLT_MIN, half = 0.5f;
+    int failures = 0;
+
+        /* a block from a biquad~ holding 1e30 is 1e30 throughout if it
+        only checks once per block, and zero if it checks every sample */
+    libpd_start_message(2);
+    libpd_add_float(1e30f);
+    libpd_add_float(0);
+    libpd_finish_message("probe", "set");
+    libpd_process_float(1, inbuf, outbuf);
+    if ((outbuf[NCHANS] != 0) != flushed)
+    {
+        printf("    FAIL %s: biquad~ %s its state every sample\n", mode,
+            (flushed ? "checks" : "doesn't check"));
+        failures++;
+    }
+    libpd_process_float(1, inbuf, outbuf);
+    if (outbuf[NCHANS] != 0)
+    {
+        printf("    FAIL %s: biquad~ state not cleared after a block\n",
+            mode);
+        failures++;
+    }
+        /* flushing is only turned on around DSP, not left on for us */
+    if (tiny * half == 0)
+    {
+        printf("    FAIL %s: denormals still flushed after DSP\n", mode);
+        failures++;
+    }
+    return (failures);
+}
+
+int main(int argc, char **argv) {
+    char *filename = "test_denormals.pd", *dirname = ".";
+    int failures;
+    if (argc > 1) filename = argv[1];
+    if (argc > 2) dirname = argv[2];
+
+    libpd_set_printhook(pdprint);
+    libpd_init();
+    libpd_init_audio(0, NOUT, SRATE);
+    libpd_start_message(1);
+    libpd_add_float(1.0f);
+    libpd_finish_message("pd", "dsp");
+    if (!libpd_openfile(filename, dirname))
+    {
+        printf("can't open %s/%s\n", dirname, filename);
+        return 1;
+    }
+
+    if (dsp_flushing())
+    {
+        failures = run("hardware flushing");
+        failures += probe("hardware flushing", 1);
+    }
+    else
+    {
+        printf("hardware flushing: not available here\n");
+        failures = 0;
+    }
+
+    libpd_start_message(1);
+    libpd_add_float(0);
+    libpd_finish_message("pd", "flush-denormals");
+    if (dsp_flushing())
+    {
+        printf("    FAIL: still flushing after \"pd flush-denormals 0\"\n");
+        failures++;
+    }
+    failures += run("checking in software");
+    failures += probe("checking in software", 0);
+
+    printf("%s\n", (failures ? "FAILED" : "passed"));
+    return (failures != 0);
+}
@@ -184,13 +184,14 @@ static void plus_setup(void)
 {
     plus_class = class_new(gensym("+~"), (t_newmethod)plus_new, 0,
         sizeof(t_plus),
-            CLASS_MULTICHANNEL | CLASS_NOPROMOTESIG | CLASS_NOPROMOTELEFT,
+            CLASS_MULTICHANNEL | CLASS_NOPROMOTESIG | CLASS_NOPROMOTELEFT |
+                CLASS_PARALLELSAFE,
                 A_GIMME, 0);
     class_addmethod(plus_class, (t_method)plus_dsp, gensym("dsp"), A_CANT, 0);
     CLASS_MAINSIGNALIN(plus_class, t_plus, x_f);
     class_sethelpsymbol(plus_class, gensym("binops-tilde"));
     scalarplus_class = class_new(gensym("+~"), 0, 0,
-        sizeof(t_scalarplus), CLASS_MULTICHANNEL, 0);
+        sizeof(t_scalarplus), CLASS_MULTICHANNEL | CLASS_PARALLELSAFE, 0);
     CLASS_MAINSIGNALIN(scalarplus_class, t_scalarplus, x_f);
     class_addmethod(scalarplus_class, (t_method)scalarplus_dsp,
         gensym("dsp"), A_CANT, 0);
@@ -335,13 +336,14 @@ static void minus_setup(void)
 {
     minus_class = class_new(gensym("-~"), (t_newmethod)minus_new, 0,
         sizeof(t_minus),
-            CLASS_MULTICHANNEL | CLASS_NOPROMOTESIG | CLASS_NOPROMOTELEFT,
+            CLASS_MULTICHANNEL | CLASS_NOPROMOTESIG | CLASS_NOPROMOTELEFT |
+                CLASS_PARALLELSAFE,
                 A_GIMME, 0);
     CLASS_MAINSIGNALIN(minus_class, t_minus, x_f);
     class_addmethod(minus_class, (t_method)minus_dsp, gensym("dsp"), A_CANT, 0);
     class_sethelpsymbol(minus_class, gensym("binops-tilde"));
     scalarminus_class = class_new(gensym("-~"), 0, 0,
-        sizeof(t_scalarminus), CLASS_MULTICHANNEL, 0);
+        sizeof(t_scalarminus), CLASS_MULTICHANNEL | CLASS_PARALLELSAFE, 0);
     CLASS_MAINSIGNALIN(scalarminus_class, t_scalarminus, x_f);
     class_addmethod(scalarminus_class, (t_method)scalarminus_dsp,
         gensym("dsp"), A_CANT, 0);
@@ -460,13 +462,14 @@ static void times_setup(void)
 {
     times_class = class_new(gensym("*~"), (t_newmethod)times_new, 0,
         sizeof(t_times),
-            CLASS_MULTICHANNEL | CLASS_NOPROMOTESIG | CLASS_NOPROMOTELEFT,
+            CLASS_MULTICHANNEL | CLASS_NOPROMOTESIG | CLASS_NOPROMOTELEFT |
+                CLASS_PARALLELSAFE,
                 A_GIMME, 0);
     CLASS_MAINSIGNALIN(times_class, t_times, x_f);
     class_addmethod(times_class, (t_method)times_dsp, gensym("dsp"), A_CANT, 0);
     class_sethelpsymbol(times_class, gensym("binops-tilde"));
     scalartimes_class = class_new(gensym("*~"), 0, 0,
-        sizeof(t_scalartimes), CLASS_MULTICHANNEL, 0);
+        sizeof(t_scalartimes), CLASS_MULTICHANNEL | CLASS_PARALLELSAFE, 0);
     CLASS_MAINSIGNALIN(scalartimes_class, t_scalartimes, x_f);
     class_addmethod(scalartimes_class, (t_method)scalartimes_dsp,
         gensym("dsp"), A_CANT, 0);
@@ -630,13 +633,14 @@ static void over_setup(void)
 {
     over_class = class_new(gensym("/~"), (t_newmethod)over_new, 0,
         sizeof(t_over),
-            CLASS_MULTICHANNEL | CLASS_NOPROMOTESIG | CLASS_NOPROMOTELEFT,
+            CLASS_MULTICHANNEL | CLASS_NOPROMOTESIG | CLASS_NOPROMOTELEFT |
+                CLASS_PARALLELSAFE,
                 A_GIMME, 0);
     CLASS_MAINSIGNALIN(over_class, t_over, x_f);
     class_addmethod(over_class, (t_method)over_dsp, gensym("dsp"), A_CANT, 0);
     class_sethelpsymbol(over_class, gensym("binops-tilde"));
     scalarover_class = class_new(gensym("/~"), 0, 0,
-        sizeof(t_scalarover), CLASS_MULTICHANNEL, 0);
+        sizeof(t_scalarover), CLASS_MULTICHANNEL | CLASS_PARALLELSAFE, 0);
     CLASS_MAINSIGNALIN(scalarover_class, t_scalarover, x_f);
     class_addmethod(scalarover_class, (t_method)scalarover_dsp,
         gensym("dsp"), A_CANT, 0);
@@ -766,13 +770,14 @@ static void max_setup(void)
 {
     max_class = class_new(gensym("max~"), (t_newmethod)max_new, 0,
         sizeof(t_max),
-            CLASS_MULTICHANNEL | CLASS_NOPROMOTESIG | CLASS_NOPROMOTELEFT,
+            CLASS_MULTICHANNEL | CLASS_NOPROMOTESIG | CLASS_NOPROMOTELEFT |
+                CLASS_PARALLELSAFE,
                 A_GIMME, 0);
     CLASS_MAINSIGNALIN(max_class, t_max, x_f);
     class_addmethod(max_class, (t_method)max_dsp, gensym("dsp"), A_CANT, 0);
     class_sethelpsymbol(max_class, gensym("binops-tilde"));
     scalarmax_class = class_new(gensym("max~"), 0, 0,
-        sizeof(t_scalarmax), CLASS_MULTICHANNEL, 0);
+        sizeof(t_scalarmax), CLASS_MULTICHANNEL | CLASS_PARALLELSAFE, 0);
     CLASS_MAINSIGNALIN(scalarmax_class, t_scalarmax, x_f);
     class_addmethod(scalarmax_class, (t_method)scalarmax_dsp,
         gensym("dsp"), A_CANT, 0);
@@ -902,13 +907,14 @@ static void min_setup(void)
 {
     min_class = class_new(gensym("min~"), (t_newmethod)min_new, 0,
         sizeof(t_min),
-            CLASS_MULTICHANNEL | CLASS_NOPROMOTESIG | CLASS_NOPROMOTELEFT,
+            CLASS_MULTICHANNEL | CLASS_NOPROMOTESIG | CLASS_NOPROMOTELEFT |
+                CLASS_PARALLELSAFE,
                 A_GIMME, 0);
     CLASS_MAINSIGNALIN(min_class, t_min, x_f);
     class_addmethod(min_class, (t_method)min_dsp, gensym("dsp"), A_CANT, 0);
     class_sethelpsymbol(min_class, gensym("binops-tilde"));
     scalarmin_class = class_new(gensym("min~"), 0, 0,
-        sizeof(t_scalarmin), CLASS_MULTICHANNEL, 0);
+        sizeof(t_scalarmin), CLASS_MULTICHANNEL | CLASS_PARALLELSAFE, 0);
     CLASS_MAINSIGNALIN(scalarmin_class, t_scalarmin, x_f);
     class_addmethod(scalarmin_class, (t_method)scalarmin_dsp,
         gensym("dsp"), A_CANT, 0);
@@ -1028,13 +1034,14 @@ static void log_tilde_setup(void)
 {
     log_tilde_class = class_new(gensym("log~"), (t_newmethod)log_tilde_new, 0,
         sizeof(t_log_tilde),
-            CLASS_MULTICHANNEL | CLASS_NOPROMOTESIG | CLASS_NOPROMOTELEFT,
+            CLASS_MULTICHANNEL | CLASS_NOPROMOTESIG | CLASS_NOPROMOTELEFT |
+                CLASS_PARALLELSAFE,
                 A_GIMME, 0);
     CLASS_MAINSIGNALIN(log_tilde_class, t_log_tilde, x_f);
     class_addmethod(log_tilde_class, (t_method)log_tilde_dsp, gensym("dsp"), A_CANT, 0);
     class_sethelpsymbol(log_tilde_class, gensym("binops-tilde"));
     scalarlog_tilde_class = class_new(gensym("log~"), 0, 0,
-        sizeof(t_scalarlog_tilde), CLASS_MULTICHANNEL, 0);
+        sizeof(t_scalarlog_tilde), CLASS_MULTICHANNEL | CLASS_PARALLELSAFE, 0);
     CLASS_MAINSIGNALIN(scalarlog_tilde_class, t_scalarlog_tilde, x_f);
     class_addmethod(scalarlog_tilde_class, (t_method)scalarlog_tilde_dsp,
         gensym("dsp"), A_CANT, 0);
@@ -1145,19 +1152,184 @@ static void pow_tilde_setup(void)
 {
     pow_tilde_class = class_new(gensym("pow~"), (t_newmethod)pow_tilde_new, 0,
         sizeof(t_pow_tilde),
-            CLASS_MULTICHANNEL | CLASS_NOPROMOTESIG | CLASS_NOPROMOTELEFT,
+            CLASS_MULTICHANNEL | CLASS_NOPROMOTESIG | CLASS_NOPROMOTELEFT |
+                CLASS_PARALLELSAFE,
                 A_GIMME, 0);
     CLASS_MAINSIGNALIN(pow_tilde_class, t_pow_tilde, x_f);
     class_addmethod(pow_tilde_class, (t_method)pow_tilde_dsp, gensym("dsp"), A_CANT, 0);
     class_sethelpsymbol(pow_tilde_class, gensym("binops-tilde"));
     scalarpow_tilde_class = class_new(gensym("pow~"), 0, 0,
-        sizeof(t_scalarpow_tilde), CLASS_MULTICHANNEL, 0);
+        sizeof(t_scalarpow_tilde), CLASS_MULTICHANNEL | CLASS_PARALLELSAFE, 0);
     CLASS_MAINSIGNALIN(scalarpow_tilde_class, t_scalarpow_tilde, x_f);
     class_addmethod(scalarpow_tilde_class, (t_method)scalarpow_tilde_dsp,
         gensym("dsp"), A_CANT, 0);
     class_sethelpsymbol(scalarpow_tilde_class, gensym("binops-tilde"));
 }
 
+/* ----------------------- fusing binops ---------------------------- */
+
+    /* Chains of arithmetic such as "osc~ -> *~ 0.5 -> +~ 1" are common
+    enough that it's worth doing two adjacent operations in one pass, when
+    the second reads the first's output; dsp_add() asks us about each pair
+    as the chain is built.  The fused routine takes the place of the first
+    one's function word, performs both, and returns past the second, so the
+    chain keeps its layout.  The intermediate vector is still written since
+    we don't know who else reads it.  The kernels below are generated for
+    each pair of operations, and for vector/vector second operations, for
+    either side being the intermediate. */
+
+#define FUSE_OP_plus(f, g) ((f) + (g))
+#define FUSE_OP_minus(f, g) ((f) - (g))
+#define FUSE_OP_times(f, g) ((f) * (g))
+#define FUSE_OP_scalarplus(f, g) ((f) + (g))
+#define FUSE_OP_scalarminus(f, g) ((f) - (g))
+#define FUSE_OP_reversescalarminus(f, g) ((g) - (f))
+#define FUSE_OP_scalartimes(f, g) ((f) * (g))
+
+    /* second operand: V for a vector, S for a scalar read once */
+#define FUSE_DECL_V(g, arg) t_sample *g = (t_sample *)(arg);
+#define FUSE_DECL_S(g, arg) t_float g = *(t_float *)(arg);
+#define FUSE_GET_V(g, i) g[i]
+#define FUSE_GET_S(g, i) g
+
+    /* which side of the second operation the intermediate is on */
+#define FUSE_OTHER_L 7
+#define FUSE_OTHER_R 6
+#define FUSE_APPLY_L(op, t, g) op(t, g)
+#define FUSE_APPLY_R(op, t, g) op(g, t)
+
+    /* the fused result has to match the unfused chain bit for bit, so the
+    compiler mustn't contract a multiply and the following add into an fma
+    (as -ffp-contract=fast, implied by -ffast-math, otherwise allows.) */
+#if defined(__clang__)
+#define FUSE_NOCONTRACT_ATTR
+#define FUSE_NOCONTRACT _Pragma("clang fp contract(off)")
+#elif defined(__GNUC__)
+#define FUSE_NOCONTRACT_ATTR __attribute__((optimize("fp-contract=off")))
+#define FUSE_NOCONTRACT
+#else
+#define FUSE_NOCONTRACT_ATTR
+#define FUSE_NOCONTRACT _Pragma("STDC FP_CONTRACT OFF")
+#endif
+
+#define FUSE_KERNEL(A, KA, B, KB, SIDE)                                     \
+static FUSE_NOCONTRACT_ATTR t_int *fuse_##A##_##B##SIDE(t_int *w)           \
+{                                                                           \
+    FUSE_NOCONTRACT                                                         \
+    t_sample *in = (t_sample *)(w[1]);                                      \
+    t_sample *mid = (t_sample *)(w[3]);                                     \
+    t_sample *out = (t_sample *)(w[8]);                                     \
+    int i, n = (int)(w[4]);                                                 \
+    FUSE_DECL_##KA(g1, w[2])                                                \
+    FUSE_DECL_##KB(g2, w[FUSE_OTHER_##SIDE])                                \
+    for (i = 0; i < n; i++)                                                 \
+    {                                                                       \
+        t_sample t = FUSE_OP_##A(in[i], FUSE_GET_##KA(g1, i));              \
+        mid[i] = t;                                                         \
+        out[i] = FUSE_APPLY_##SIDE(FUSE_OP_##B, t, FUSE_GET_##KB(g2, i));   \
+    }                                                                       \
+    return (w+10);                                                          \
+}
+
+#define FUSE_KERNELS(A, KA)                                                 \
+    FUSE_KERNEL(A, KA, plus, V, L) FUSE_KERNEL(A, KA, plus, V, R)           \
+    FUSE_KERNEL(A, KA, minus, V, L) FUSE_KERNEL(A, KA, minus, V, R)         \
+    FUSE_KERNEL(A, KA, times, V, L) FUSE_KERNEL(A, KA, times, V, R)         \
+    FUSE_KERNEL(A, KA, scalarplus, S, L)                                    \
+    FUSE_KERNEL(A, KA, scalarminus, S, L)                                   \
+    FUSE_KERNEL(A, KA, reversescalarminus, S, L)                            \
+    FUSE_KERNEL(A, KA, scalartimes, S, L)
+
+FUSE_KERNELS(plus, V)
+FUSE_KERNELS(minus, V)
+FUSE_KERNELS(times, V)
+FUSE_KERNELS(scalarplus, S)
+FUSE_KERNELS(scalarminus, S)
+FUSE_KERNELS(reversescalarminus, S)
+FUSE_KERNELS(scalartimes, S)
+
+#define FUSE_ROW(A) {                                                       \
+    {fuse_##A##_plusL, fuse_##A##_plusR},                                   \
+    {fuse_##A##_minusL, fuse_##A##_minusR},                                 \
+    {fuse_##A##_timesL, fuse_##A##_timesR},                                 \
+    {fuse_##A##_scalarplusL, 0},                                            \
+    {fuse_##A##_scalarminusL, 0},                                           \
+    {fuse_##A##_reversescalarminusL, 0},                                    \
+    {fuse_##A##_scalartimesL, 0}}
+
+#define NFUSEOP 7
+#define FUSENSCALAR 3   /* operations before this have vector operands */
+
+static const t_perfroutine fuse_kernels[NFUSEOP][NFUSEOP][2] = {
+    FUSE_ROW(plus),
+    FUSE_ROW(minus),
+    FUSE_ROW(times),
+    FUSE_ROW(scalarplus),
+    FUSE_ROW(scalarminus),
+    FUSE_ROW(reversescalarminus),
+    FUSE_ROW(scalartimes),
+};
+
+static const struct
+{
+    t_perfroutine f_fn;
+    int f_op;
+} fuse_ops[] = {
+    {plus_perform, 0}, {plus_perf8, 0},
+    {minus_perform, 1}, {minus_perf8, 1},
+    {times_perform, 2}, {times_perf8, 2},
+    {scalarplus_perform, 3}, {scalarplus_perf8, 3},
+    {scalarminus_perform, 4}, {scalarminus_perf8, 4},
+    {reversescalarminus_perform, 5}, {reversescalarminus_perf8, 5},
+    {scalartimes_perform, 6}, {scalartimes_perf8, 6},
+};
+
+static int fuse_whichop(t_int fn)
+{
+    int i;
+    for (i = 0; i < (int)(sizeof(fuse_ops)/sizeof(*fuse_ops)); i++)
+        if ((t_int)fuse_ops[i].f_fn == fn)
+            return (fuse_ops[i].f_op);
+    return (-1);
+}
+
+    /* the kernels work one sample at a time, so vectors must be either the
+    same or not overlap at all */
+static int fuse_apart(t_int a, t_int b, int n)
+{
+    t_sample *x = (t_sample *)a, *y = (t_sample *)b;
+    return (x == y || x + n <= y || y + n <= x);
+}
+
+    /* "w" points to an operation on the DSP chain followed by another one.
+    If they can be fused return the routine to replace the first one's
+    function with, otherwise zero. */
+t_perfroutine d_arithmetic_fuse(t_int *w)
+{
+    int op1, op2, side, n = (int)w[4], i, j;
+    t_int vec[5];
+    if ((op1 = fuse_whichop(w[0])) < 0 || (op2 = fuse_whichop(w[5])) < 0 ||
+        n < 1 || w[9] != n)
+            return (0);
+    if (w[6] == w[3])
+        side = 0;
+    else if (op2 < FUSENSCALAR && w[7] == w[3])
+        side = 1;
+    else return (0);
+        /* the second scalar is read before the first loop runs */
+    if (op2 >= FUSENSCALAR && (t_sample *)w[7] >= (t_sample *)w[3] &&
+        (t_sample *)w[7] < (t_sample *)w[3] + n)
+            return (0);
+    vec[0] = w[1]; vec[1] = w[3]; vec[2] = w[8];
+    vec[3] = (op1 < FUSENSCALAR ? w[2] : w[1]);
+    vec[4] = (op2 < FUSENSCALAR ? w[7 - side] : w[8]);
+    for (i = 0; i < 5; i++)
+        for (j = i+1; j < 5; j++)
+            if (!fuse_apart(vec[i], vec[j], n))
+                return (0);
+    return (fuse_kernels[op1][op2][side]);
+}
+
 /* ----------------------- global setup routine ---------------- */
 void d_arithmetic_setup(void)
 {
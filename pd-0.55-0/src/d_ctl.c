@@ -16,30 +16,67 @@ typedef struct _sig
 {
     t_object x_obj;
     t_float x_f;
+    t_sigeventq x_events;   /* values waiting for their sample to come */
 } t_sig;
 
+    /* while DSP is running, a new value takes effect at the sample its
+    message was sent at (see sigeventq_add() in d_ugen.c) rather than at the
+    start of the next block, unless we're asked for 0.54 compatibility. */
 static void sig_tilde_float(t_sig *x, t_float f)
 {
-    x->x_f = f;
+    if (!pd_getdspstate() || pd_compatibilitylevel < 55 ||
+        !sigeventq_add(&x->x_events, 0, f))
+    {
+        sigeventq_clear(&x->x_events);
+        x->x_f = f;
+    }
+}
+
+static t_int *sig_tilde_perform(t_int *w)
+{
+    t_sig *x = (t_sig *)(w[1]);
+    t_sample *out = (t_sample *)(w[2]);
+    int n = (int)(w[3]), i = 0, until;
+    t_sample f = x->x_f;
+    t_sigevent e;
+    sigeventq_startblock(&x->x_events, n);
+    while (1)
+    {
+        until = sigeventq_next(&x->x_events, n, &e);
+        for (; i < until; i++)
+            out[i] = f;
+        if (until == n)
+            break;
+        f = x->x_f = e.e_f;
+    }
+    return (w+4);
 }
 
 static void sig_tilde_dsp(t_sig *x, t_signal **sp)
 {
-    dsp_add_scalarcopy(&x->x_f, sp[0]->s_vec, (t_int)sp[0]->s_n);
+    sigeventq_dsp(&x->x_events, sp[0]->s_sr);
+    dsp_add(sig_tilde_perform, 3, x, sp[0]->s_vec, (t_int)sp[0]->s_n);
 }
 
 static void *sig_tilde_new(t_floatarg f)
 {
     t_sig *x = (t_sig *)pd_new(sig_tilde_class);
     x->x_f = f;
+    sigeventq_init(&x->x_events);
     outlet_new(&x->x_obj, gensym("signal"));
     return (x);
 }
 
+static void sig_tilde_free(t_sig *x)
+{
+    sigeventq_free(&x->x_events);
+}
+
 static void sig_tilde_setup(void)
 {
-    sig_tilde_class = class_new(gensym("sig~"), (t_newmethod)sig_tilde_new, 0,
-        sizeof(t_sig), 0, A_DEFFLOAT, 0);
+    sig_tilde_class = class_new(gensym("sig~"), (t_newmethod)sig_tilde_new,
+        (t_method)sig_tilde_free, sizeof(t_sig), CLASS_PARALLELSAFE,
+            A_DEFFLOAT, 0);
     class_addfloat(sig_tilde_class, (t_method)sig_tilde_float);
     class_addmethod(sig_tilde_class, (t_method)sig_tilde_dsp,
         gensym("dsp"), A_CANT, 0);
@@ -180,7 +217,7 @@ static void *line_tilde_new(void)
 static void line_tilde_setup(void)
 {
     line_tilde_class = class_new(gensym("line~"), line_tilde_new, 0,
-        sizeof(t_line), 0, 0);
+        sizeof(t_line), CLASS_PARALLELSAFE, 0);
     class_addfloat(line_tilde_class, (t_method)line_tilde_float);
     class_addmethod(line_tilde_class, (t_method)line_tilde_dsp,
         gensym("dsp"), A_CANT, 0);
@@ -262,7 +299,7 @@ static t_int *vline_tilde_perform(t_int *w)
                 x->x_target = s->s_target;
                 x->x_targettime = s->s_targettime;
                 x->x_list = s->s_next;
-                t_freebytes(s, sizeof(*s));
+                rt_freebytes(s, sizeof(*s));
                 s = x->x_list;
                 goto checknext;
             }
@@ -281,7 +318,7 @@ static void vline_tilde_stop(t_vline *x)
 {
     t_vseg *s1, *s2;
     for (s1 = x->x_list; s1; s1 = s2)
-        s2 = s1->s_next, t_freebytes(s1, sizeof(*s1));
+        s2 = s1->s_next, rt_freebytes(s1, sizeof(*s1));
     x->x_list = 0;
     x->x_inc = 0;
     x->x_inlet1 = x->x_inlet2 = 0;
@@ -306,7 +343,7 @@ static void vline_tilde_float(t_vline *x, t_float f)
         vline_tilde_stop(x);
         return;
     }
-    snew = (t_vseg *)t_getbytes(sizeof(*snew));
+    snew = (t_vseg *)rt_getbytes(sizeof(*snew));
         /* check if we supplant the first item in the list.  We supplant
         an item by having an earlier starttime, or an equal starttime unless
         the equal one was instantaneous and the new one isn't (in which case
@@ -338,7 +375,7 @@ static void vline_tilde_float(t_vline *x, t_float f)
     while (deletefrom)
     {
         s1 = deletefrom->s_next;
-        t_freebytes(deletefrom, sizeof(*deletefrom));
+        rt_freebytes(deletefrom, sizeof(*deletefrom));
         deletefrom = s1;
     }
     snew->s_next = 0;
@@ -374,7 +411,7 @@ static void *vline_tilde_new(void)
 static void vline_tilde_setup(void)
 {
     vline_tilde_class = class_new(gensym("vline~"), vline_tilde_new,
-        (t_method)vline_tilde_stop, sizeof(t_vline), 0, 0);
+        (t_method)vline_tilde_stop, sizeof(t_vline), CLASS_PARALLELSAFE, 0);
     class_addfloat(vline_tilde_class, (t_method)vline_tilde_float);
     class_addmethod(vline_tilde_class, (t_method)vline_tilde_dsp,
         gensym("dsp"), A_CANT, 0);
@@ -428,7 +465,7 @@ static void snapshot_tilde_set(t_snapshot *x, t_floatarg f)
 static void snapshot_tilde_setup(void)
 {
     snapshot_tilde_class = class_new(gensym("snapshot~"), snapshot_tilde_new, 0,
-        sizeof(t_snapshot), 0, 0);
+        sizeof(t_snapshot), CLASS_PARALLELSAFE, 0);
     CLASS_MAINSIGNALIN(snapshot_tilde_class, t_snapshot, x_f);
     class_addmethod(snapshot_tilde_class, (t_method)snapshot_tilde_dsp,
         gensym("dsp"), A_CANT, 0);
@@ -516,7 +553,7 @@ static void vsnapshot_tilde_setup(void)
 {
     vsnapshot_tilde_class = class_new(gensym("vsnapshot~"),
         vsnapshot_tilde_new, (t_method)vsnapshot_tilde_ff,
-        sizeof(t_vsnapshot), 0, 0);
+        sizeof(t_vsnapshot), CLASS_PARALLELSAFE, 0);
     CLASS_MAINSIGNALIN(vsnapshot_tilde_class, t_vsnapshot, x_f);
     class_addmethod(vsnapshot_tilde_class, (t_method)vsnapshot_tilde_dsp,
         gensym("dsp"), A_CANT, 0);
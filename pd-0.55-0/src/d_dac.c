@@ -10,7 +10,7 @@
 #include <string.h>
 
 /* ----------------------------- dac~ --------------------------- */
-static t_class *dac_class;
+t_class *dac_class;
 
 typedef struct _dac
 {
@@ -88,7 +88,7 @@ static void dac_setup(void)
 }
 
 /* ----------------------------- adc~ --------------------------- */
-static t_class *adc_class;
+t_class *adc_class;
 
 typedef struct _adc
 {
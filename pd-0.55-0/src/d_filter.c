@@ -5,12 +5,36 @@
 /*  "filters", both linear and nonlinear.
 */
 #include "m_pd.h"
+#include <string.h>
+
+/* ---------- per-channel state and lanes for multichannel filters -------- */
+
+    /* Filters that take multichannel signals keep their state per channel
+    and run FILTER_LANES channels side by side.  The inner loops over lanes
+    do the same arithmetic on independent data, so the compiler turns them
+    into SIMD operations, whereas filtering one channel after another is a
+    chain of dependent scalar operations.  Channels left over at the end go
+    through the mono loop. */
+#define FILTER_LANES 8
+
+    /* resize a state array of "size" bytes per channel, keeping the
+    channels that survive and clearing new ones */
+static void *filter_resizestate(void *state, int oldchans, int newchans,
+    size_t size)
+{
+    state = resizebytes(state, oldchans * size, newchans * size);
+    if (newchans > oldchans)
+        memset((char *)state + oldchans * size, 0,
+            (newchans - oldchans) * size);
+    return (state);
+}
 
 /* ---------------- hip~ - 1-pole 1-zero hipass filter. ----------------- */
 
 typedef struct hipctl
 {
-    t_sample c_x;
+    t_sample *c_x;      /* last value, one per channel */
+    int c_nchans;       /* number of channels */
     t_sample c_coef;
 } t_hipctl;
 
@@ -32,7 +56,8 @@ static void *sighip_new(t_floatarg f)
     inlet_new(&x->x_obj, &x->x_obj.ob_pd, gensym("float"), gensym("ft1"));
     outlet_new(&x->x_obj, &s_signal);
     x->x_sr = 44100;
-    x->x_cspace.c_x = 0;
+    x->x_cspace.c_x = (t_sample *)getbytes(sizeof(t_sample));
+    x->x_cspace.c_nchans = 1;
     sighip_ft1(x, f);
     x->x_f = 0;
     return (x);
@@ -55,27 +80,50 @@ static t_int *sighip_perform(t_int *w)
     t_sample *out = (t_sample *)(w[2]);
     t_hipctl *c = (t_hipctl *)(w[3]);
     int n = (int)w[4];
-    int i;
-    t_sample last = c->c_x;
+    int i, k, ch = 0;
     t_sample coef = c->c_coef;
     if (coef < 1)
     {
         t_sample normal = 0.5*(1+coef);
-        for (i = 0; i < n; i++)
+        for (; ch + FILTER_LANES <= c->c_nchans; ch += FILTER_LANES)
         {
-            t_sample new = *in++ + coef * last;
-            *out++ = normal * (new - last);
-            last = new;
+            t_sample *lin = in + ch * n, *lout = out + ch * n;
+            t_sample last[FILTER_LANES], new[FILTER_LANES];
+            for (k = 0; k < FILTER_LANES; k++)
+                last[k] = c->c_x[ch + k];
+            for (i = 0; i < n; i++)
+            {
+                for (k = 0; k < FILTER_LANES; k++)
+                    new[k] = lin[k * n + i] + coef * last[k];
+                for (k = 0; k < FILTER_LANES; k++)
+                    lout[k * n + i] = normal * (new[k] - last[k]);
+                for (k = 0; k < FILTER_LANES; k++)
+                    last[k] = new[k];
+            }
+            for (k = 0; k < FILTER_LANES; k++)
+                c->c_x[ch + k] = (PD_BIGORSMALL(last[k]) ? 0 : last[k]);
+        }
+        for (; ch < c->c_nchans; ch++)
+        {
+            t_sample *lin = in + ch * n, *lout = out + ch * n;
+            t_sample last = c->c_x[ch];
+            for (i = 0; i < n; i++)
+            {
+                t_sample new = *lin++ + coef * last;
+                *lout++ = normal * (new - last);
+                last = new;
+            }
+            if (PD_BIGORSMALL(last))
+                last = 0;
+            c->c_x[ch] = last;
         }
-        if (PD_BIGORSMALL(last))
-            last = 0;
-        c->c_x = last;
     }
     else
     {
-        for (i = 0; i < n; i++)
+        for (i = 0; i < n * c->c_nchans; i++)
             *out++ = *in++;
-        c->c_x = 0;
+        for (ch = 0; ch < c->c_nchans; ch++)
+            c->c_x[ch] = 0;
     }
     return (w+5);
 }
@@ -86,34 +134,46 @@ static t_int *sighip_perform_old(t_int *w)
     t_sample *out = (t_sample *)(w[2]);
     t_hipctl *c = (t_hipctl *)(w[3]);
     int n = (int)w[4];
-    int i;
-    t_sample last = c->c_x;
+    int i, ch;
     t_sample coef = c->c_coef;
     if (coef < 1)
     {
-        for (i = 0; i < n; i++)
+        for (ch = 0; ch < c->c_nchans; ch++)
         {
-            t_sample new = *in++ + coef * last;
-            *out++ = new - last;
-            last = new;
+            t_sample last = c->c_x[ch];
+            for (i = 0; i < n; i++)
+            {
+                t_sample new = *in++ + coef * last;
+                *out++ = new - last;
+                last = new;
+            }
+            if (PD_BIGORSMALL(last))
+                last = 0;
+            c->c_x[ch] = last;
         }
-        if (PD_BIGORSMALL(last))
-            last = 0;
-        c->c_x = last;
     }
     else
     {
-        for (i = 0; i < n; i++)
+        for (i = 0; i < n * c->c_nchans; i++)
             *out++ = *in++;
-        c->c_x = 0;
+        for (ch = 0; ch < c->c_nchans; ch++)
+            c->c_x[ch] = 0;
     }
     return (w+5);
 }
 
 static void sighip_dsp(t_sighip *x, t_signal **sp)
 {
+    int nchans = sp[0]->s_nchans;
     x->x_sr = sp[0]->s_sr;
     sighip_ft1(x,  x->x_hz);
+    if (nchans != x->x_cspace.c_nchans)
+    {
+        x->x_cspace.c_x = (t_sample *)filter_resizestate(x->x_cspace.c_x,
+            x->x_cspace.c_nchans, nchans, sizeof(t_sample));
+        x->x_cspace.c_nchans = nchans;
+    }
+    signal_setmultiout(&sp[1], nchans);
     dsp_add((pd_compatibilitylevel > 43 ?
         sighip_perform : sighip_perform_old),
             4, sp[0]->s_vec, sp[1]->s_vec, &x->x_cspace, (t_int)sp[0]->s_n);
@@ -121,13 +181,19 @@ static void sighip_dsp(t_sighip *x, t_signal **sp)
 
 static void sighip_clear(t_sighip *x, t_floatarg q)
 {
-    x->x_cspace.c_x = 0;
+    memset(x->x_cspace.c_x, 0, x->x_cspace.c_nchans * sizeof(t_sample));
+}
+
+static void sighip_free(t_sighip *x)
+{
+    freebytes(x->x_cspace.c_x, x->x_cspace.c_nchans * sizeof(t_sample));
 }
 
 void sighip_setup(void)
 {
-    sighip_class = class_new(gensym("hip~"), (t_newmethod)sighip_new, 0,
-        sizeof(t_sighip), 0, A_DEFFLOAT, 0);
+    sighip_class = class_new(gensym("hip~"), (t_newmethod)sighip_new,
+        (t_method)sighip_free, sizeof(t_sighip),
+            CLASS_MULTICHANNEL | CLASS_PARALLELSAFE, A_DEFFLOAT, 0);
     CLASS_MAINSIGNALIN(sighip_class, t_sighip, x_f);
     class_addmethod(sighip_class, (t_method)sighip_dsp,
         gensym("dsp"), A_CANT, 0);
@@ -142,7 +208,9 @@ typedef struct siglop
 {
     t_object x_obj;
     t_float x_conversion;   /* frequency-to-coefficient conversion factor */
-    t_sample x_last;        /* last output */
+    t_sample *x_last;       /* last output, one per channel */
+    int x_nchans;           /* number of channels */
+    int x_nhzchans;         /* channels in the frequency input if a signal */
     t_float x_hz;           /* rolloff frequency in hz  (for scalar inlet) */
     t_sample x_coef;        /* filter coefficient (for scalar inlet) */
     t_float x_f;            /* value of first inlet if unconnected */
@@ -157,14 +225,21 @@ static void *siglop_new(t_floatarg f)
     t_siglop *x = (t_siglop *)pd_new(siglop_class);
     signalinlet_new(&x->x_obj, f);
     outlet_new(&x->x_obj, &s_signal);
-    x->x_conversion =  x->x_last = x->x_hz = x->x_coef = 0;
+    x->x_conversion = x->x_hz = x->x_coef = 0;
+    x->x_last = (t_sample *)getbytes(sizeof(t_sample));
+    x->x_nchans = x->x_nhzchans = 1;
     x->x_f = 0;
     return (x);
 }
 
 static void siglop_clear(t_siglop *x, t_floatarg q)
 {
-    x->x_last = 0;
+    memset(x->x_last, 0, x->x_nchans * sizeof(t_sample));
+}
+
+static void siglop_free(t_siglop *x)
+{
+    freebytes(x->x_last, x->x_nchans * sizeof(t_sample));
 }
 
 static t_int *siglop_perf_scalar(t_int *w)
@@ -173,8 +248,8 @@ static t_int *siglop_perf_scalar(t_int *w)
     t_sample *in1 = (t_sample *)(w[2]);
     t_sample newhz = *(t_sample *)(w[3]);
     t_sample *out = (t_sample *)(w[4]);
-    int i, n = (int)w[5];
-    t_sample last = x->x_last, coef, feedback;
+    int i, k, ch = 0, n = (int)w[5];
+    t_sample coef, feedback;
     if (newhz != x->x_hz)
     {
         x->x_hz = newhz;
@@ -187,52 +262,93 @@ static t_int *siglop_perf_scalar(t_int *w)
     }
     else coef = x->x_coef;
     feedback = 1.f - coef;
-    for (i = 0; i < n; i++)
-        last = *out++ = coef * *in1++ + feedback * last;
-    if (PD_BIGORSMALL(last))
-        last = 0;
-    x->x_last = last;
+    for (; ch + FILTER_LANES <= x->x_nchans; ch += FILTER_LANES)
+    {
+        t_sample *lin = in1 + ch * n, *lout = out + ch * n;
+        t_sample last[FILTER_LANES], next[FILTER_LANES];
+        for (k = 0; k < FILTER_LANES; k++)
+            last[k] = x->x_last[ch + k];
+        for (i = 0; i < n; i++)
+        {
+            for (k = 0; k < FILTER_LANES; k++)
+                next[k] = lin[k * n + i];
+            for (k = 0; k < FILTER_LANES; k++)
+                last[k] = coef * next[k] + feedback * last[k];
+            for (k = 0; k < FILTER_LANES; k++)
+                lout[k * n + i] = last[k];
+        }
+        for (k = 0; k < FILTER_LANES; k++)
+            x->x_last[ch + k] = (PD_BIGORSMALL(last[k]) ? 0 : last[k]);
+    }
+    for (; ch < x->x_nchans; ch++)
+    {
+        t_sample *lin = in1 + ch * n, *lout = out + ch * n;
+        t_sample last = x->x_last[ch];
+        for (i = 0; i < n; i++)
+            last = *lout++ = coef * *lin++ + feedback * last;
+        if (PD_BIGORSMALL(last))
+            last = 0;
+        x->x_last[ch] = last;
+    }
     return (w+6);
 }
 
+    /* with a signal frequency the coefficient changes every sample, so
+    channels are filtered one by one, each reading its own channel of the
+    frequency input (wrapping around if that has fewer channels) */
 static t_int *siglop_perf_vector(t_int *w)
 {
     t_siglop *x = (t_siglop *)(w[1]);
     t_sample *in1 = (t_sample *)(w[2]);
     t_sample *in2 = (t_sample *)(w[3]);
     t_sample *out = (t_sample *)(w[4]);
-    int i, n = (int)w[5];
-    t_sample last = x->x_last, coef;
+    int i, ch, n = (int)w[5];
 
-    for (i = 0; i < n; i++)
+    for (ch = 0; ch < x->x_nchans; ch++)
     {
-        coef = *in2++ * x->x_conversion;
-        if (coef > 1)
-            coef = 1;
-        else if (coef < 0)
-            coef = 0;
-        last = *out++ = coef * *in1++ + (1.f - coef) * last;
-        /* this formulation seems to run slower, at least on Intel hardware:
-            *out++ = (last += coef * (*in1++ - last)); */
+        t_sample *hz = in2 + (ch % x->x_nhzchans) * n;
+        t_sample last = x->x_last[ch], coef;
+        for (i = 0; i < n; i++)
+        {
+            coef = *hz++ * x->x_conversion;
+            if (coef > 1)
+                coef = 1;
+            else if (coef < 0)
+                coef = 0;
+            last = *out++ = coef * *in1++ + (1.f - coef) * last;
+            /* this formulation seems to run slower, at least on Intel
+            hardware: *out++ = (last += coef * (*in1++ - last)); */
+        }
+        if (PD_BIGORSMALL(last))
+            last = 0;
+        x->x_last[ch] = last;
     }
-    if (PD_BIGORSMALL(last))
-        last = 0;
-    x->x_last = last;
     return (w+6);
 }
 
 static void siglop_dsp(t_siglop *x, t_signal **sp)
 {
+    int nchans = sp[0]->s_nchans;
     x->x_conversion = (2*3.14159)/sp[0]->s_sr;
     x->x_hz = x->x_coef = 0;    /* this will be updated at perf time */
+    if (nchans != x->x_nchans)
+    {
+        x->x_last = (t_sample *)filter_resizestate(x->x_last,
+            x->x_nchans, nchans, sizeof(t_sample));
+        x->x_nchans = nchans;
+    }
+    x->x_nhzchans = sp[1]->s_nchans;
+    signal_setmultiout(&sp[2], nchans);
     dsp_add((sp[1]->s_n > 1 ? siglop_perf_vector : siglop_perf_scalar), 5,
         x, sp[0]->s_vec, sp[1]->s_vec, sp[2]->s_vec, (t_int)sp[0]->s_n);
 }
 
 void siglop_setup(void)
 {
-    siglop_class = class_new(gensym("lop~"), (t_newmethod)siglop_new, 0,
-        sizeof(t_siglop), CLASS_NOPROMOTESIG, A_DEFFLOAT, 0);
+    siglop_class = class_new(gensym("lop~"), (t_newmethod)siglop_new,
+        (t_method)siglop_free, sizeof(t_siglop),
+            CLASS_MULTICHANNEL | CLASS_NOPROMOTESIG | CLASS_PARALLELSAFE,
+                A_DEFFLOAT, 0);
     CLASS_MAINSIGNALIN(siglop_class, t_siglop, x_f);
     class_addmethod(siglop_class, (t_method)siglop_dsp,
         gensym("dsp"), A_CANT, 0);
@@ -362,7 +478,7 @@ static void sigbp_dsp(t_sigbp *x, t_signal **sp)
 void sigbp_setup(void)
 {
     sigbp_class = class_new(gensym("bp~"), (t_newmethod)sigbp_new, 0,
-        sizeof(t_sigbp), 0, A_DEFFLOAT, A_DEFFLOAT, 0);
+        sizeof(t_sigbp), CLASS_PARALLELSAFE, A_DEFFLOAT, A_DEFFLOAT, 0);
     CLASS_MAINSIGNALIN(sigbp_class, t_sigbp, x_f);
     class_addmethod(sigbp_class, (t_method)sigbp_dsp,
         gensym("dsp"), A_CANT, 0);
@@ -377,8 +493,8 @@ void sigbp_setup(void)
 
 typedef struct biquadctl
 {
-    t_sample c_x1;
-    t_sample c_x2;
+    t_sample *c_x;      /* last two values, a pair per channel */
+    int c_nchans;       /* number of channels */
     t_sample c_fb1;
     t_sample c_fb2;
     t_sample c_ff1;
@@ -401,40 +517,90 @@ static void *sigbiquad_new(t_symbol *s, int argc, t_atom *argv)
 {
     t_sigbiquad *x = (t_sigbiquad *)pd_new(sigbiquad_class);
     outlet_new(&x->x_obj, &s_signal);
-    x->x_cspace.c_x1 = x->x_cspace.c_x2 = 0;
+    x->x_cspace.c_x = (t_sample *)getbytes(2 * sizeof(t_sample));
+    x->x_cspace.c_nchans = 1;
     sigbiquad_list(x, s, argc, argv);
     x->x_f = 0;
     return (x);
 }
 
-static t_int *sigbiquad_perform(t_int *w)
+    /* "check" is a constant in each caller below, so that the test on each
+    sample is compiled out of the version used when the hardware flushes
+    denormals (see dsp_flushing() in d_ugen.c).  That one only checks the
+    state once per block, which still recovers from a blown-up filter, and
+    runs groups of channels in lanes. */
+PD_INLINE t_int *sigbiquad_doperform(t_int *w, int check)
 {
     t_sample *in = (t_sample *)(w[1]);
     t_sample *out = (t_sample *)(w[2]);
     t_biquadctl *c = (t_biquadctl *)(w[3]);
     int n = (int)w[4];
-    int i;
-    t_sample last = c->c_x1;
-    t_sample prev = c->c_x2;
+    int i, k, ch = 0;
     t_sample fb1 = c->c_fb1;
     t_sample fb2 = c->c_fb2;
     t_sample ff1 = c->c_ff1;
     t_sample ff2 = c->c_ff2;
     t_sample ff3 = c->c_ff3;
-    for (i = 0; i < n; i++)
+    if (!check)
+        for (; ch + FILTER_LANES <= c->c_nchans; ch += FILTER_LANES)
     {
-        t_sample output =  *in++ + fb1 * last + fb2 * prev;
-        if (PD_BIGORSMALL(output))
-            output = 0;
-        *out++ = ff1 * output + ff2 * last + ff3 * prev;
-        prev = last;
-        last = output;
+        t_sample *lin = in + ch * n, *lout = out + ch * n;
+        t_sample last[FILTER_LANES], prev[FILTER_LANES], output[FILTER_LANES];
+        for (k = 0; k < FILTER_LANES; k++)
+            last[k] = c->c_x[2 * (ch + k)], prev[k] = c->c_x[2 * (ch + k) + 1];
+        for (i = 0; i < n; i++)
+        {
+            for (k = 0; k < FILTER_LANES; k++)
+                output[k] = lin[k * n + i] + fb1 * last[k] + fb2 * prev[k];
+            for (k = 0; k < FILTER_LANES; k++)
+                lout[k * n + i] =
+                    ff1 * output[k] + ff2 * last[k] + ff3 * prev[k];
+            for (k = 0; k < FILTER_LANES; k++)
+                prev[k] = last[k], last[k] = output[k];
+        }
+        for (k = 0; k < FILTER_LANES; k++)
+        {
+            c->c_x[2 * (ch + k)] = (PD_BIGORSMALL(last[k]) ? 0 : last[k]);
+            c->c_x[2 * (ch + k) + 1] = (PD_BIGORSMALL(prev[k]) ? 0 : prev[k]);
+        }
+    }
+    for (; ch < c->c_nchans; ch++)
+    {
+        t_sample *lin = in + ch * n, *lout = out + ch * n;
+        t_sample last = c->c_x[2 * ch];
+        t_sample prev = c->c_x[2 * ch + 1];
+        for (i = 0; i < n; i++)
+        {
+            t_sample output =  *lin++ + fb1 * last + fb2 * prev;
+            if (check && PD_BIGORSMALL(output))
+                output = 0;
+            *lout++ = ff1 * output + ff2 * last + ff3 * prev;
+            prev = last;
+            last = output;
+        }
+        if (!check)
+        {
+            if (PD_BIGORSMALL(last))
+                last = 0;
+            if (PD_BIGORSMALL(prev))
+                prev = 0;
+        }
+        c->c_x[2 * ch] = last;
+        c->c_x[2 * ch + 1] = prev;
     }
-    c->c_x1 = last;
-    c->c_x2 = prev;
     return (w+5);
 }
 
+static t_int *sigbiquad_perform(t_int *w)
+{
+    return (sigbiquad_doperform(w, 1));
+}
+
+static t_int *sigbiquad_perform_flushed(t_int *w)
+{
+    return (sigbiquad_doperform(w, 0));
+}
+
 static void sigbiquad_list(t_sigbiquad *x, t_symbol *s, int argc, t_atom *argv)
 {
     t_float fb1 = atom_getfloatarg(0, argc, argv);
@@ -469,24 +635,46 @@ stable:
     c->c_ff3 = ff3;
 }
 
+    /* set (or clear) the state of every channel */
 static void sigbiquad_set(t_sigbiquad *x, t_symbol *s, int argc, t_atom *argv)
 {
     t_biquadctl *c = &x->x_cspace;
-    c->c_x1 = atom_getfloatarg(0, argc, argv);
-    c->c_x2 = atom_getfloatarg(1, argc, argv);
+    int ch;
+    for (ch = 0; ch < c->c_nchans; ch++)
+    {
+        c->c_x[2 * ch] = atom_getfloatarg(0, argc, argv);
+        c->c_x[2 * ch + 1] = atom_getfloatarg(1, argc, argv);
+    }
 }
 
+int dsp_flushing(void);     /* from d_ugen.c */
+
 static void sigbiquad_dsp(t_sigbiquad *x, t_signal **sp)
 {
-    dsp_add(sigbiquad_perform, 4,
+    int nchans = sp[0]->s_nchans;
+    if (nchans != x->x_cspace.c_nchans)
+    {
+        x->x_cspace.c_x = (t_sample *)filter_resizestate(x->x_cspace.c_x,
+            x->x_cspace.c_nchans, nchans, 2 * sizeof(t_sample));
+        x->x_cspace.c_nchans = nchans;
+    }
+    signal_setmultiout(&sp[1], nchans);
+    dsp_add((dsp_flushing() ?
+        sigbiquad_perform_flushed : sigbiquad_perform), 4,
         sp[0]->s_vec, sp[1]->s_vec,
             &x->x_cspace, (t_int)sp[0]->s_n);
 }
 
+static void sigbiquad_free(t_sigbiquad *x)
+{
+    freebytes(x->x_cspace.c_x, 2 * x->x_cspace.c_nchans * sizeof(t_sample));
+}
+
 void sigbiquad_setup(void)
 {
     sigbiquad_class = class_new(gensym("biquad~"), (t_newmethod)sigbiquad_new,
-        0, sizeof(t_sigbiquad), 0, A_GIMME, 0);
+        (t_method)sigbiquad_free, sizeof(t_sigbiquad),
+            CLASS_MULTICHANNEL | CLASS_PARALLELSAFE, A_GIMME, 0);
     CLASS_MAINSIGNALIN(sigbiquad_class, t_sigbiquad, x_f);
     class_addmethod(sigbiquad_class, (t_method)sigbiquad_dsp,
         gensym("dsp"), A_CANT, 0);
@@ -564,7 +752,8 @@ static void sigsamphold_set(t_sigsamphold *x, t_float f)
 void sigsamphold_setup(void)
 {
     sigsamphold_class = class_new(gensym("samphold~"),
-        (t_newmethod)sigsamphold_new, 0, sizeof(t_sigsamphold), 0, 0);
+        (t_newmethod)sigsamphold_new, 0, sizeof(t_sigsamphold),
+            CLASS_PARALLELSAFE, 0);
     CLASS_MAINSIGNALIN(sigsamphold_class, t_sigsamphold, x_f);
     class_addmethod(sigsamphold_class, (t_method)sigsamphold_set,
         gensym("set"), A_DEFFLOAT, 0);
@@ -637,7 +826,8 @@ static void sigrpole_set(t_sigrpole *x, t_float f)
 void sigrpole_setup(void)
 {
     sigrpole_class = class_new(gensym("rpole~"),
-        (t_newmethod)sigrpole_new, 0, sizeof(t_sigrpole), 0, A_DEFFLOAT, 0);
+        (t_newmethod)sigrpole_new, 0, sizeof(t_sigrpole), CLASS_PARALLELSAFE,
+            A_DEFFLOAT, 0);
     CLASS_MAINSIGNALIN(sigrpole_class, t_sigrpole, x_f);
     class_addmethod(sigrpole_class, (t_method)sigrpole_set,
         gensym("set"), A_DEFFLOAT, 0);
@@ -709,7 +899,8 @@ static void sigrzero_set(t_sigrzero *x, t_float f)
 void sigrzero_setup(void)
 {
     sigrzero_class = class_new(gensym("rzero~"),
-        (t_newmethod)sigrzero_new, 0, sizeof(t_sigrzero), 0, A_DEFFLOAT, 0);
+        (t_newmethod)sigrzero_new, 0, sizeof(t_sigrzero), CLASS_PARALLELSAFE,
+            A_DEFFLOAT, 0);
     CLASS_MAINSIGNALIN(sigrzero_class, t_sigrzero, x_f);
     class_addmethod(sigrzero_class, (t_method)sigrzero_set,
         gensym("set"), A_DEFFLOAT, 0);
@@ -782,7 +973,7 @@ void sigrzero_rev_setup(void)
 {
     sigrzero_rev_class = class_new(gensym("rzero_rev~"),
         (t_newmethod)sigrzero_rev_new, 0, sizeof(t_sigrzero_rev),
-        0, A_DEFFLOAT, 0);
+        CLASS_PARALLELSAFE, A_DEFFLOAT, 0);
     CLASS_MAINSIGNALIN(sigrzero_rev_class, t_sigrzero_rev, x_f);
     class_addmethod(sigrzero_rev_class, (t_method)sigrzero_rev_set,
         gensym("set"), A_DEFFLOAT, 0);
@@ -874,7 +1065,7 @@ static void sigcpole_set(t_sigcpole *x, t_float re, t_float im)
 void sigcpole_setup(void)
 {
     sigcpole_class = class_new(gensym("cpole~"),
-        (t_newmethod)sigcpole_new, 0, sizeof(t_sigcpole), 0,
+        (t_newmethod)sigcpole_new, 0, sizeof(t_sigcpole), CLASS_PARALLELSAFE,
             A_DEFFLOAT, A_DEFFLOAT, 0);
     CLASS_MAINSIGNALIN(sigcpole_class, t_sigcpole, x_f);
     class_addmethod(sigcpole_class, (t_method)sigcpole_set,
@@ -964,7 +1155,7 @@ static void sigczero_set(t_sigczero *x, t_float re, t_float im)
 void sigczero_setup(void)
 {
     sigczero_class = class_new(gensym("czero~"),
-        (t_newmethod)sigczero_new, 0, sizeof(t_sigczero), 0,
+        (t_newmethod)sigczero_new, 0, sizeof(t_sigczero), CLASS_PARALLELSAFE,
             A_DEFFLOAT, A_DEFFLOAT, 0);
     CLASS_MAINSIGNALIN(sigczero_class, t_sigczero, x_f);
     class_addmethod(sigczero_class, (t_method)sigczero_set,
@@ -1056,7 +1247,8 @@ static void sigczero_rev_set(t_sigczero_rev *x, t_float re, t_float im)
 void sigczero_rev_setup(void)
 {
     sigczero_rev_class = class_new(gensym("czero_rev~"),
-        (t_newmethod)sigczero_rev_new, 0, sizeof(t_sigczero_rev), 0,
+        (t_newmethod)sigczero_rev_new, 0, sizeof(t_sigczero_rev),
+            CLASS_PARALLELSAFE,
             A_DEFFLOAT, A_DEFFLOAT, 0);
     CLASS_MAINSIGNALIN(sigczero_rev_class, t_sigczero_rev, x_f);
     class_addmethod(sigczero_rev_class, (t_method)sigczero_rev_set,
@@ -1166,7 +1358,7 @@ static void slop_tilde_dsp(t_slop_tilde *x, t_signal **sp)
 void slop_tilde_setup(void)
 {
     slop_tilde_class = class_new(gensym("slop~"), (t_newmethod)slop_tilde_new, 0,
-        sizeof(t_slop_tilde), 0, A_GIMME, 0);
+        sizeof(t_slop_tilde), CLASS_PARALLELSAFE, A_GIMME, 0);
     CLASS_MAINSIGNALIN(slop_tilde_class, t_slop_tilde, x_f);
     class_addmethod(slop_tilde_class, (t_method)slop_tilde_dsp,
         gensym("dsp"), A_CANT, 0);
@@ -0,0 +1,559 @@
+/* Copyright (c) 1997-2025 Miller Puckette and others.
+* For information on usage and redistribution, and for a DISCLAIMER OF ALL
+* WARRANTIES, see the file, "LICENSE.txt," in this distribution.  */
+
+/*  Parallel execution of the DSP chain.
+
+    When the chain for a toplevel canvas is built (see ugen_done_graph() in
+    d_ugen.c) and DSP threads are enabled, the code for the canvas is
+    framed by a "region".  As each toplevel box is scheduled, the region is
+    told where on the chain its code starts ("segments"), which signal
+    buffers it touches, and whether the box is known to touch nothing else
+    (CLASS_PARALLELSAFE, or a subpatch or clone containing only such
+    objects).  When the graph is done we work out which segments depend on
+    which:  two segments sharing signal memory run in chain order unless
+    both only read it, and all "unsafe" segments (send~/receive~, arrays, delay lines, dac~ and
+    anything we know nothing about) are kept in chain order among
+    themselves.  Every other pair may run at the same time.
+
+    At DSP time the region's perform routine hands the segments to a small
+    pool of worker threads, each with its own queue, which steal from each
+    other when they run dry.  The scheduler thread works along with them and
+    returns only when every segment is done, so whatever follows the region
+    on the chain sees the same buffers it would have seen from the serial
+    chain.  Each segment is the same straight run of perform routines it
+    would have been, and no sample is computed by more than one segment, so
+    the output is bit-identical to running the chain serially.  If the pool
+    is in use (by another Pd instance) or the region has no useful
+    parallelism, the perform routine just returns into the segments and the
+    chain runs through them as usual.
+
+    The pool is started with the "pd dsp-threads <n>" message, where n is
+    the number of helper threads (0, the default, turns all this off.) */
+
+#include "m_pd.h"
+#include "m_imp.h"
+#include "s_stuff.h"
+#include <string.h>
+#include <stdlib.h>
+#include <pthread.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sched.h>
+#endif
+
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#define DSP_ATOMIC_DEC(p) _InterlockedDecrement(p)
+#define DSP_BARRIER() MemoryBarrier()
+#else
+#define DSP_ATOMIC_DEC(p) __sync_sub_and_fetch((p), 1)
+#define DSP_BARRIER() __sync_synchronize()
+#endif
+
+#define DSP_MAXTHREADS 64
+
+typedef struct _dsptouch
+{
+    const char *t_lo;           /* first byte of a signal buffer */
+    const char *t_hi;           /* one past the last */
+    int t_write;                /* zero if only read */
+} t_dsptouch;
+
+typedef struct _dspseg
+{
+    int s_onset;                /* first word, relative to region start */
+    int s_end;                  /* one past the last word */
+    int s_unsafe;               /* might touch more than its signals */
+    int s_ntouch;               /* signal memory touched (while building) */
+    int s_touchsize;
+    t_dsptouch *s_touch;
+    int s_ndeps;                /* how many segments must run before us */
+    int s_nsucc;                /* segments that wait for us */
+    int s_succsize;
+    int *s_succ;
+    volatile long s_pending;    /* deps still outstanding this tick */
+} t_dspseg;
+
+struct _dspregion
+{
+    int r_nseg;
+    int r_segsize;
+    t_dspseg *r_seg;
+    int r_serial;               /* nothing to gain; run the chain in place */
+    int r_nqueue;               /* number of run queues allocated below */
+    int *r_queue;               /* r_nseg slots per thread */
+    t_int *r_base;              /* chain address of the region's first word */
+    volatile long r_remaining;  /* segments not yet done this tick */
+    struct _dspregion *r_next;  /* next region on the same DSP chain */
+};
+
+typedef struct _dspregion t_dspregion;
+
+/* ------------------------- building regions -------------------------- */
+
+    /* make a new region and add it to a list so that we can free it
+    along with the chain. */
+t_dspregion *dspregion_new(t_dspregion **list)
+{
+    t_dspregion *r = (t_dspregion *)getbytes(sizeof(*r));
+    r->r_segsize = 16;
+    r->r_seg = (t_dspseg *)getbytes(r->r_segsize * sizeof(*r->r_seg));
+    r->r_nseg = 1;      /* first segment starts at the beginning */
+    r->r_next = *list;
+    *list = r;
+    return (r);
+}
+
+    /* start a new segment at "onset" words from the beginning of the
+    region.  If nothing was put in the current one, reuse it. */
+void dspregion_mark(t_dspregion *r, int onset, int unsafe)
+{
+    t_dspseg *s = &r->r_seg[r->r_nseg - 1];
+    if (s->s_onset == onset)
+    {
+        s->s_unsafe = unsafe;
+        return;
+    }
+    s->s_end = onset;
+    if (r->r_nseg == r->r_segsize)
+    {
+        r->r_seg = (t_dspseg *)resizebytes(r->r_seg,
+            r->r_segsize * sizeof(*r->r_seg),
+                2 * r->r_segsize * sizeof(*r->r_seg));
+        r->r_segsize *= 2;
+    }
+    s = &r->r_seg[r->r_nseg++];
+    s->s_onset = onset;
+    s->s_unsafe = unsafe;
+}
+
+    /* note that the current segment reads (or if "write" is set, may also
+    write) nbytes at vec. */
+void dspregion_touch(t_dspregion *r, const void *vec, size_t nbytes,
+    int write)
+{
+    t_dspseg *s = &r->r_seg[r->r_nseg - 1];
+    const char *lo = (const char *)vec, *hi = lo + nbytes;
+    int i;
+    for (i = 0; i < s->s_ntouch; i++)
+        if (s->s_touch[i].t_lo <= lo && s->s_touch[i].t_hi >= hi &&
+            (s->s_touch[i].t_write || !write))
+                return;
+    if (s->s_ntouch == s->s_touchsize)
+    {
+        int newsize = (s->s_touchsize ? 2 * s->s_touchsize : 8);
+        s->s_touch = (t_dsptouch *)resizebytes(s->s_touch,
+            s->s_touchsize * sizeof(*s->s_touch),
+                newsize * sizeof(*s->s_touch));
+        s->s_touchsize = newsize;
+    }
+    s->s_touch[s->s_ntouch].t_lo = lo;
+    s->s_touch[s->s_ntouch].t_hi = hi;
+    s->s_touch[s->s_ntouch].t_write = write;
+    s->s_ntouch++;
+}
+
+static int dsptouch_compare(const void *a, const void *b)
+{
+    const char *x = ((const t_dsptouch *)a)->t_lo,
+        *y = ((const t_dsptouch *)b)->t_lo;
+    return (x < y ? -1 : (x > y));
+}
+
+    /* sort a segment's buffers by address, merging any that overlap, so
+    that two segments can be compared in one pass.  A merged range counts
+    as written if any part of it was. */
+static void dspseg_sorttouches(t_dspseg *s)
+{
+    int i, n = 0;
+    if (!s->s_ntouch)
+        return;
+    qsort(s->s_touch, s->s_ntouch, sizeof(*s->s_touch), dsptouch_compare);
+    for (i = 1; i < s->s_ntouch; i++)
+    {
+        if (s->s_touch[i].t_lo < s->s_touch[n].t_hi)
+        {
+            if (s->s_touch[i].t_hi > s->s_touch[n].t_hi)
+                s->s_touch[n].t_hi = s->s_touch[i].t_hi;
+            s->s_touch[n].t_write |= s->s_touch[i].t_write;
+        }
+        else s->s_touch[++n] = s->s_touch[i];
+    }
+    s->s_ntouch = n + 1;
+}
+
+    /* check whether two segments conflict: one writes memory the other
+    reads or writes */
+static int dspseg_overlap(const t_dspseg *a, const t_dspseg *b)
+{
+    int i = 0, j = 0;
+    while (i < a->s_ntouch && j < b->s_ntouch)
+    {
+        if (a->s_touch[i].t_hi <= b->s_touch[j].t_lo)
+            i++;
+        else if (b->s_touch[j].t_hi <= a->s_touch[i].t_lo)
+            j++;
+        else if (a->s_touch[i].t_write || b->s_touch[j].t_write)
+            return (1);
+        else if (a->s_touch[i].t_hi <= b->s_touch[j].t_hi)
+            i++;
+        else j++;
+    }
+    return (0);
+}
+
+static void dspseg_addsucc(t_dspseg *s, int which)
+{
+    if (s->s_nsucc == s->s_succsize)
+    {
+        int newsize = (s->s_succsize ? 2 * s->s_succsize : 4);
+        s->s_succ = (int *)resizebytes(s->s_succ,
+            s->s_succsize * sizeof(int), newsize * sizeof(int));
+        s->s_succsize = newsize;
+    }
+    s->s_succ[s->s_nsucc++] = which;
+}
+
+int dspregion_nthreads(void);
+
+    /* the chain is complete: close the last segment, drop empty ones, and
+    work out the dependencies between the rest. */
+void dspregion_finish(t_dspregion *r, int length)
+{
+    int i, j, n, lastunsafe = -1, longest = 0, *depth;
+    r->r_seg[r->r_nseg - 1].s_end = length;
+    for (i = n = 0; i < r->r_nseg; i++)
+    {
+        if (r->r_seg[i].s_end > r->r_seg[i].s_onset)
+            r->r_seg[n++] = r->r_seg[i];
+        else if (r->r_seg[i].s_touch)
+            freebytes(r->r_seg[i].s_touch,
+                r->r_seg[i].s_touchsize * sizeof(t_dsptouch));
+    }
+    r->r_nseg = n;
+    for (i = 0; i < n; i++)
+        dspseg_sorttouches(&r->r_seg[i]);
+
+        /* depth[i] is the length of the longest chain of dependencies
+        ending at segment i.  If that's as long as the region itself
+        there's nothing to run in parallel. */
+    depth = (int *)getbytes((n ? n : 1) * sizeof(int));
+    for (i = 0; i < n; i++)
+    {
+        t_dspseg *s = &r->r_seg[i];
+        depth[i] = 1;
+        for (j = 0; j < i; j++)
+        {
+            if ((s->s_unsafe && j == lastunsafe) ||
+                dspseg_overlap(&r->r_seg[j], s))
+            {
+                dspseg_addsucc(&r->r_seg[j], i);
+                s->s_ndeps++;
+                if (depth[j] + 1 > depth[i])
+                    depth[i] = depth[j] + 1;
+            }
+        }
+        if (s->s_unsafe)
+            lastunsafe = i;
+        if (depth[i] > longest)
+            longest = depth[i];
+    }
+    freebytes(depth, (n ? n : 1) * sizeof(int));
+    for (i = 0; i < n; i++)
+    {
+        t_dspseg *s = &r->r_seg[i];
+        if (s->s_touch)
+            freebytes(s->s_touch, s->s_touchsize * sizeof(*s->s_touch));
+        s->s_touch = 0;
+        s->s_ntouch = s->s_touchsize = 0;
+    }
+    r->r_serial = (n < 2 || longest >= n || !dspregion_nthreads());
+    if (!r->r_serial)
+    {
+        r->r_nqueue = dspregion_nthreads() + 1;
+        r->r_queue = (int *)getbytes(r->r_nqueue * n * sizeof(int));
+    }
+}
+
+    /* free all regions on a list */
+void dspregion_freelist(t_dspregion **list)
+{
+    t_dspregion *r;
+    int i;
+    while ((r = *list))
+    {
+        *list = r->r_next;
+        for (i = 0; i < r->r_nseg; i++)
+        {
+            if (r->r_seg[i].s_touch)
+                freebytes(r->r_seg[i].s_touch,
+                    r->r_seg[i].s_touchsize * sizeof(t_dsptouch));
+            if (r->r_seg[i].s_succ)
+                freebytes(r->r_seg[i].s_succ,
+                    r->r_seg[i].s_succsize * sizeof(int));
+        }
+        freebytes(r->r_seg, r->r_segsize * sizeof(*r->r_seg));
+        if (r->r_queue)
+            freebytes(r->r_queue, r->r_nqueue * r->r_nseg * sizeof(int));
+        freebytes(r, sizeof(*r));
+    }
+}
+
+/* ---------------------------- thread pool ----------------------------- */
+
+    /* denormal flushing for the helpers, from d_ugen.c */
+unsigned int dsp_startflush(void);
+void dsp_endflush(unsigned int was);
+#ifdef DEBUGMEM
+void rtmem_dspenter(void);  /* from m_memory.c */
+void rtmem_dspexit(void);
+#endif
+
+typedef struct _dspworker
+{
+    pthread_t w_thread;
+    pthread_mutex_t w_lock;     /* protects the run queue below */
+    int w_head;                 /* oldest item, taken by thieves */
+    int w_tail;                 /* newest item, taken by the owner */
+    int w_index;                /* 0 is the scheduler thread */
+    int w_generation;           /* last run we took part in */
+    int w_placed;               /* see sys_updateplacement() */
+} t_dspworker;
+
+static struct _dsppool
+{
+    int p_init;
+    int p_nthreads;             /* helper threads, not counting scheduler */
+    t_dspworker p_worker[DSP_MAXTHREADS + 1];
+    pthread_mutex_t p_runlock;  /* held while a region is running */
+    pthread_mutex_t p_lock;     /* protects the fields below */
+    pthread_cond_t p_wake;      /* a new region is ready to run */
+    pthread_cond_t p_idle;      /* the last helper has finished */
+    int p_generation;           /* incremented for each run */
+    int p_active;               /* helpers still working on this run */
+    int p_quit;
+    t_dspregion *p_region;
+    t_pdinstance *p_instance;
+} dsppool;
+
+static void dsp_yield(void)
+{
+#ifdef _WIN32
+    SwitchToThread();
+#else
+    sched_yield();
+#endif
+}
+
+    /* queue a segment for thread q.  Only q itself or (before a run starts)
+    the scheduler thread ever adds to q's queue. */
+static void dspregion_push(t_dspregion *r, int q, int seg)
+{
+    t_dspworker *w = &dsppool.p_worker[q];
+    pthread_mutex_lock(&w->w_lock);
+    r->r_queue[q * r->r_nseg + w->w_tail++] = seg;
+    pthread_mutex_unlock(&w->w_lock);
+}
+
+    /* get a segment to run: the newest in our own queue (its inputs are
+    most likely still in cache) or else the oldest in someone else's.
+    Returns -1 if nothing is ready just now. */
+static int dspregion_take(t_dspregion *r, int q)
+{
+    int i, seg = -1;
+    for (i = 0; i < r->r_nqueue && seg < 0; i++)
+    {
+        int k = (q + i) % r->r_nqueue;
+        t_dspworker *w = &dsppool.p_worker[k];
+        pthread_mutex_lock(&w->w_lock);
+        if (w->w_tail > w->w_head)
+            seg = r->r_queue[k * r->r_nseg +
+                (k == q ? --w->w_tail : w->w_head++)];
+        pthread_mutex_unlock(&w->w_lock);
+    }
+    return (seg);
+}
+
+    /* run segments until the region is done */
+static void dspregion_work(t_dspregion *r, int q)
+{
+    while (r->r_remaining > 0)
+    {
+        t_dspseg *s;
+        t_int *ip, *end;
+        int seg, i;
+        if ((seg = dspregion_take(r, q)) < 0)
+        {
+            dsp_yield();
+            continue;
+        }
+        s = &r->r_seg[seg];
+        for (ip = r->r_base + s->s_onset, end = r->r_base + s->s_end;
+            ip < end; )
+                ip = (*(t_perfroutine)(*ip))(ip);
+        for (i = 0; i < s->s_nsucc; i++)
+            if (!DSP_ATOMIC_DEC(&r->r_seg[s->s_succ[i]].s_pending))
+                dspregion_push(r, q, s->s_succ[i]);
+        DSP_ATOMIC_DEC(&r->r_remaining);
+    }
+    DSP_BARRIER();
+}
+
+static void *dsppool_thread(void *z)
+{
+    t_dspworker *w = (t_dspworker *)z;
+    pthread_mutex_lock(&dsppool.p_lock);
+    while (1)
+    {
+        t_dspregion *r;
+        unsigned int fpstate;
+        while (!dsppool.p_quit && dsppool.p_generation == w->w_generation)
+            pthread_cond_wait(&dsppool.p_wake, &dsppool.p_lock);
+        if (dsppool.p_quit)
+            break;
+        w->w_generation = dsppool.p_generation;
+        r = dsppool.p_region;
+#ifdef PDINSTANCE
+        pd_setinstance(dsppool.p_instance);
+#endif
+        pthread_mutex_unlock(&dsppool.p_lock);
+        sys_updateplacement(CPUS_DSP, w->w_index, &w->w_placed);
+        fpstate = dsp_startflush();
+#ifdef DEBUGMEM
+        rtmem_dspenter();
+#endif
+        dspregion_work(r, w->w_index);
+#ifdef DEBUGMEM
+        rtmem_dspexit();
+#endif
+        dsp_endflush(fpstate);
+        pthread_mutex_lock(&dsppool.p_lock);
+        if (!--dsppool.p_active)
+            pthread_cond_signal(&dsppool.p_idle);
+    }
+    pthread_mutex_unlock(&dsppool.p_lock);
+    return (0);
+}
+
+static void dsppool_stop(void)
+{
+    int i;
+    if (!dsppool.p_nthreads)
+        return;
+    pthread_mutex_lock(&dsppool.p_lock);
+    dsppool.p_quit = 1;
+    pthread_cond_broadcast(&dsppool.p_wake);
+    pthread_mutex_unlock(&dsppool.p_lock);
+    for (i = 1; i <= dsppool.p_nthreads; i++)
+        pthread_join(dsppool.p_worker[i].w_thread, 0);
+    dsppool.p_nthreads = 0;
+    dsppool.p_quit = 0;
+}
+
+static void dsppool_init(void)
+{
+    int i;
+    pthread_mutex_init(&dsppool.p_runlock, 0);
+    pthread_mutex_init(&dsppool.p_lock, 0);
+    pthread_cond_init(&dsppool.p_wake, 0);
+    pthread_cond_init(&dsppool.p_idle, 0);
+    for (i = 0; i <= DSP_MAXTHREADS; i++)
+    {
+        pthread_mutex_init(&dsppool.p_worker[i].w_lock, 0);
+        dsppool.p_worker[i].w_index = i;
+    }
+    dsppool.p_init = 1;
+}
+
+static void dsppool_start(int nthreads)
+{
+    int i;
+    for (i = 1; i <= nthreads; i++)
+    {
+        t_dspworker *w = &dsppool.p_worker[i];
+        w->w_generation = dsppool.p_generation;
+        if (pthread_create(&w->w_thread, 0, dsppool_thread, w))
+        {
+            pd_error(0, "dsp-threads: couldn't start thread %d", i);
+            break;
+        }
+    }
+    dsppool.p_nthreads = i - 1;
+}
+
+/* ------------------------- running regions ---------------------------- */
+
+    /* the perform routine at the head of each region.  w[1] is the region
+    and w[2] the number of words its segments occupy on the chain. */
+t_int *dspregion_perform(t_int *w)
+{
+    t_dspregion *r = (t_dspregion *)(w[1]);
+    int i, nthreads = dsppool.p_nthreads;
+
+        /* if we can't go parallel, let the chain run straight through */
+    if (r->r_serial || r->r_nqueue != nthreads + 1 ||
+        pthread_mutex_trylock(&dsppool.p_runlock))
+            return (w + 3);
+    r->r_base = w + 3;
+    r->r_remaining = r->r_nseg;
+    for (i = 0; i <= nthreads; i++)
+        dsppool.p_worker[i].w_head = dsppool.p_worker[i].w_tail = 0;
+    for (i = 0; i < r->r_nseg; i++)
+    {
+        t_dspseg *s = &r->r_seg[i];
+        if (!(s->s_pending = s->s_ndeps))
+        {
+            t_dspworker *wk = &dsppool.p_worker[i % (nthreads + 1)];
+            r->r_queue[wk->w_index * r->r_nseg + wk->w_tail++] = i;
+        }
+    }
+    pthread_mutex_lock(&dsppool.p_lock);
+    dsppool.p_region = r;
+    dsppool.p_instance = pd_this;
+    dsppool.p_active = nthreads;
+    dsppool.p_generation++;
+    pthread_cond_broadcast(&dsppool.p_wake);
+    pthread_mutex_unlock(&dsppool.p_lock);
+
+    dspregion_work(r, 0);
+
+        /* wait until every helper is out of the region before going on */
+    pthread_mutex_lock(&dsppool.p_lock);
+    while (dsppool.p_active)
+        pthread_cond_wait(&dsppool.p_idle, &dsppool.p_lock);
+    pthread_mutex_unlock(&dsppool.p_lock);
+    pthread_mutex_unlock(&dsppool.p_runlock);
+    return (w + 3 + w[2]);
+}
+
+int dspregion_nthreads(void)
+{
+    return (dsppool.p_nthreads);
+}
+
+    /* "pd dsp-threads <n>" - set the number of helper threads and
+    rebuild the DSP chain to match. */
+void glob_dspthreads(void *dummy, t_floatarg f)
+{
+    int n = f;
+    if (n < 0)
+        n = 0;
+    else if (n > DSP_MAXTHREADS)
+    {
+        post("dsp-threads: limiting to %d", DSP_MAXTHREADS);
+        n = DSP_MAXTHREADS;
+    }
+    if (n == dsppool.p_nthreads)
+        return;
+    if (!dsppool.p_init)
+        dsppool_init();
+        /* another Pd instance might be in the middle of a region */
+    pthread_mutex_lock(&dsppool.p_runlock);
+    dsppool_stop();
+    if (n)
+        dsppool_start(n);
+    pthread_mutex_unlock(&dsppool.p_runlock);
+    canvas_update_dsp();
+}
@@ -0,0 +1,514 @@
+/* Copyright (c) 1997-2025 Miller Puckette and others.
+* For information on usage and redistribution, and for a DISCLAIMER OF ALL
+* WARRANTIES, see the file, "LICENSE.txt," in this distribution.  */
+
+/*  Per-object DSP profiling.
+
+    When profiling is on ("pd profile 1") the DSP chain is rebuilt and, as
+    each box is scheduled, we note where its code starts on the chain (see
+    ugen_doit() in d_ugen.c).  Every word of the chain is then owned by the
+    box that put it there; glue code such as the additions that sum fanned-in
+    signals is charged to the box being fed, and a block~'s prolog and
+    epilog to the block~.  Instead of running the chain straight through,
+    dsp_tick() calls dspprofile_perform(), which reads the clock after each
+    perform routine and charges the time to its owner.  With profiling off
+    the chain is run exactly as before and none of this costs anything.
+
+    Messages to "pd":
+        profile 1|0         start or stop profiling
+        profile reset       clear the accumulated times
+        profile print [n]   post the n most expensive boxes (default 20),
+                            then the cost of each canvas including its
+                            subpatches
+        profile csv <file>  write one line per box
+        profile json <file> write a tree of canvases and boxes that
+                            flame graph viewers (d3-flame-graph and the
+                            like) can read
+
+    Times are reported in microseconds per DSP tick. */
+
+#include "m_pd.h"
+#include "m_imp.h"
+#include "g_canvas.h"
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+typedef struct _dspprofentry
+{
+    int e_onset;                /* first word of the chain it owns */
+    t_object *e_obj;            /* box, or zero for toplevel glue */
+    t_canvas *e_canvas;         /* canvas the box is in */
+    double e_time;              /* accumulated seconds */
+    double e_calls;             /* perform routines run */
+    double e_ticks;             /* ticks it was profiled for */
+} t_dspprofentry;
+
+struct _dspprofile
+{
+    t_canvas *p_canvas;         /* toplevel the chain belongs to */
+    int p_nentry;
+    int p_entrysize;
+    t_dspprofentry *p_entry;
+    int p_chainsize;
+    int *p_owner;               /* entry owning each word of the chain */
+    double p_ticks;             /* ticks run since built or reset */
+};
+
+#define t_dspprofile struct _dspprofile
+
+    /* from d_ugen.c */
+int ugen_getprofiling(void);
+void ugen_setprofiling(int onoff);
+void ugen_foreachprofile(void (*fn)(t_dspprofile *p, void *arg), void *arg);
+
+static double dspprofile_time(void)
+{
+#ifdef _WIN32
+    static double freq;
+    LARGE_INTEGER now;
+    if (freq == 0)
+    {
+        LARGE_INTEGER f;
+        QueryPerformanceFrequency(&f);
+        freq = (double)f.QuadPart;
+    }
+    QueryPerformanceCounter(&now);
+    return ((double)now.QuadPart / freq);
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec + 1e-9 * now.tv_nsec);
+#endif
+}
+
+t_dspprofile *dspprofile_new(t_canvas *x)
+{
+    t_dspprofile *p = (t_dspprofile *)getbytes(sizeof(*p));
+    p->p_canvas = x;
+    p->p_nentry = 0;
+    p->p_entrysize = 16;
+    p->p_entry = (t_dspprofentry *)getbytes(p->p_entrysize *
+        sizeof(*p->p_entry));
+    p->p_chainsize = 0;
+    p->p_owner = 0;
+    p->p_ticks = 0;
+        /* anything before the first box belongs to the toplevel itself */
+    p->p_entry[0].e_onset = 0;
+    p->p_entry[0].e_obj = 0;
+    p->p_entry[0].e_canvas = x;
+    p->p_nentry = 1;
+    return (p);
+}
+
+    /* the code for "obj" starts at chain word "onset" */
+void dspprofile_mark(t_dspprofile *p, int onset, t_object *obj,
+    t_canvas *canvas)
+{
+    t_dspprofentry *e = p->p_entry + (p->p_nentry - 1);
+        /* if the previous owner added nothing, forget it */
+    if (e->e_onset < onset)
+    {
+        if (p->p_nentry == p->p_entrysize)
+        {
+            p->p_entry = (t_dspprofentry *)resizebytes(p->p_entry,
+                p->p_entrysize * sizeof(*p->p_entry),
+                    2 * p->p_entrysize * sizeof(*p->p_entry));
+            p->p_entrysize *= 2;
+        }
+        e = p->p_entry + p->p_nentry++;
+    }
+    e->e_onset = onset;
+    e->e_obj = obj;
+    e->e_canvas = canvas;
+}
+
+    /* the chain is complete; note who owns each word */
+void dspprofile_finish(t_dspprofile *p, int chainsize)
+{
+    int i, j;
+    p->p_chainsize = chainsize;
+    p->p_owner = (int *)getbytes(chainsize * sizeof(*p->p_owner));
+    for (i = 0; i < p->p_nentry; i++)
+    {
+        int end = (i < p->p_nentry - 1 ?
+            p->p_entry[i + 1].e_onset : chainsize);
+        for (j = p->p_entry[i].e_onset; j < end && j < chainsize; j++)
+            p->p_owner[j] = i;
+    }
+}
+
+void dspprofile_free(t_dspprofile *p)
+{
+    freebytes(p->p_entry, p->p_entrysize * sizeof(*p->p_entry));
+    if (p->p_owner)
+        freebytes(p->p_owner, p->p_chainsize * sizeof(*p->p_owner));
+    freebytes(p, sizeof(*p));
+}
+
+    /* run a chain built with profiling on, timing each perform routine */
+void dspprofile_perform(t_dspprofile *p, t_int *chain)
+{
+    t_int *ip = chain;
+    double then = dspprofile_time(), now;
+    while (ip)
+    {
+        t_dspprofentry *e = p->p_entry + p->p_owner[ip - chain];
+        ip = (*(t_perfroutine)(*ip))(ip);
+        now = dspprofile_time();
+        e->e_time += now - then;
+        e->e_calls++;
+        then = now;
+    }
+    p->p_ticks++;
+}
+
+/* ------------------------ reporting --------------------------- */
+
+typedef struct _dspprofreport
+{
+    int r_n;
+    int r_size;
+    t_dspprofentry *r_entry;
+} t_dspprofreport;
+
+static void dspprofile_collect(t_dspprofile *p, void *arg)
+{
+    t_dspprofreport *r = (t_dspprofreport *)arg;
+    int i;
+    for (i = 0; i < p->p_nentry; i++)
+    {
+        if (r->r_n == r->r_size)
+        {
+            int newsize = (r->r_size ? 2 * r->r_size : 64);
+            r->r_entry = (t_dspprofentry *)resizebytes(r->r_entry,
+                r->r_size * sizeof(*r->r_entry),
+                    newsize * sizeof(*r->r_entry));
+            r->r_size = newsize;
+        }
+        r->r_entry[r->r_n] = p->p_entry[i];
+        r->r_entry[r->r_n].e_ticks = p->p_ticks;
+        r->r_n++;
+    }
+}
+
+static void dspprofile_clear(t_dspprofile *p, void *arg)
+{
+    int i;
+    for (i = 0; i < p->p_nentry; i++)
+        p->p_entry[i].e_time = p->p_entry[i].e_calls = 0;
+    p->p_ticks = 0;
+}
+
+    /* cost of an entry in microseconds per tick */
+static double dspprofile_us(t_dspprofentry *e)
+{
+    return (e->e_ticks > 0 ? 1e6 * e->e_time / e->e_ticks : 0);
+}
+
+static int dspprofile_byobj(const void *a, const void *b)
+{
+    const t_dspprofentry *e1 = a, *e2 = b;
+    if (e1->e_canvas != e2->e_canvas)
+        return ((size_t)e1->e_canvas < (size_t)e2->e_canvas ? -1 : 1);
+    if (e1->e_obj != e2->e_obj)
+        return ((size_t)e1->e_obj < (size_t)e2->e_obj ? -1 : 1);
+    return (0);
+}
+
+static int dspprofile_bytime(const void *a, const void *b)
+{
+    double t1 = dspprofile_us((t_dspprofentry *)a),
+        t2 = dspprofile_us((t_dspprofentry *)b);
+    return (t1 > t2 ? -1 : (t1 < t2 ? 1 : 0));
+}
+
+    /* gather all entries, one per box, sorted by cost */
+static void dspprofile_getreport(t_dspprofreport *r)
+{
+    int i, n;
+    r->r_n = r->r_size = 0;
+    r->r_entry = 0;
+    ugen_foreachprofile(dspprofile_collect, r);
+    if (!r->r_n)
+        return;
+        /* a box may own more than one stretch of the chain */
+    qsort(r->r_entry, r->r_n, sizeof(*r->r_entry), dspprofile_byobj);
+    for (i = 1, n = 1; i < r->r_n; i++)
+    {
+        t_dspprofentry *e = r->r_entry + (n - 1);
+        if (!dspprofile_byobj(e, r->r_entry + i))
+        {
+            e->e_time += r->r_entry[i].e_time;
+            e->e_calls += r->r_entry[i].e_calls;
+        }
+        else r->r_entry[n++] = r->r_entry[i];
+    }
+    r->r_n = n;
+    qsort(r->r_entry, r->r_n, sizeof(*r->r_entry), dspprofile_bytime);
+}
+
+static void dspprofile_freereport(t_dspprofreport *r)
+{
+    if (r->r_entry)
+        freebytes(r->r_entry, r->r_size * sizeof(*r->r_entry));
+}
+
+    /* box text, such as "osc~ 440", or the toplevel's name for glue */
+static void dspprofile_label(t_dspprofentry *e, char *buf, int size)
+{
+    if (e->e_obj && e->e_obj->te_binbuf)
+    {
+        char *text;
+        int len;
+        binbuf_gettext(e->e_obj->te_binbuf, &text, &len);
+        snprintf(buf, size, "%.*s", len, text);
+        freebytes(text, len);
+    }
+    else snprintf(buf, size, "(%s)", (e->e_obj ?
+        class_getname(pd_class(&e->e_obj->ob_pd)) : "glue"));
+}
+
+    /* canvas names from the toplevel down, such as "main.pd/sub" */
+static void dspprofile_path(t_canvas *x, char *buf, int size)
+{
+    int len;
+    if (x->gl_owner)
+    {
+        dspprofile_path(x->gl_owner, buf, size);
+        len = strlen(buf);
+        snprintf(buf + len, size - len, "/%s", x->gl_name->s_name);
+    }
+    else snprintf(buf, size, "%s", x->gl_name->s_name);
+}
+
+static int dspprofile_isin(t_canvas *x, t_canvas *parent)
+{
+    for (; x; x = x->gl_owner)
+        if (x == parent)
+            return (1);
+    return (0);
+}
+
+    /* total cost of a canvas and everything in it */
+static double dspprofile_canvastime(t_dspprofreport *r, t_canvas *x)
+{
+    int i;
+    double sum = 0;
+    for (i = 0; i < r->r_n; i++)
+        if (dspprofile_isin(r->r_entry[i].e_canvas, x))
+            sum += dspprofile_us(&r->r_entry[i]);
+    return (sum);
+}
+
+static void dspprofile_print(int n)
+{
+    t_dspprofreport r;
+    int i, j, ncanvas = 0, canvassize;
+    double total = 0;
+    char label[MAXPDSTRING], path[MAXPDSTRING];
+    t_canvas **canvases;
+
+    dspprofile_getreport(&r);
+    if (!r.r_n)
+    {
+        post("profile: nothing to report (DSP or profiling is off)");
+        return;
+    }
+    for (i = 0; i < r.r_n; i++)
+        total += dspprofile_us(&r.r_entry[i]);
+    post("profile: %g us per tick in %d boxes", total, r.r_n);
+    post("    us/tick      %%    calls  box (canvas)");
+    for (i = 0; i < r.r_n && i < n; i++)
+    {
+        t_dspprofentry *e = &r.r_entry[i];
+        dspprofile_label(e, label, MAXPDSTRING);
+        dspprofile_path(e->e_canvas, path, MAXPDSTRING);
+        post("%11.3f %6.2f %8.0f  %s (%s)", dspprofile_us(e),
+            (total > 0 ? 100 * dspprofile_us(e) / total : 0),
+                (e->e_ticks > 0 ? e->e_calls / e->e_ticks : 0), label, path);
+    }
+
+        /* then each canvas, including whatever is inside it */
+    canvases = (t_canvas **)getbytes((canvassize = r.r_n) *
+        sizeof(*canvases));
+    for (i = 0; i < r.r_n; i++)
+    {
+        t_canvas *x;
+        for (x = r.r_entry[i].e_canvas; x; x = x->gl_owner)
+        {
+            for (j = 0; j < ncanvas; j++)
+                if (canvases[j] == x)
+                    break;
+            if (j == ncanvas)
+            {
+                if (ncanvas == canvassize)
+                {
+                    canvases = (t_canvas **)resizebytes(canvases,
+                        canvassize * sizeof(*canvases),
+                            2 * canvassize * sizeof(*canvases));
+                    canvassize *= 2;
+                }
+                canvases[ncanvas++] = x;
+            }
+        }
+    }
+    post("    us/tick      %%  canvas");
+    for (i = 0; i < ncanvas; i++)
+    {
+        double t = dspprofile_canvastime(&r, canvases[i]);
+        dspprofile_path(canvases[i], path, MAXPDSTRING);
+        post("%11.3f %6.2f  %s", t, (total > 0 ? 100 * t / total : 0), path);
+    }
+    freebytes(canvases, canvassize * sizeof(*canvases));
+    dspprofile_freereport(&r);
+}
+
+    /* write a string as a quoted CSV or JSON field */
+static void dspprofile_quote(FILE *fd, const char *s, int json)
+{
+    putc('"', fd);
+    for (; *s; s++)
+    {
+        if (*s == '"')
+            fputs(json ? "\\\"" : "\"\"", fd);
+        else if (json && *s == '\\')
+            fputs("\\\\", fd);
+        else if (json && (unsigned char)*s < 32)
+            fprintf(fd, "\\u%04x", (unsigned char)*s);
+        else putc(*s, fd);
+    }
+    putc('"', fd);
+}
+
+static void dspprofile_writecsv(FILE *fd, t_dspprofreport *r)
+{
+    int i;
+    char label[MAXPDSTRING], path[MAXPDSTRING];
+    fprintf(fd, "canvas,box,class,us_per_tick,calls_per_tick,ticks\n");
+    for (i = 0; i < r->r_n; i++)
+    {
+        t_dspprofentry *e = &r->r_entry[i];
+        dspprofile_label(e, label, MAXPDSTRING);
+        dspprofile_path(e->e_canvas, path, MAXPDSTRING);
+        dspprofile_quote(fd, path, 0);
+        putc(',', fd);
+        dspprofile_quote(fd, label, 0);
+        putc(',', fd);
+        dspprofile_quote(fd, (e->e_obj ?
+            class_getname(pd_class(&e->e_obj->ob_pd)) : ""), 0);
+        fprintf(fd, ",%.3f,%.3f,%.0f\n", dspprofile_us(e),
+            (e->e_ticks > 0 ? e->e_calls / e->e_ticks : 0), e->e_ticks);
+    }
+}
+
+    /* one node of the flame tree: a canvas, its boxes, and the subcanvases
+    that contain profiled boxes */
+static void dspprofile_writenode(FILE *fd, t_dspprofreport *r, t_canvas *x,
+    int depth)
+{
+    int i, j, nchild = 0;
+    char label[MAXPDSTRING];
+    fprintf(fd, "%*s{\"name\": ", 2 * depth, "");
+    dspprofile_quote(fd, x->gl_name->s_name, 1);
+    fprintf(fd, ", \"value\": %.3f, \"children\": [",
+        dspprofile_canvastime(r, x));
+    for (i = 0; i < r->r_n; i++)
+    {
+        t_dspprofentry *e = &r->r_entry[i];
+        t_canvas *child;
+        if (e->e_canvas == x)
+        {
+            dspprofile_label(e, label, MAXPDSTRING);
+            fprintf(fd, "%s\n%*s{\"name\": ", (nchild++ ? "," : ""),
+                2 * depth + 2, "");
+            dspprofile_quote(fd, label, 1);
+            fprintf(fd, ", \"value\": %.3f}", dspprofile_us(e));
+            continue;
+        }
+        if (!dspprofile_isin(e->e_canvas, x))
+            continue;
+            /* the subcanvas of x this entry is in; write it once, at the
+            first entry inside it */
+        for (child = e->e_canvas; child->gl_owner != x; )
+            child = child->gl_owner;
+        for (j = 0; j < i; j++)
+            if (dspprofile_isin(r->r_entry[j].e_canvas, child))
+                break;
+        if (j < i)
+            continue;
+        fprintf(fd, "%s\n", (nchild++ ? "," : ""));
+        dspprofile_writenode(fd, r, child, depth + 1);
+    }
+    fprintf(fd, "]}");
+}
+
+static void dspprofile_writejson(FILE *fd, t_dspprofreport *r)
+{
+    int i, j, nroot = 0;
+    double total = 0;
+    for (i = 0; i < r->r_n; i++)
+        total += dspprofile_us(&r->r_entry[i]);
+    fprintf(fd, "{\"name\": \"pd\", \"value\": %.3f, \"children\": [", total);
+    for (i = 0; i < r->r_n; i++)
+    {
+        t_canvas *root;
+        for (root = r->r_entry[i].e_canvas; root->gl_owner; )
+            root = root->gl_owner;
+        for (j = 0; j < i; j++)
+            if (dspprofile_isin(r->r_entry[j].e_canvas, root))
+                break;
+        if (j < i)
+            continue;
+        fprintf(fd, "%s\n", (nroot++ ? "," : ""));
+        dspprofile_writenode(fd, r, root, 1);
+    }
+    fprintf(fd, "]}\n");
+}
+
+static void dspprofile_write(t_symbol *filename, int json)
+{
+    t_dspprofreport r;
+    FILE *fd = sys_fopen(filename->s_name, "w");
+    if (!fd)
+    {
+        pd_error(0, "%s: can't create", filename->s_name);
+        return;
+    }
+    dspprofile_getreport(&r);
+    if (json)
+        dspprofile_writejson(fd, &r);
+    else dspprofile_writecsv(fd, &r);
+    if (ferror(fd))
+        pd_error(0, "%s: write error", filename->s_name);
+    sys_fclose(fd);
+    dspprofile_freereport(&r);
+}
+
+void glob_profile(void *dummy, t_symbol *s, int argc, t_atom *argv)
+{
+    t_symbol *what = atom_getsymbolarg(0, argc, argv);
+    if (argc && argv->a_type == A_FLOAT)
+    {
+        int onoff = (atom_getfloat(argv) != 0);
+        if (onoff != ugen_getprofiling())
+            ugen_setprofiling(onoff);
+    }
+    else if (!argc || what == gensym("print"))
+        dspprofile_print(argc > 1 ? (int)atom_getfloatarg(1, argc, argv) : 20);
+    else if (what == gensym("reset"))
+        ugen_foreachprofile(dspprofile_clear, 0);
+    else if (what == gensym("csv") || what == gensym("json"))
+    {
+        t_symbol *filename = atom_getsymbolarg(1, argc, argv);
+        if (filename == &s_)
+            pd_error(0, "profile %s: no file name given", what->s_name);
+        else dspprofile_write(filename, what == gensym("json"));
+    }
+    else pd_error(0, "profile: unknown argument '%s'", what->s_name);
+}
@@ -12,6 +12,7 @@ thread so that they can be used in real time.  The readsf~ and writesf~
 objects use Posix-like threads. */
 
 #include "d_soundfile.h"
+#include "s_stuff.h"
 #ifdef _WIN32
 #include <io.h>
 #endif
@@ -804,7 +805,11 @@ static int soundfiler_parsewriteargs(void *obj, int *p_argc, t_atom **p_argv,
     return 0;
 }
 
-    /** sets sf fd & headerisze on success and returns fd or -1 on failure */
+void sys_expandpath(const char *from, char *to, int bufsize);
+
+    /** sets sf fd & headerisze on success and returns fd or -1 on failure;
+        without a canvas the filename is taken relative to the current
+        directory */
 static int create_soundfile(t_canvas *canvas, const char *filename,
     t_soundfile *sf, size_t nframes)
 {
@@ -818,7 +823,9 @@ static int create_soundfile(t_canvas *canvas, const char *filename,
         if (!sf->sf_type->t_addextensionfn(filenamebuf, MAXPDSTRING-10))
             return -1;
     filenamebuf[MAXPDSTRING-10] = 0; /* FIXME: what is the 10 for? */
-    canvas_makefilename(canvas, filenamebuf, pathbuf, MAXPDSTRING);
+    if (canvas)
+        canvas_makefilename(canvas, filenamebuf, pathbuf, MAXPDSTRING);
+    else sys_expandpath(filenamebuf, pathbuf, MAXPDSTRING);
     if ((fd = sys_open(pathbuf, O_WRONLY | O_CREAT | O_TRUNC, 0666)) < 0)
         return -1;
     sf->sf_fd = fd;
@@ -1802,6 +1809,7 @@ static void *readsf_child_main(void *zz)
 {
     t_readsf *x = zz;
     t_soundfile sf = {0};
+    int placed = 0;
     soundfile_clear(&sf);
 #ifdef PDINSTANCE
     pd_this = x->x_pd_this;
@@ -1814,6 +1822,8 @@ static void *readsf_child_main(void *zz)
     {
         int fifohead;
         char *buf;
+            /* keep off the DSP CPUs (see sys_placethread()) */
+        sys_updateplacement(CPUS_IO, 0, &placed);
 #ifdef DEBUG_SOUNDFILE_THREADS
         fprintf(stderr, "readsf~: 0\n");
 #endif
@@ -2379,6 +2389,7 @@ static void *writesf_child_main(void *zz)
 {
     t_writesf *x = zz;
     t_soundfile sf = {0};
+    int placed = 0;
     soundfile_clear(&sf);
 #ifdef PDINSTANCE
     pd_this = x->x_pd_this;
@@ -2389,6 +2400,8 @@ static void *writesf_child_main(void *zz)
     pthread_mutex_lock(&x->x_mutex);
     while (1)
     {
+            /* keep off the DSP CPUs (see sys_placethread()) */
+        sys_updateplacement(CPUS_IO, 0, &placed);
 #ifdef DEBUG_SOUNDFILE_THREADS
         fprintf(stderr, "writesf~: 0\n");
 #endif
@@ -2860,6 +2873,197 @@ static void writesf_setup(void)
     CLASS_MAINSIGNALIN(writesf_class, t_writesf, x_f);
 }
 
+/* --------------------- offline rendering (-render) ---------------------- */
+
+/* When Pd is started with "-render <file>" the batch scheduler hands the
+dac~ output of each tick to soundfile_render_write(), which converts it
+straight into a byte FIFO as writesf~ does.  A child thread writes the FIFO
+to disk from where it lies, so the scheduler only ever waits if it gets a
+whole FIFO ahead of the disk. */
+
+#define RENDERBUFSIZE (4 * 1048576)
+
+typedef struct _sfrender
+{
+    t_soundfile r_sf;
+    const char *r_filename;
+    char *r_buf;
+    int r_fifosize;             /**< bytes, a multiple of one tick's worth */
+    volatile int r_fifohead;    /**< next byte the scheduler fills */
+    volatile int r_fifotail;    /**< next byte the child writes */
+    volatile int r_quit;        /**< no more is coming; drain and exit */
+    int r_fileerror;
+    size_t r_frameswritten;
+    int r_sigcountdown;
+    int r_sigperiod;
+    pthread_mutex_t r_mutex;
+    pthread_cond_t r_requestcondition;
+    pthread_cond_t r_answercondition;
+    pthread_t r_childthread;
+} t_sfrender;
+
+static t_sfrender *sfrender;
+
+static void *sfrender_child_main(void *zz)
+{
+    t_sfrender *x = zz;
+    int placed = 0;
+    sys_updateplacement(CPUS_IO, 0, &placed);
+    pthread_mutex_lock(&x->r_mutex);
+    while (!x->r_fileerror)
+    {
+        if (x->r_fifohead != x->r_fifotail)
+        {
+            int fifotail = x->r_fifotail, writebytes =
+                (x->r_fifohead > fifotail ? x->r_fifohead : x->r_fifosize)
+                    - fifotail;
+            ssize_t byteswritten;
+            if (writebytes > WRITESIZE)
+                writebytes = WRITESIZE;
+            pthread_mutex_unlock(&x->r_mutex);
+            byteswritten = write(x->r_sf.sf_fd, x->r_buf + fifotail,
+                writebytes);
+            pthread_mutex_lock(&x->r_mutex);
+            if (byteswritten <= 0)
+                x->r_fileerror = (byteswritten < 0 ? errno : EIO);
+            else
+            {
+                x->r_fifotail = (fifotail + byteswritten) % x->r_fifosize;
+                x->r_frameswritten += byteswritten / x->r_sf.sf_bytesperframe;
+            }
+            sfread_cond_signal(&x->r_answercondition);
+        }
+        else if (x->r_quit)
+            break;
+        else sfread_cond_wait(&x->r_requestcondition, &x->r_mutex);
+    }
+    sfread_cond_signal(&x->r_answercondition);
+    pthread_mutex_unlock(&x->r_mutex);
+    return 0;
+}
+
+    /** open "filename" for rendering; the type comes from its extension and
+        samples are written as 32-bit floats.  Returns 0 on success. */
+int soundfile_render_open(const char *filename, int nchannels,
+    int samplerate)
+{
+    t_soundfiler_writeargs wa = {0};
+    t_sfrender *x;
+    t_atom at[3], *argv = at;
+    int argc = 3;
+    SETSYMBOL(&at[0], gensym("-bytes"));
+    SETFLOAT(&at[1], 4);
+    SETSYMBOL(&at[2], gensym(filename));
+    if (nchannels < 1)
+    {
+        pd_error(0, "-render %s: no output channels to write "
+            "(check -nosound or -outchannels)", filename);
+        return (-1);
+    }
+    if (nchannels > MAXSFCHANS ||
+        soundfiler_parsewriteargs(0, &argc, &argv, &wa) || wa.wa_ascii)
+    {
+        pd_error(0, "-render %s: can't write %d channels to this file type",
+            filename, nchannels);
+        return (-1);
+    }
+    x = (t_sfrender *)getbytes(sizeof(*x));
+    soundfile_clear(&x->r_sf);
+    x->r_sf.sf_type = wa.wa_type;
+    x->r_sf.sf_samplerate = samplerate;
+    x->r_sf.sf_nchannels = nchannels;
+    x->r_sf.sf_bytespersample = wa.wa_bytespersample;
+    x->r_sf.sf_bigendian = wa.wa_bigendian;
+    x->r_sf.sf_bytesperframe = nchannels * wa.wa_bytespersample;
+    x->r_filename = wa.wa_filesym->s_name;
+    if (create_soundfile(0, x->r_filename, &x->r_sf, 0) < 0)
+    {
+        object_sferror(0, "-render", x->r_filename, errno, &x->r_sf);
+        freebytes(x, sizeof(*x));
+        return (-1);
+    }
+    x->r_fifosize = RENDERBUFSIZE - (RENDERBUFSIZE %
+        (x->r_sf.sf_bytesperframe * DEFDACBLKSIZE));
+    x->r_buf = getbytes(x->r_fifosize);
+        /* wake the child 16 times per FIFO */
+    x->r_sigcountdown = x->r_sigperiod = x->r_fifosize /
+        (16 * x->r_sf.sf_bytesperframe * DEFDACBLKSIZE);
+    pthread_mutex_init(&x->r_mutex, 0);
+    pthread_cond_init(&x->r_requestcondition, 0);
+    pthread_cond_init(&x->r_answercondition, 0);
+    pthread_create(&x->r_childthread, 0, sfrender_child_main, x);
+    sfrender = x;
+    return (0);
+}
+
+    /** append "nframes" (at most DEFDACBLKSIZE) frames from "vec", which
+        holds one DEFDACBLKSIZE vector per channel as in STUFF->st_soundout.
+        Returns 0 unless the file can't be written to. */
+int soundfile_render_write(t_sample *vec, int nframes)
+{
+    t_sfrender *x = sfrender;
+    t_sample *vecs[MAXSFCHANS];
+    int i, room, wantbytes = nframes * x->r_sf.sf_bytesperframe;
+    for (i = 0; i < x->r_sf.sf_nchannels; i++)
+        vecs[i] = vec + i * DEFDACBLKSIZE;
+    pthread_mutex_lock(&x->r_mutex);
+    while (!x->r_fileerror)
+    {
+        if ((room = x->r_fifotail - x->r_fifohead) <= 0)
+            room += x->r_fifosize;
+        if (room > wantbytes)
+            break;
+        sfread_cond_signal(&x->r_requestcondition);
+        sfread_cond_wait(&x->r_answercondition, &x->r_mutex);
+    }
+    pthread_mutex_unlock(&x->r_mutex);
+    if (x->r_fileerror)
+        return (-1);
+        /* only we move the head, and the child never reads past it, so
+        the conversion itself needs no lock */
+    soundfile_xferout_sample(&x->r_sf, vecs,
+        (unsigned char *)(x->r_buf + x->r_fifohead), nframes, 0, 1.);
+    pthread_mutex_lock(&x->r_mutex);
+    x->r_fifohead = (x->r_fifohead + wantbytes) % x->r_fifosize;
+    if (--x->r_sigcountdown <= 0 || nframes < DEFDACBLKSIZE)
+    {
+        sfread_cond_signal(&x->r_requestcondition);
+        x->r_sigcountdown = x->r_sigperiod;
+    }
+    pthread_mutex_unlock(&x->r_mutex);
+    return (0);
+}
+
+    /** flush, fix up the header, and close.  Returns 0 on success. */
+int soundfile_render_close(void)
+{
+    t_sfrender *x = sfrender;
+    void *threadrtn;
+    int err;
+    if (!x)
+        return (0);
+    pthread_mutex_lock(&x->r_mutex);
+    x->r_quit = 1;
+    sfread_cond_signal(&x->r_requestcondition);
+    pthread_mutex_unlock(&x->r_mutex);
+    pthread_join(x->r_childthread, &threadrtn);
+    if (!(err = x->r_fileerror) &&
+        !x->r_sf.sf_type->t_updateheaderfn(&x->r_sf, x->r_frameswritten))
+            err = errno;
+    if (err)
+        object_sferror(0, "-render", x->r_filename, err, &x->r_sf);
+    else logpost(0, PD_VERBOSE, "-render: wrote %ld frames to %s",
+        (long)x->r_frameswritten, x->r_filename);
+    sys_close(x->r_sf.sf_fd);
+    pthread_cond_destroy(&x->r_requestcondition);
+    pthread_cond_destroy(&x->r_answercondition);
+    pthread_mutex_destroy(&x->r_mutex);
+    freebytes(x->r_buf, x->r_fifosize);
+    freebytes(x, sizeof(*x));
+    sfrender = 0;
+    return (err != 0);
+}
+
 /* ------------------------- global setup routine ------------------------ */
 
 void d_soundfile_setup(void)
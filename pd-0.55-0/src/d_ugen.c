@@ -14,8 +14,19 @@
 #include "m_pd.h"
 #include "m_imp.h"
 #include "g_canvas.h"
+#include "s_stuff.h"
 #include <stdarg.h>
+#include <string.h>
+#include <float.h>
 #define DEFDACBLKSIZE 64    /* from s_stuff.h - LATER make this dynamic */
+#define DSPCHAINMIN 256     /* initial size of a DSP chain, in words */
+#define SIGARENASIZE 16384  /* bytes in each block of signal memory */
+#define SIGALIGN 64         /* alignment of signal vectors, in bytes */
+    /* a signal may reuse a free vector up to this many powers of 2 larger
+    than it needs */
+#define SIGMAXSTRETCH 3
+#define UGENPLAN_HASHSIZE 64    /* buckets for saved canvas graphs */
+#define UGENPLAN_MAX 1024       /* forget them all beyond this many */
 
 extern t_class *vinlet_class, *voutlet_class, *canvas_class, *text_class;
 
@@ -32,11 +43,69 @@ void voutlet_dspepilog(struct _voutlet *x, t_signal **parentsigs,
     int myvecsize, int phase, int period, int frequency,
     int downsample, int upsample, int reblock, int switched);
 
+    /* parallel regions, from d_parallel.c */
+EXTERN_STRUCT _dspregion;
+struct _dspregion *dspregion_new(struct _dspregion **list);
+void dspregion_mark(struct _dspregion *r, int onset, int unsafe);
+void dspregion_touch(struct _dspregion *r, const void *vec, size_t nbytes,
+    int write);
+void dspregion_finish(struct _dspregion *r, int length);
+void dspregion_freelist(struct _dspregion **list);
+t_int *dspregion_perform(t_int *w);
+int dspregion_nthreads(void);
+
+    /* profiling, from d_profile.c */
+EXTERN_STRUCT _dspprofile;
+struct _dspprofile *dspprofile_new(t_canvas *x);
+void dspprofile_mark(struct _dspprofile *p, int onset, t_object *obj,
+    t_canvas *canvas);
+void dspprofile_finish(struct _dspprofile *p, int chainsize);
+void dspprofile_free(struct _dspprofile *p);
+void dspprofile_perform(struct _dspprofile *p, t_int *chain);
+
+    /* fusing arithmetic, from d_arithmetic.c */
+t_perfroutine d_arithmetic_fuse(t_int *w);
+
+    /* Signal vectors for each fragment (below) are carved out of a few
+    large, aligned blocks of memory rather than allocated one by one, so
+    that the vectors a chain uses are packed next to each other and stay in
+    cache together.  They're all freed at once with the chain. */
+typedef struct _sigarena
+{
+    struct _sigarena *a_next;
+    size_t a_size;                  /* bytes allocated, including header */
+    char *a_mem;                    /* first free aligned byte */
+    char *a_end;                    /* end of the block */
+} t_sigarena;
+
+    /* The DSP chain is kept in "fragments", one for each toplevel canvas,
+    so that after an edit only the edited toplevel's chain need be rebuilt
+    (see canvas_suspend_dsp_for() in g_canvas.c).  dsp_tick() runs them in
+    the order of the toplevels. */
+typedef struct _dspfragment
+{
+    t_canvas *f_canvas;             /* the toplevel this is the chain for */
+    t_int *f_chain;                 /* DSP chain */
+    int f_chainsize;                /* number of elements in DSP chain */
+    t_signal *f_signals;            /* list of signals used by DSP chain */
+    t_sigarena *f_arena;            /* memory for the signals' vectors */
+    struct _dspregion *f_regions;   /* parallel regions in the chain */
+    struct _dspprofile *f_profile;  /* timings if built for profiling */
+    unsigned int f_linked:1;        /* objects may refer to other toplevels */
+    unsigned int f_dirty:1;         /* toplevel edited since we built this */
+    struct _dspfragment *f_next;
+} t_dspfragment;
+
 struct _instanceugen
 {
-    t_int *u_dspchain;         /* DSP chain */
+    t_int *u_dspchain;         /* DSP chain being built */
     int u_dspchainsize;        /* number of elements in DSP chain */
+    int u_dspchainalloc;       /* number of elements allocated */
+    int u_lastonset;           /* onset of the last routine added, or -1 */
     t_signal *u_signals;       /* list of signals used by DSP chain */
+    t_sigarena *u_arena;       /* memory for their vectors */
+    t_signal **u_stretchin;    /* if set, new signals may take larger free */
+    int u_nstretchin;          /* vectors, except these (see ugen_doit) */
     int u_sortno;              /* number of DSP sortings so far */
         /* list of signals which can be reused, sorted by buffer size */
     t_signal *u_freelist[MAXLOGSIG+1];
@@ -45,20 +114,58 @@ struct _instanceugen
     int u_phase;
     int u_loud;
     struct _dspcontext *u_context;
+    struct _dspregion *u_region;    /* parallel region we're building */
+    struct _dspcontext *u_regioncontext;    /* toplevel context it's for */
+    int u_regiononset;              /* chain index of the region's start */
+        /* buffers freed by clone instances compiled in parallel */
+    t_signal *u_forkfree[MAXLOGSIG+1];
+    struct _dspregion *u_regions;   /* all regions on the current chain */
+    t_dspfragment *u_fragments;     /* the running chain, one per toplevel */
+    t_dspfragment **u_lastfragment; /* where to append the next one */
+    t_dspfragment *u_oldfragments;  /* left over from before an update */
+    t_dspfragment *u_building;      /* the one we're building */
+    int u_profiling;                /* build chains for profiling */
+    int u_placed;                   /* see sys_updateplacement() */
+    struct _dspscene *u_scenes;     /* toplevels held or fading */
+    t_sample *u_scenebuf;           /* DAC output before a fading one ran */
+    int u_scenebufsize;
+    t_clock *u_sceneclock;          /* to clean up after fades */
+    struct _dspprofile *u_profile;  /* profile for the one we're building */
+        /* graphs of canvases sorted before, for reuse (see ugen_addcanvas) */
+    struct _ugenplan *u_plans[UGENPLAN_HASHSIZE];
+    int u_nplans;
 };
 
 #define THIS (pd_this->pd_ugen)
 
+static void ugen_freeplans(void);
+static void ugen_dropscene(t_canvas *x);
+static void ugen_freescenes(void);
+
 void d_ugen_newpdinstance(void)
 {
     THIS = getbytes(sizeof(*THIS));
     THIS->u_dspchain = 0;
-    THIS->u_dspchainsize = 0;
+    THIS->u_dspchainsize = THIS->u_dspchainalloc = 0;
+    THIS->u_lastonset = -1;
     THIS->u_signals = 0;
+    THIS->u_arena = 0;
+    THIS->u_fragments = 0;
+    THIS->u_lastfragment = &THIS->u_fragments;
+    THIS->u_profiling = 0;
+    THIS->u_profile = 0;
+    memset(THIS->u_plans, 0, sizeof(THIS->u_plans));
+    THIS->u_nplans = 0;
+    THIS->u_scenes = 0;
+    THIS->u_scenebuf = 0;
+    THIS->u_scenebufsize = 0;
+    THIS->u_sceneclock = 0;
 }
 
 void d_ugen_freepdinstance(void)
 {
+    ugen_freeplans();
+    ugen_freescenes();
     freebytes(THIS, sizeof(*THIS));
 }
 
@@ -138,6 +245,7 @@ typedef struct _block
     int x_period;       /* submultiple of containing canvas */
     int x_frequency;    /* supermultiple of comtaining canvas */
     int x_count;        /* number of times parent block has called us */
+    t_dspfragment *x_fragment;  /* DSP chain we're on */
     int x_chainonset;   /* beginning of code in DSP chain */
     int x_blocklength;  /* length of dspchain for this block */
     int x_epiloglength; /* length of epilog */
@@ -265,13 +373,24 @@ static void block_float(t_block *x, t_floatarg f)
     }
 }
 
+    /* find the chain we were put on, if DSP is still running it */
+static t_int *block_getchain(t_block *x)
+{
+    t_dspfragment *f;
+    for (f = THIS->u_fragments; f; f = f->f_next)
+        if (f == x->x_fragment)
+            return (f->f_chain);
+    return (0);
+}
+
 static void block_bang(t_block *x)
 {
-    if (x->x_switched && !x->x_switchon && THIS->u_dspchain)
+    t_int *chain = block_getchain(x);
+    if (x->x_switched && !x->x_switchon && chain)
     {
         t_int *ip;
         x->x_return = 1;
-        for (ip = THIS->u_dspchain + x->x_chainonset; ip; )
+        for (ip = chain + x->x_chainonset; ip; )
             ip = (*(t_perfroutine)(*ip))(ip);
         x->x_return = 0;
     }
@@ -281,7 +400,7 @@ static void block_bang(t_block *x)
     {
         if (x->x_switchon)
             pd_error(x, "[switch~]: bang has no effect at on-state");
-        if (!THIS->u_dspchain)
+        if (!chain)
             pd_error(x, "[switch~]: bang has no effect if DSP is off");
     }
 }
@@ -337,7 +456,8 @@ static void block_dsp(t_block *x, t_signal **sp)
 void block_tilde_setup(void)
 {
     block_class = class_new(gensym("block~"), (t_newmethod)block_new, 0,
-            sizeof(t_block), 0, A_DEFFLOAT, A_DEFFLOAT, A_DEFFLOAT, 0);
+            sizeof(t_block), CLASS_PARALLELSAFE,
+                A_DEFFLOAT, A_DEFFLOAT, A_DEFFLOAT, 0);
     class_addcreator((t_newmethod)switch_new, gensym("switch~"),
         A_DEFFLOAT, A_DEFFLOAT, A_DEFFLOAT, 0);
     class_addmethod(block_class, (t_method)block_set, gensym("set"),
@@ -354,50 +474,381 @@ static t_int dsp_done(t_int *w)
     return (0);
 }
 
+    /* make room for a perform routine with n arguments.  The chain grows
+    by doubling so that building it costs linear time; ugen_endfragment()
+    trims it to size when it's done. */
+static void dsp_grow(int n)
+{
+    int newsize = THIS->u_dspchainsize + n+1, newalloc;
+    if (newsize <= THIS->u_dspchainalloc)
+        return;
+    for (newalloc = THIS->u_dspchainalloc * 2; newalloc < newsize; )
+        newalloc *= 2;
+    THIS->u_dspchain = t_resizebytes(THIS->u_dspchain,
+        THIS->u_dspchainalloc * sizeof (t_int), newalloc * sizeof (t_int));
+    THIS->u_dspchainalloc = newalloc;
+}
+
+    /* a routine has just been added at "onset"; if it and the one before it
+    can be done in one pass, replace the first with a routine that does
+    both (see d_arithmetic_fuse()).  Not while profiling, which charges
+    each routine to its own box. */
+static void dsp_fuse(int onset)
+{
+    t_perfroutine fused;
+    if (THIS->u_lastonset >= 0 && !THIS->u_profile &&
+        (fused = d_arithmetic_fuse(THIS->u_dspchain + THIS->u_lastonset)))
+    {
+        THIS->u_dspchain[THIS->u_lastonset] = (t_int)fused;
+        THIS->u_lastonset = -1;
+    }
+    else THIS->u_lastonset = onset;
+}
+
 void dsp_add(t_perfroutine f, int n, ...)
 {
     int newsize = THIS->u_dspchainsize + n+1, i;
+    t_int *ip;
     va_list ap;
 
-    THIS->u_dspchain = t_resizebytes(THIS->u_dspchain,
-        THIS->u_dspchainsize * sizeof (t_int), newsize * sizeof (t_int));
-    THIS->u_dspchain[THIS->u_dspchainsize-1] = (t_int)f;
-    if (THIS->u_loud)
-        post("add to chain: %lx",
-            THIS->u_dspchain[THIS->u_dspchainsize-1]);
+    dsp_grow(n);
+    ip = THIS->u_dspchain + (THIS->u_dspchainsize-1);
+    *ip++ = (t_int)f;
     va_start(ap, n);
     for (i = 0; i < n; i++)
-    {
-        THIS->u_dspchain[THIS->u_dspchainsize + i] = va_arg(ap, t_int);
-        if (THIS->u_loud)
-            post("add to chain: %lx",
-                THIS->u_dspchain[THIS->u_dspchainsize + i]);
-    }
+        *ip++ = va_arg(ap, t_int);
     va_end(ap);
-    THIS->u_dspchain[newsize-1] = (t_int)dsp_done;
+    *ip = (t_int)dsp_done;
     THIS->u_dspchainsize = newsize;
+    dsp_fuse(newsize - n - 2);
 }
 
     /* at Guenter's suggestion, here's a vectorized version */
 void dsp_addv(t_perfroutine f, int n, t_int *vec)
 {
-    int newsize = THIS->u_dspchainsize + n+1, i;
+    int newsize = THIS->u_dspchainsize + n+1;
 
-    THIS->u_dspchain = t_resizebytes(THIS->u_dspchain,
-        THIS->u_dspchainsize * sizeof (t_int), newsize * sizeof (t_int));
+    dsp_grow(n);
     THIS->u_dspchain[THIS->u_dspchainsize-1] = (t_int)f;
-    for (i = 0; i < n; i++)
-        THIS->u_dspchain[THIS->u_dspchainsize + i] = vec[i];
+    memcpy(THIS->u_dspchain + THIS->u_dspchainsize, vec, n * sizeof(t_int));
     THIS->u_dspchain[newsize-1] = (t_int)dsp_done;
     THIS->u_dspchainsize = newsize;
+    dsp_fuse(newsize - n - 2);
+}
+
+/* ------------------- flushing denormals -------------------------- */
+
+    /* Denormal numbers are very slow on most FPUs, and recursive filters
+    decaying toward silence make them in droves.  Where the hardware can
+    flush them to zero (the FTZ and DAZ bits on SSE, FZ on ARM) we turn that
+    on for as long as each DSP tick runs, and in the DSP worker threads, and
+    restore whatever the thread had before; filters then needn't check each
+    sample they compute.  Whether flushing really works is tested once, by
+    trying to make a denormal, so that a missing or emulated FPU feature
+    falls back on the checks.  "pd flush-denormals 0" turns it off. */
+
+#if defined(__SSE__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define DSP_FLUSH_SSE
+#elif defined(__aarch64__) && defined(__GNUC__)
+#define DSP_FLUSH_ARM64
+#elif defined(__arm__) && defined(__GNUC__) && defined(__ARM_FP)
+#define DSP_FLUSH_ARM
+#endif
+
+static int dsp_flushwanted = 1;
+static int dsp_flushworks = -1;     /* -1 until tested */
+
+static unsigned int dsp_getfpstate(void)
+{
+#if defined(DSP_FLUSH_SSE)
+    return (_mm_getcsr());
+#elif defined(DSP_FLUSH_ARM64)
+    unsigned long long fpcr;
+    __asm__ __volatile__ ("mrs %0, fpcr" : "=r" (fpcr));
+    return ((unsigned int)fpcr);
+#elif defined(DSP_FLUSH_ARM)
+    unsigned int fpscr;
+    __asm__ __volatile__ ("vmrs %0, fpscr" : "=r" (fpscr));
+    return (fpscr);
+#else
+    return (0);
+#endif
+}
+
+static void dsp_setfpstate(unsigned int state)
+{
+#if defined(DSP_FLUSH_SSE)
+    _mm_setcsr(state);
+#elif defined(DSP_FLUSH_ARM64)
+    unsigned long long fpcr = state;
+    __asm__ __volatile__ ("msr fpcr, %0" : : "r" (fpcr));
+#elif defined(DSP_FLUSH_ARM)
+    __asm__ __volatile__ ("vmsr fpscr, %0" : : "r" (state));
+#endif
+}
+
+static unsigned int dsp_flushbits(void)
+{
+#if defined(DSP_FLUSH_SSE)
+    return (0x8040);        /* FTZ | DAZ */
+#elif defined(DSP_FLUSH_ARM64) || defined(DSP_FLUSH_ARM)
+    return (1 << 24);       /* FZ */
+#else
+    return (0);
+#endif
+}
+
+    /* true if DSP runs with denormals flushed, so that perform routines
+    can leave out their own checks */
+int dsp_flushing(void)
+{
+    if (dsp_flushworks < 0)
+    {
+        unsigned int was = dsp_getfpstate();
+#if PD_FLOATSIZE == 32
+        volatile t_sample tiny = FLT_MIN;
+#else
+        volatile t_sample tiny = DBL_MIN;
+#endif
+        volatile t_sample half = 0.5, one = 1, denormal, flushed, read;
+        denormal = tiny * half;     /* a denormal, unless already flushing */
+        dsp_setfpstate(was | dsp_flushbits());
+        flushed = tiny * half;      /* zero if results are flushed */
+        read = denormal * one;      /* zero if operands are too */
+        dsp_setfpstate(was);
+        dsp_flushworks = (dsp_flushbits() && flushed == 0 && read == 0);
+        if (!dsp_flushworks)
+            logpost(0, PD_VERBOSE,
+                "DSP: can't flush denormals in hardware; checking instead");
+    }
+    return (dsp_flushwanted && dsp_flushworks);
+}
+
+    /* turn flushing on in this thread if we're using it; returns the state
+    to give back to dsp_endflush() afterward */
+unsigned int dsp_startflush(void)
+{
+    unsigned int was = dsp_getfpstate();
+    if (dsp_flushing())
+        dsp_setfpstate(was | dsp_flushbits());
+    return (was);
+}
+
+void dsp_endflush(unsigned int was)
+{
+    if (dsp_flushworks > 0)
+        dsp_setfpstate(was);
+}
+
+void glob_flushdenormals(void *dummy, t_floatarg f)
+{
+    dsp_flushwanted = (f != 0);
+        /* perform routines are picked accordingly when the chain is built */
+    canvas_update_dsp();
+}
+
+#ifdef DEBUGMEM
+void rtmem_dspenter(void);  /* from m_memory.c */
+void rtmem_dspexit(void);
+#endif
+
+/* ----------------- held and crossfaded toplevels -------------------- */
+
+    /* A toplevel opened with "pd prepare" (see glob_prepare() in
+    g_canvas.c) gets its own chain compiled while DSP keeps running, but
+    is held silent, without being run at all, until "pd commit" fades it
+    in; the same message fades others out, closing them once they're
+    silent.  Both happen between two ticks.  A fading toplevel's chain runs
+    as usual and then whatever it added to the DAC outputs is scaled, which
+    works because dac~ adds into the output buffer.  (Anything else it
+    writes, like arrays or throw~ buses, isn't faded.) */
+
+typedef struct _dspscene
+{
+    t_canvas *s_canvas;
+    t_sample s_gain;            /* gain at the start of the next tick */
+    t_sample s_inc;             /* change per sample while fading */
+    t_sample s_target;          /* gain at the end of the fade */
+    int s_nfade;                /* samples left in the fade */
+    unsigned int s_held:1;      /* prepared but not yet committed */
+    unsigned int s_done:1;      /* fade over; clean up at the next clock */
+    struct _dspscene *s_next;
+} t_dspscene;
+
+static t_dspscene *ugen_findscene(t_canvas *x)
+{
+    t_dspscene *sc;
+    for (sc = THIS->u_scenes; sc; sc = sc->s_next)
+        if (sc->s_canvas == x)
+            return (sc);
+    return (0);
+}
+
+static void ugen_dropscene(t_canvas *x)
+{
+    t_dspscene **sp, *sc;
+    for (sp = &THIS->u_scenes; (sc = *sp); sp = &sc->s_next)
+        if (sc->s_canvas == x)
+    {
+        *sp = sc->s_next;
+        freebytes(sc, sizeof(*sc));
+        return;
+    }
+}
+
+static void ugen_freescenes(void)
+{
+    while (THIS->u_scenes)
+        ugen_dropscene(THIS->u_scenes->s_canvas);
+    freebytes(THIS->u_scenebuf, THIS->u_scenebufsize * sizeof(t_sample));
+    if (THIS->u_sceneclock)
+        clock_free(THIS->u_sceneclock);
+}
+
+    /* after a fade, forget toplevels that are now at full gain, and close
+    ones that have been faded out */
+static void ugen_scenetick(void *dummy)
+{
+    t_dspscene *sc = THIS->u_scenes;
+    while (sc)
+    {
+        if (sc->s_done)
+        {
+            t_canvas *x = sc->s_canvas;
+            int close = (sc->s_target == 0);
+            ugen_dropscene(x);
+            if (close)
+                pd_free(&x->gl_pd);
+            sc = THIS->u_scenes;    /* the list may have changed */
+        }
+        else sc = sc->s_next;
+    }
+}
+
+static t_dspscene *ugen_getscene(t_canvas *x)
+{
+    t_dspscene *sc = ugen_findscene(x);
+    if (!sc)
+    {
+        sc = (t_dspscene *)getbytes(sizeof(*sc));
+        sc->s_canvas = x;
+        sc->s_gain = sc->s_target = 1;
+        sc->s_next = THIS->u_scenes;
+        THIS->u_scenes = sc;
+    }
+    if (!THIS->u_sceneclock)
+        THIS->u_sceneclock = clock_new(0, (t_method)ugen_scenetick);
+    return (sc);
+}
+
+    /* hold a toplevel silent until it's faded in */
+void ugen_holdcanvas(t_canvas *x)
+{
+    t_dspscene *sc = ugen_getscene(x);
+    sc->s_held = 1;
+    sc->s_gain = sc->s_target = 0;
+    sc->s_nfade = 0;
+    sc->s_done = 0;
+}
+
+    /* make sure the crossfade buffer holds a block of every output channel;
+    the channel count can change while a fade is under way */
+static void ugen_growscenebuf(void)
+{
+    int size = STUFF->st_outchannels * DEFDACBLKSIZE;
+    if (size > THIS->u_scenebufsize)
+    {
+        THIS->u_scenebuf = (t_sample *)resizebytes(THIS->u_scenebuf,
+            THIS->u_scenebufsize * sizeof(t_sample), size * sizeof(t_sample));
+        THIS->u_scenebufsize = size;
+    }
+}
+
+    /* fade a toplevel in, or out and then close it, over "msec" */
+void ugen_fadecanvas(t_canvas *x, t_float msec, int out)
+{
+    t_dspscene *sc = ugen_getscene(x);
+    ugen_growscenebuf();
+    sc->s_held = 0;
+    sc->s_done = 0;
+    sc->s_target = (out ? 0 : 1);
+    sc->s_nfade = (pd_getdspstate() ? msec * sys_getsr() * 0.001 : 0);
+    if (sc->s_nfade > 0)
+        sc->s_inc = (sc->s_target - sc->s_gain) / sc->s_nfade;
+    else
+    {
+        sc->s_gain = sc->s_target;
+        sc->s_done = 1;
+        clock_delay(THIS->u_sceneclock, 0);
+    }
+}
+
+static void ugen_runfragment(t_dspfragment *f)
+{
+    t_int *ip;
+    if (f->f_profile)
+        dspprofile_perform(f->f_profile, f->f_chain);
+    else for (ip = f->f_chain; ip; ) ip = (*(t_perfroutine)(*ip))(ip);
+}
+
+    /* run a toplevel that's held or fading */
+static void ugen_runscene(t_dspfragment *f, t_dspscene *sc)
+{
+    t_sample *out = STUFF->st_soundout, *save;
+    int size = STUFF->st_outchannels * DEFDACBLKSIZE, i, j, n;
+    if (sc->s_held || (sc->s_done && sc->s_target == 0))
+        return;
+    ugen_growscenebuf();
+    save = THIS->u_scenebuf;
+    memcpy(save, out, size * sizeof(t_sample));
+    ugen_runfragment(f);
+    n = (sc->s_nfade < DEFDACBLKSIZE ? sc->s_nfade : DEFDACBLKSIZE);
+    for (j = 0; j < size; j += DEFDACBLKSIZE)
+    {
+        t_sample g = sc->s_gain;
+        for (i = 0; i < DEFDACBLKSIZE; i++)
+        {
+            out[j + i] = save[j + i] + g * (out[j + i] - save[j + i]);
+            if (i < n)
+                g += sc->s_inc;
+        }
+    }
+    if (!sc->s_done)
+    {
+        sc->s_gain += n * sc->s_inc;
+        if (!(sc->s_nfade -= n))
+        {
+            sc->s_gain = sc->s_target;
+            sc->s_done = 1;
+            clock_delay(THIS->u_sceneclock, 0);
+        }
+    }
 }
 
 void dsp_tick(void)
 {
-    if (THIS->u_dspchain)
+    if (THIS->u_fragments)
     {
-        t_int *ip;
-        for (ip = THIS->u_dspchain; ip; ) ip = (*(t_perfroutine)(*ip))(ip);
+        t_dspfragment *f;
+        t_dspscene *sc;
+        unsigned int fpstate;
+        sys_updateplacement(CPUS_DSP, 0, &THIS->u_placed);
+        fpstate = dsp_startflush();
+#ifdef DEBUGMEM
+        rtmem_dspenter();
+#endif
+        for (f = THIS->u_fragments; f; f = f->f_next)
+        {
+            if (THIS->u_scenes && (sc = ugen_findscene(f->f_canvas)))
+                ugen_runscene(f, sc);
+            else ugen_runfragment(f);
+        }
+#ifdef DEBUGMEM
+        rtmem_dspexit();
+#endif
+        dsp_endflush(fpstate);
         THIS->u_phase++;
     }
 }
@@ -417,21 +868,45 @@ int ilog2(int n)
 }
 
 
-    /* call this when DSP is stopped to free all the signals */
-static void signal_cleanup(void)
+    /* get aligned memory for a signal vector from the current arena */
+static t_sample *signal_getvec(int n)
+{
+    size_t nbytes = ((n * sizeof(t_sample) + SIGALIGN - 1) / SIGALIGN)
+        * SIGALIGN;
+    t_sigarena *a = THIS->u_arena;
+    char *ret;
+    if (!a || a->a_mem + nbytes > a->a_end)
+    {
+        size_t size = sizeof(*a) + SIGALIGN +
+            (nbytes > SIGARENASIZE ? nbytes : SIGARENASIZE);
+        a = (t_sigarena *)getbytes(size);
+        a->a_size = size;
+        a->a_mem = (char *)(((size_t)(a + 1) + SIGALIGN - 1) &
+            ~(size_t)(SIGALIGN - 1));
+        a->a_end = (char *)a + size;
+        a->a_next = THIS->u_arena;
+        THIS->u_arena = a;
+    }
+    ret = a->a_mem;
+    a->a_mem += nbytes;
+    return ((t_sample *)ret);
+}
+
+    /* call this when a chain is freed to free all its signals */
+static void signal_cleanup(t_signal **list, t_sigarena **arena)
 {
     t_signal *sig;
-    int i;
-    while ((sig = THIS->u_signals))
+    t_sigarena *a;
+    while ((sig = *list))
     {
-        THIS->u_signals = sig->s_nextused;
-        if (!sig->s_isborrowed && !sig->s_isscalar)
-            t_freebytes(sig->s_vec, sig->s_nalloc * sizeof (*sig->s_vec));
+        *list = sig->s_nextused;
         t_freebytes(sig, sizeof *sig);
     }
-    for (i = 0; i <= MAXLOGSIG; i++)
-        THIS->u_freelist[i] = 0;
-    THIS->u_freeborrowed = 0;
+    while ((a = *arena))
+    {
+        *arena = a->a_next;
+        freebytes(a, a->a_size);
+    }
 }
 
 static void signal_dereference(t_signal *s)
@@ -493,6 +968,34 @@ void signal_makereusable(t_signal *sig)
     }
 }
 
+    /* Look for a free vector in one of the next few larger size classes.
+    Exact-size reuse lets a box compute in place, writing its outputs over
+    its own inputs, which only works when they have the same shape; so the
+    inputs of the box being scheduled, listed in u_stretchin, are passed
+    over here.  Return the list link pointing to the signal found. */
+static t_signal **signal_findbigger(t_signal **whichlist, t_signal **found)
+{
+    int i, j;
+    t_signal **sp;
+    for (i = 0; i < SIGMAXSTRETCH &&
+        whichlist < THIS->u_freelist + MAXLOGSIG; i++)
+    {
+        for (sp = ++whichlist; *sp; sp = &(*sp)->s_nextfree)
+        {
+            for (j = 0; j < THIS->u_nstretchin; j++)
+                if (THIS->u_stretchin[j]->s_vec == (*sp)->s_vec)
+                    break;
+            if (j == THIS->u_nstretchin)
+            {
+                *found = *sp;
+                return (sp);
+            }
+        }
+    }
+    *found = 0;
+    return (whichlist);
+}
+
     /* pop an audio signal from free list or create a new one.
     if "scalarp" is nonzero, it's a pointer to a scalar owned by the
     tilde object; in this case we neither allocate nor free it.
@@ -521,15 +1024,23 @@ t_signal *signal_new(int length, int nchans, t_float sr, t_sample *scalarptr)
     else /* scalar or borrowed signal */
         whichlist = &THIS->u_freeborrowed;
 
-        /* try to reclaim one from the free list */
-    if ((ret = *whichlist))
+        /* try to reclaim one from the free list.  Failing that, a somewhat
+        larger free vector is better than a new one, since it's already
+        warm in the cache and the chain's memory doesn't grow. */
+    if (!(ret = *whichlist) && allocsize && THIS->u_stretchin)
+        whichlist = signal_findbigger(whichlist, &ret);
+    if (ret)
+    {
         *whichlist = ret->s_nextfree;
+        if (allocsize)
+            allocsize = ret->s_nalloc;
+    }
     else
     {
                  /* LATER figure out what to do if we ran out of space */
         ret = (t_signal *)t_getbytes(sizeof *ret);
         if (allocsize)
-            ret->s_vec = (t_sample *)getbytes(allocsize * sizeof (*ret->s_vec));
+            ret->s_vec = signal_getvec(allocsize);
         ret->s_nextused = THIS->u_signals;
         THIS->u_signals = ret;
     }
@@ -554,6 +1065,9 @@ t_signal *signal_new(int length, int nchans, t_float sr, t_sample *scalarptr)
     ret->s_overlap = 0;
     ret->s_refcount = 0;
     ret->s_borrowedfrom = 0;
+    if (THIS->u_region && allocsize)
+        dspregion_touch(THIS->u_region, ret->s_vec,
+            allocsize * sizeof(*ret->s_vec), 1);
     if (THIS->u_loud) post("new %lx: %lx", ret, ret->s_vec);
     return (ret);
 }
@@ -598,6 +1112,116 @@ static int signal_compatible(t_signal *s1, t_signal *s2)
         && s1->s_sr == s2->s_sr && s1->s_overlap == s2->s_overlap);
 }
 
+/* ---------------------- sample-accurate events ----------------------- */
+
+    /* Messages reach signal objects between DSP ticks, but each one is sent
+    at a logical time that can fall anywhere in the block about to be
+    computed: clocks run at their own times within the tick.  A queue
+    remembers that time for each event so the perform routine can apply it
+    at the right sample, using the same bookkeeping as vline~ to find out
+    which stretch of logical time the current block covers.  The queue only
+    grows up to SIGEVENTQMAX events (if, say, the object isn't in a running
+    DSP chain); past that sigeventq_add() refuses and the object should
+    clear the queue and apply the value right away. */
+
+#define SIGEVENTQINIT 16
+#define SIGEVENTQMAX 4096
+
+void sigeventq_init(t_sigeventq *x)
+{
+    x->q_vec =
+        (t_sigevent *)rt_getbytes(SIGEVENTQINIT * sizeof(t_sigevent));
+    x->q_size = SIGEVENTQINIT;
+    x->q_head = x->q_tail = 0;
+    x->q_referencetime = clock_getlogicaltime();
+    x->q_lastlogicaltime = x->q_blocktime = x->q_nextblocktime = 0;
+    x->q_msecpersamp = 1000./44100.;
+}
+
+void sigeventq_free(t_sigeventq *x)
+{
+    rt_freebytes(x->q_vec, x->q_size * sizeof(t_sigevent));
+}
+
+void sigeventq_dsp(t_sigeventq *x, t_float sr)
+{
+    x->q_msecpersamp = 1000. / sr;
+}
+
+int sigeventq_add(t_sigeventq *x, int which, t_float f)
+{
+    t_sigevent *e;
+    if (((x->q_tail + 1) & (x->q_size - 1)) == x->q_head)
+    {
+            /* full: double the ring, unwrapping it as we go */
+        int i, n = x->q_size - 1;
+        t_sigevent *vec;
+        if (x->q_size >= SIGEVENTQMAX)
+            return (0);
+        vec = (t_sigevent *)rt_getbytes(
+            2 * x->q_size * sizeof(t_sigevent));
+        for (i = 0; i < n; i++)
+            vec[i] = x->q_vec[(x->q_head + i) & (x->q_size - 1)];
+        rt_freebytes(x->q_vec, x->q_size * sizeof(t_sigevent));
+        x->q_vec = vec;
+        x->q_size *= 2;
+        x->q_head = 0;
+        x->q_tail = n;
+    }
+    e = &x->q_vec[x->q_tail];
+    e->e_time = clock_gettimesince(x->q_referencetime);
+    e->e_which = which;
+    e->e_f = f;
+    x->q_tail = (x->q_tail + 1) & (x->q_size - 1);
+    return (1);
+}
+
+void sigeventq_clear(t_sigeventq *x)
+{
+    x->q_head = x->q_tail;
+}
+
+    /* find out what logical time the block of n samples we're about to
+    compute starts at.  A block ends at the current logical time, so if
+    this is the first block in this tick it started DEFDACBLKSIZE samples
+    (or n, if larger) ago; smaller blocks follow on from each other. */
+void sigeventq_startblock(t_sigeventq *x, int n)
+{
+    double logicaltimenow = clock_gettimesince(x->q_referencetime);
+    if (logicaltimenow != x->q_lastlogicaltime)
+    {
+        int sampstotime = (n > DEFDACBLKSIZE ? n : DEFDACBLKSIZE);
+        x->q_lastlogicaltime = logicaltimenow;
+        x->q_nextblocktime = logicaltimenow - sampstotime * x->q_msecpersamp;
+    }
+    x->q_blocktime = x->q_nextblocktime;
+    x->q_nextblocktime = x->q_blocktime + n * x->q_msecpersamp;
+}
+
+    /* return the offset in this block of the next event due in it (the
+    first sample at or after its time), and take it off the queue; or
+    return n if there's none.  Events that were sent before the block
+    started (such as messages from the GUI) come out at offset zero. */
+int sigeventq_next(t_sigeventq *x, int n, t_sigevent *e)
+{
+    double offset;
+    int i;
+    if (x->q_head == x->q_tail)
+        return (n);
+        /* allow for roundoff so an event on a sample isn't pushed late */
+    offset = (x->q_vec[x->q_head].e_time - x->q_blocktime) /
+        x->q_msecpersamp - 1e-4;
+    if (offset >= n)
+        return (n);
+    else if (offset <= 0)
+        i = 0;
+    else if ((i = (int)offset) < offset && ++i == n)
+        return (n);
+    *e = x->q_vec[x->q_head];
+    x->q_head = (x->q_head + 1) & (x->q_size - 1);
+    return (i);
+}
+
 /* ------------------ ugen ("unit generator") sorting ----------------- */
 
 typedef struct _ugenbox
@@ -638,7 +1262,11 @@ typedef struct _sigoutlet
 struct _dspcontext
 {
     struct _ugenbox *dc_ugenlist;
+    struct _ugenbox **dc_hash;      /* ugenboxes hashed by object */
+    int dc_hashsize;                /* size of hash table, a power of 2 */
+    int dc_nugen;                   /* number of ugenboxes */
     struct _dspcontext *dc_parentcontext;
+    t_canvas *dc_canvas;            /* canvas being sorted, if known */
     int dc_ninlets;
     int dc_noutlets;
     t_signal **dc_iosigs;
@@ -647,6 +1275,7 @@ struct _dspcontext
     unsigned int dc_reblock:1;      /* true if we have to reblock in/outlets */
     unsigned int dc_switched:1;     /* true if we're switched */
     unsigned int dc_warnedmulti:1;  /* already warned about bad multi input */
+    struct _ugenplan *dc_plan;      /* saved graph we're using, if any */
 };
 #define DC_LENGTH(x) ((x)->dc_nullsignal.s_length)
 #define DC_SR(x) ((x)->dc_nullsignal.s_sr)
@@ -663,14 +1292,14 @@ t_signal *signal_newfromcontext(int borrowed, int nchans)
     return s;
 }
 
-void ugen_stop(void)
+static void ugen_freefragment(t_dspfragment *f)
 {
 #if 0   /* test to make sure we aren't leaving signal garbage */
     {
         t_signal *sig;
         int done = 0, count = 0;
             /* report any signals still in use */
-        for (sig = THIS->u_signals; sig; sig = sig->s_nextused)
+        for (sig = f->f_signals; sig; sig = sig->s_nextused)
         {
             if (sig->s_refcount)
                 post("signal %lx refcount %d", sig, sig->s_refcount), done = 1;
@@ -680,25 +1309,180 @@ void ugen_stop(void)
             post("all %d signals freed correctly", count);
     }
 #endif
-    if (THIS->u_dspchain)
+    freebytes(f->f_chain, f->f_chainsize * sizeof (t_int));
+    dspregion_freelist(&f->f_regions);
+    if (f->f_profile)
+        dspprofile_free(f->f_profile);
+    signal_cleanup(&f->f_signals, &f->f_arena);
+    freebytes(f, sizeof(*f));
+}
+
+void ugen_stop(void)
+{
+    t_dspfragment *f;
+    while ((f = THIS->u_fragments))
     {
-        freebytes(THIS->u_dspchain,
-            THIS->u_dspchainsize * sizeof (t_int));
-        THIS->u_dspchain = 0;
+        THIS->u_fragments = f->f_next;
+        ugen_freefragment(f);
     }
-    signal_cleanup();
-
+    THIS->u_lastfragment = &THIS->u_fragments;
 }
 
+    /* start a new DSP chain from scratch; call ugen_startfragment() and
+    ugen_endfragment() around canvas_dodsp() for each toplevel. */
 void ugen_start(void)
 {
     ugen_stop();
     THIS->u_sortno++;
     /*  THIS->u_loud = 1;  -- enable this for volumes of debugging output */
-    THIS->u_dspchain = (t_int *)getbytes(sizeof(*THIS->u_dspchain));
+    if (THIS->u_context) bug("ugen_start");
+}
+
+    /* rebuild the DSP chain keeping what we can.  For each toplevel, in
+    order, either ugen_keepfragment() or rebuild it as above; then call
+    ugen_finishupdate() to free what was left over. */
+void ugen_startupdate(void)
+{
+    THIS->u_sortno++;
+    THIS->u_oldfragments = THIS->u_fragments;
+    THIS->u_fragments = 0;
+    THIS->u_lastfragment = &THIS->u_fragments;
+    if (THIS->u_context) bug("ugen_startupdate");
+}
+
+static int ugen_parallelsafe(t_object *obj, int iook);
+
+    /* keep the existing chain for a toplevel unless it was edited or
+    might refer to objects in other toplevels (send~/receive~, delay lines,
+    arrays, ...) which may have changed.  Return 0 if it must be rebuilt. */
+int ugen_keepfragment(t_canvas *x)
+{
+    t_dspfragment **fp, *f;
+    for (fp = &THIS->u_oldfragments; (f = *fp); fp = &f->f_next)
+        if (f->f_canvas == x)
+    {
+        if (f->f_dirty || f->f_linked)
+            return (0);
+        *fp = f->f_next;
+        f->f_next = 0;
+        *THIS->u_lastfragment = f;
+        THIS->u_lastfragment = &f->f_next;
+        return (1);
+    }
+    return (0);
+}
+
+void ugen_finishupdate(void)
+{
+    t_dspfragment *f;
+    while ((f = THIS->u_oldfragments))
+    {
+        THIS->u_oldfragments = f->f_next;
+        ugen_freefragment(f);
+    }
+}
+
+    /* start building the chain for a toplevel.  Signals aren't shared
+    between toplevels so that each can be freed with its own chain. */
+void ugen_startfragment(t_canvas *x)
+{
+    t_dspfragment *f = (t_dspfragment *)getbytes(sizeof(*f)), *old;
+    int alloc = DSPCHAINMIN;
+        /* if we're recompiling, the old chain's size is a good guess */
+    for (old = THIS->u_oldfragments; old; old = old->f_next)
+        if (old->f_canvas == x && old->f_chainsize > alloc)
+            alloc = old->f_chainsize;
+    f->f_canvas = x;
+    THIS->u_building = f;
+    THIS->u_dspchain = (t_int *)getbytes(alloc * sizeof(*THIS->u_dspchain));
+    THIS->u_dspchainalloc = alloc;
     THIS->u_dspchain[0] = (t_int)dsp_done;
     THIS->u_dspchainsize = 1;
-    if (THIS->u_context) bug("ugen_start");
+    THIS->u_lastonset = -1;
+    THIS->u_signals = 0;
+    THIS->u_arena = 0;
+    THIS->u_regions = 0;
+    memset(THIS->u_freelist, 0, sizeof(THIS->u_freelist));
+    THIS->u_freeborrowed = 0;
+    THIS->u_profile = (THIS->u_profiling ? dspprofile_new(x) : 0);
+}
+
+void ugen_endfragment(void)
+{
+    t_dspfragment *f = THIS->u_building;
+        /* trim the chain, leaving it in one block of exactly its size */
+    f->f_chain = t_resizebytes(THIS->u_dspchain,
+        THIS->u_dspchainalloc * sizeof (t_int),
+            THIS->u_dspchainsize * sizeof (t_int));
+    f->f_chainsize = THIS->u_dspchainsize;
+    f->f_signals = THIS->u_signals;
+    f->f_arena = THIS->u_arena;
+    f->f_regions = THIS->u_regions;
+    if ((f->f_profile = THIS->u_profile))
+        dspprofile_finish(f->f_profile, f->f_chainsize);
+    THIS->u_profile = 0;
+    f->f_linked = !ugen_parallelsafe(&f->f_canvas->gl_obj, 1);
+    *THIS->u_lastfragment = f;
+    THIS->u_lastfragment = &f->f_next;
+    THIS->u_building = 0;
+    THIS->u_dspchain = 0;
+    THIS->u_dspchainsize = THIS->u_dspchainalloc = 0;
+    THIS->u_lastonset = -1;
+    THIS->u_signals = 0;
+    THIS->u_arena = 0;
+    THIS->u_regions = 0;
+    memset(THIS->u_freelist, 0, sizeof(THIS->u_freelist));
+    THIS->u_freeborrowed = 0;
+}
+
+    /* note that a toplevel has been edited */
+void ugen_dirtycanvas(t_canvas *x)
+{
+    t_dspfragment *f;
+    for (f = THIS->u_fragments; f; f = f->f_next)
+        if (f->f_canvas == x)
+            f->f_dirty = 1;
+}
+
+    /* a toplevel is going away; drop its chain */
+void ugen_forgetcanvas(t_canvas *x)
+{
+    t_dspfragment **fp, *f;
+    ugen_dropscene(x);
+    for (fp = &THIS->u_fragments; (f = *fp); )
+    {
+        if (f->f_canvas == x)
+        {
+            *fp = f->f_next;
+            ugen_freefragment(f);
+        }
+        else fp = &f->f_next;
+    }
+    for (fp = &THIS->u_fragments; *fp; fp = &(*fp)->f_next)
+        ;
+    THIS->u_lastfragment = fp;
+}
+
+    /* turn profiling on or off (see d_profile.c).  Every chain is rebuilt,
+    with or without the bookkeeping needed to charge time to boxes. */
+void ugen_setprofiling(int onoff)
+{
+    THIS->u_profiling = onoff;
+    canvas_update_dsp();
+}
+
+int ugen_getprofiling(void)
+{
+    return (THIS->u_profiling);
+}
+
+void ugen_foreachprofile(void (*fn)(struct _dspprofile *p, void *arg),
+    void *arg)
+{
+    t_dspfragment *f;
+    for (f = THIS->u_fragments; f; f = f->f_next)
+        if (f->f_profile)
+            (*fn)(f->f_profile, arg);
 }
 
 int ugen_getsortno(void)
@@ -746,17 +1530,64 @@ t_dspcontext *ugen_start_graph(int toplevel, t_signal **sp,
         ninlets = noutlets = 0;
 
     dc->dc_ugenlist = 0;
+    dc->dc_canvas = 0;
+    dc->dc_hash = 0;
+    dc->dc_hashsize = dc->dc_nugen = 0;
     dc->dc_toplevel = toplevel;
     dc->dc_iosigs = sp;
     dc->dc_ninlets = ninlets;
     dc->dc_noutlets = noutlets;
     dc->dc_warnedmulti = 0;
+    dc->dc_plan = 0;
     dc->dc_parentcontext = THIS->u_context;
     THIS->u_context = dc;
     return (dc);
 }
 
     /* first the canvas calls this to create all the boxes... */
+    /* ugen_connect() has to find the ugenbox for an object; a linear search
+    makes sorting large patches quadratic, so we keep a hash table. */
+#define UGEN_HASH(obj, size) \
+    ((int)(((size_t)(obj) >> 4) * 2654435761u) & ((size) - 1))
+
+static void ugen_hashin(t_ugenbox **hash, int size, t_ugenbox *x)
+{
+    int i = UGEN_HASH(x->u_obj, size);
+    while (hash[i])
+        i = (i + 1) & (size - 1);
+    hash[i] = x;
+}
+
+static t_ugenbox *ugen_hashfind(t_ugenbox **hash, int size, t_object *obj)
+{
+    int i;
+    if (!size)
+        return (0);
+    for (i = UGEN_HASH(obj, size); hash[i]; i = (i + 1) & (size - 1))
+        if (hash[i]->u_obj == obj)
+            return (hash[i]);
+    return (0);
+}
+
+static t_ugenbox *ugen_find(t_dspcontext *dc, t_object *obj)
+{
+    return (ugen_hashfind(dc->dc_hash, dc->dc_hashsize, obj));
+}
+
+    /* note which canvas a context is for; used to label profiles */
+void ugen_setcanvas(t_dspcontext *dc, t_canvas *x)
+{
+    dc->dc_canvas = x;
+}
+
+    /* when profiling, note that what follows on the chain is obj's */
+static void ugen_profilemark(t_dspcontext *dc, t_object *obj)
+{
+    if (THIS->u_profile)
+        dspprofile_mark(THIS->u_profile, THIS->u_dspchainsize - 1, obj,
+            dc->dc_canvas);
+}
+
 void ugen_add(t_dspcontext *dc, t_object *obj)
 {
     t_ugenbox *x = (t_ugenbox *)getbytes(sizeof *x);
@@ -775,6 +1606,20 @@ void ugen_add(t_dspcontext *dc, t_object *obj)
     x->u_out = getbytes(x->u_nout * sizeof (*x->u_out));
     for (uout = x->u_out, i = x->u_nout; i--; uout++)
         uout->o_connections = 0, uout->o_nconnect = 0;
+
+        /* keep the hash table at most half full */
+    if (2 * ++dc->dc_nugen > dc->dc_hashsize)
+    {
+        int newsize = (dc->dc_hashsize ? 2 * dc->dc_hashsize : 64);
+        t_ugenbox **newhash = (t_ugenbox **)getbytes(newsize *
+            sizeof(*newhash)), *u;
+        for (u = dc->dc_ugenlist; u; u = u->u_next)
+            ugen_hashin(newhash, newsize, u);
+        freebytes(dc->dc_hash, dc->dc_hashsize * sizeof(*dc->dc_hash));
+        dc->dc_hash = newhash;
+        dc->dc_hashsize = newsize;
+    }
+    else ugen_hashin(dc->dc_hash, dc->dc_hashsize, x);
 }
 
     /* and then this to make all the connections. */
@@ -791,8 +1636,8 @@ void ugen_connect(t_dspcontext *dc, t_object *x1, int outno, t_object *x2,
         post("%s -> %s: %d->%d",
             class_getname(x1->ob_pd),
                 class_getname(x2->ob_pd), outno, inno);
-    for (u1 = dc->dc_ugenlist; u1 && u1->u_obj != x1; u1 = u1->u_next);
-    for (u2 = dc->dc_ugenlist; u2 && u2->u_obj != x2; u2 = u2->u_next);
+    u1 = ugen_find(dc, x1);
+    u2 = ugen_find(dc, x2);
     if (!u1 || !u2 || siginno < 0 || !u2->u_nin)
     {
         if (!u1)
@@ -834,11 +1679,428 @@ static int ugen_index(t_dspcontext *dc, t_ugenbox *x)
         if (u == x) return (ret);
     return (-1);
 }
+
+/* ------------------------- saved graphs ----------------------------- */
+
+    /* Before a canvas can be sorted we have to find its tilde objects and
+    their connections, walking every box and line on it, looking up both
+    ends of every connection, and allocating a ugenbox for each object and
+    a record for each connection, all of which is thrown away afterward.
+    The copies of an abstraction (and above all the instances of a clone)
+    have identical graphs, as does any canvas each time DSP is restarted,
+    so we keep each graph as a "plan" which we can hand to the next canvas
+    with the same name, directory and number of boxes.  Since copies can
+    still differ (edited or dynamically patched ones) the plan is checked
+    box by box and line by line before it's used; this only compares
+    pointers and needs no memory.  If the check fails a new plan replaces
+    the old one. */
+
+typedef struct _planconnect
+{
+    int c_from;             /* index of source ugen */
+    int c_outno;            /* outlet number, counting all outlets */
+    int c_to;               /* index of sink ugen */
+    int c_inno;             /* inlet number, counting all inlets */
+} t_planconnect;
+
+typedef struct _ugenplan
+{
+    t_symbol *p_name;           /* canvas name, directory, and number */
+    t_symbol *p_dir;            /* of boxes, which we look plans up by */
+    int p_ngobj;
+    t_class **p_classes;        /* class of each box, in canvas order */
+    int *p_where;               /* index in that list of each ugen */
+    int p_nugen;
+    t_ugenbox *p_ugens;         /* the ugens, linked in ugen_add() order */
+    t_siginlet *p_in;           /* all their signal inlets */
+    int p_nin;
+    t_sigoutlet *p_out;         /* ... and signal outlets */
+    int p_nout;
+    t_planconnect *p_connect;   /* the connections in linetraverser order */
+    t_sigoutconnect *p_oc;      /* ... and as ugen_connect() would make them */
+    int p_nconnect;
+    int p_busy;                 /* in use by a canvas being sorted */
+    struct _ugenplan *p_next;   /* next in hash bucket */
+} t_ugenplan;
+
+#define UGENPLAN_BUCKET(name, n) \
+    ((int)(((size_t)(name) >> 4) + (n)) & (UGENPLAN_HASHSIZE - 1))
+
+static void ugen_planfree(t_ugenplan *p)
+{
+    freebytes(p->p_classes, p->p_ngobj * sizeof(*p->p_classes));
+    freebytes(p->p_where, p->p_nugen * sizeof(*p->p_where));
+    freebytes(p->p_ugens, p->p_nugen * sizeof(*p->p_ugens));
+    freebytes(p->p_in, p->p_nin * sizeof(*p->p_in));
+    freebytes(p->p_out, p->p_nout * sizeof(*p->p_out));
+    freebytes(p->p_connect, p->p_nconnect * sizeof(*p->p_connect));
+    freebytes(p->p_oc, p->p_nconnect * sizeof(*p->p_oc));
+    freebytes(p, sizeof(*p));
+    THIS->u_nplans--;
+}
+
+    /* forget all plans that aren't in use */
+static void ugen_freeplans(void)
+{
+    int i;
+    t_ugenplan **pp, *p;
+    for (i = 0; i < UGENPLAN_HASHSIZE; i++)
+        for (pp = &THIS->u_plans[i]; (p = *pp); )
+    {
+        if (p->p_busy)
+            pp = &p->p_next;
+        else
+        {
+            *pp = p->p_next;
+            ugen_planfree(p);
+        }
+    }
+}
+
+    /* make a plan from the canvas's contents.  Return 0 if there's anything
+    ugen_connect() would complain about; such canvases are always done the
+    slow way so that the errors get reported. */
+static t_ugenplan *ugen_planmake(t_canvas *x, t_symbol *dir, int ngobj)
+{
+    t_symbol *dspsym = gensym("dsp");
+    t_ugenplan *p = (t_ugenplan *)getbytes(sizeof(*p));
+    t_ugenbox **hash, *u, *u2;
+    t_siginlet *uin;
+    t_sigoutlet *uout;
+    t_sigoutconnect *oc;
+    t_outconnect *conn;
+    t_outlet *outlet;
+    t_inlet *inlet;
+    t_object *ob, *sink;
+    t_gobj *y;
+    int i, k, nout, outno, inno, siginno, hashsize, alloc = 0, ok = 1;
+
+    THIS->u_nplans++;
+    p->p_name = x->gl_name;
+    p->p_dir = dir;
+    p->p_ngobj = ngobj;
+    p->p_classes = (t_class **)getbytes(ngobj * sizeof(*p->p_classes));
+    p->p_where = (int *)getbytes(ngobj * sizeof(*p->p_where));
+    for (y = x->gl_list, i = 0; y; y = y->g_next, i++)
+    {
+        p->p_classes[i] = pd_class(&y->g_pd);
+        if (!(ob = pd_checkobject(&y->g_pd)))
+            continue;
+        if (zgetfn(&y->g_pd, dspsym))
+        {
+            p->p_where[p->p_nugen++] = i;
+            p->p_nin += obj_nsiginlets(ob);
+            p->p_nout += obj_nsigoutlets(ob);
+        }
+        else if (obj_nsigoutlets(ob))
+            ok = 0;
+    }
+    p->p_where = (int *)resizebytes(p->p_where,
+        ngobj * sizeof(*p->p_where), p->p_nugen * sizeof(*p->p_where));
+    p->p_ugens = (t_ugenbox *)getbytes(p->p_nugen * sizeof(*p->p_ugens));
+    p->p_in = (t_siginlet *)getbytes(p->p_nin * sizeof(*p->p_in));
+    p->p_out = (t_sigoutlet *)getbytes(p->p_nout * sizeof(*p->p_out));
+    if (!ok)
+        goto fail;
+
+        /* fill in the ugens, linked backward as ugen_add() would, and
+        hash them so we can find the sink of each connection */
+    for (hashsize = 64; hashsize < 2 * p->p_nugen; hashsize *= 2)
+        ;
+    hash = (t_ugenbox **)getbytes(hashsize * sizeof(*hash));
+    uin = p->p_in, uout = p->p_out;
+    for (y = x->gl_list, i = k = 0; k < p->p_nugen; y = y->g_next, i++)
+        if (i == p->p_where[k])
+    {
+        u = p->p_ugens + k;
+        u->u_obj = pd_checkobject(&y->g_pd);
+        u->u_in = uin;
+        uin += (u->u_nin = obj_nsiginlets(u->u_obj));
+        u->u_out = uout;
+        uout += (u->u_nout = obj_nsigoutlets(u->u_obj));
+        u->u_next = (k ? u - 1 : 0);
+        ugen_hashin(hash, hashsize, u);
+        k++;
+    }
+
+        /* list the connections in the order the linetraverser sees them */
+    for (k = 0, u = p->p_ugens; k < p->p_nugen && ok; k++, u++)
+    {
+        nout = obj_noutlets(u->u_obj);
+        for (outno = 0; outno < nout && ok; outno++)
+        {
+            if (!obj_issignaloutlet(u->u_obj, outno))
+                continue;
+            for (conn = obj_starttraverseoutlet(u->u_obj, &outlet, outno);
+                conn; )
+            {
+                t_planconnect *c;
+                conn = obj_nexttraverseoutlet(conn, &sink, &inlet, &inno);
+                if (!(u2 = ugen_hashfind(hash, hashsize, sink)) ||
+                    (siginno = obj_siginletindex(sink, inno)) < 0 ||
+                        siginno >= u2->u_nin)
+                {
+                    ok = 0;
+                    break;
+                }
+                if (p->p_nconnect == alloc)
+                {
+                    int newalloc = (alloc ? 2 * alloc : 16);
+                    p->p_connect = (t_planconnect *)resizebytes(
+                        p->p_connect, alloc * sizeof(*p->p_connect),
+                            newalloc * sizeof(*p->p_connect));
+                    alloc = newalloc;
+                }
+                c = p->p_connect + p->p_nconnect++;
+                c->c_from = k;
+                c->c_outno = outno;
+                c->c_to = (int)(u2 - p->p_ugens);
+                c->c_inno = inno;
+            }
+        }
+    }
+    freebytes(hash, hashsize * sizeof(*hash));
+    p->p_connect = (t_planconnect *)resizebytes(p->p_connect,
+        alloc * sizeof(*p->p_connect), p->p_nconnect * sizeof(*p->p_connect));
+    p->p_oc = (t_sigoutconnect *)getbytes(p->p_nconnect * sizeof(*p->p_oc));
+    if (!ok)
+        goto fail;
+
+        /* and connect them as ugen_connect() would */
+    for (k = 0, oc = p->p_oc; k < p->p_nconnect; k++, oc++)
+    {
+        t_planconnect *c = p->p_connect + k;
+        u = p->p_ugens + c->c_from;
+        u2 = p->p_ugens + c->c_to;
+        uout = u->u_out + obj_sigoutletindex(u->u_obj, c->c_outno);
+        oc->oc_who = u2;
+        oc->oc_inno = obj_siginletindex(u2->u_obj, c->c_inno);
+        oc->oc_next = uout->o_connections;
+        uout->o_connections = oc;
+        uout->o_nconnect++;
+        u2->u_in[oc->oc_inno].i_nconnect++;
+    }
+    return (p);
+fail:
+    ugen_planfree(p);
+    return (0);
+}
+
+    /* check that a canvas has exactly the graph in a plan, filling in the
+    plan's objects as we go */
+static int ugen_plancheck(t_ugenplan *p, t_canvas *x)
+{
+    t_ugenbox *u = p->p_ugens, *endu = p->p_ugens + p->p_nugen;
+    t_planconnect *c = p->p_connect, *endc = p->p_connect + p->p_nconnect;
+    t_outconnect *conn;
+    t_outlet *outlet;
+    t_inlet *inlet;
+    t_object *sink;
+    t_gobj *y;
+    int i, nout, outno, inno;
+
+    for (y = x->gl_list, i = 0; y; y = y->g_next, i++)
+    {
+        if (i == p->p_ngobj || pd_class(&y->g_pd) != p->p_classes[i])
+            return (0);
+        if (u < endu && p->p_where[u - p->p_ugens] == i)
+        {
+            u->u_obj = pd_checkobject(&y->g_pd);
+            if (obj_nsiginlets(u->u_obj) != u->u_nin ||
+                obj_nsigoutlets(u->u_obj) != u->u_nout)
+                    return (0);
+            u++;
+        }
+    }
+    if (i != p->p_ngobj)
+        return (0);
+    for (u = p->p_ugens; u < endu; u++)
+    {
+        nout = obj_noutlets(u->u_obj);
+        for (outno = 0; outno < nout; outno++)
+        {
+            if (!obj_issignaloutlet(u->u_obj, outno))
+                continue;
+            for (conn = obj_starttraverseoutlet(u->u_obj, &outlet, outno);
+                conn; c++)
+            {
+                conn = obj_nexttraverseoutlet(conn, &sink, &inlet, &inno);
+                if (c == endc || c->c_from != u - p->p_ugens ||
+                    c->c_outno != outno || c->c_inno != inno ||
+                        p->p_ugens[c->c_to].u_obj != sink ||
+                            obj_siginletindex(sink, inno) !=
+                                p->p_oc[c - p->p_connect].oc_inno)
+                    return (0);
+            }
+        }
+    }
+    return (c == endc);
+}
+
+    /* add all of a canvas's tilde objects and their connections to the
+    graph, using a plan if we can.  Return 0 if the canvas has to be
+    added by calling ugen_add() and ugen_connect() instead. */
+int ugen_addcanvas(t_dspcontext *dc, t_canvas *x)
+{
+    t_symbol *dir = canvas_getdir(x);
+    t_ugenplan **bucket, **pp, *p;
+    t_gobj *y;
+    int ngobj = 0;
+
+    if (dc->dc_ugenlist)
+        return (0);
+    for (y = x->gl_list; y; y = y->g_next)
+        ngobj++;
+    bucket = &THIS->u_plans[UGENPLAN_BUCKET(x->gl_name, ngobj)];
+    for (pp = bucket; (p = *pp); pp = &p->p_next)
+        if (p->p_name == x->gl_name && p->p_dir == dir &&
+            p->p_ngobj == ngobj)
+                break;
+    if (p && p->p_busy)     /* a subpatch in a subpatch of the same name */
+        return (0);
+    if (!p || !ugen_plancheck(p, x))
+    {
+        if (p)
+        {
+            *pp = p->p_next;
+            ugen_planfree(p);
+        }
+        if (THIS->u_nplans >= UGENPLAN_MAX)
+            ugen_freeplans();
+        if (!(p = ugen_planmake(x, dir, ngobj)))
+            return (0);
+        p->p_next = *bucket;
+        *bucket = p;
+    }
+    p->p_busy = 1;
+    dc->dc_plan = p;
+    dc->dc_ugenlist = (p->p_nugen ? p->p_ugens + p->p_nugen - 1 : 0);
+    dc->dc_nugen = p->p_nugen;
+    return (1);
+}
 extern t_class *clone_class;
 
 static const t_sample ugen_scalarzero;  /* zero for scalar-to-vector copying */
 
 extern int class_getdspflags(const t_class *c);
+int clone_get_n(t_gobj *x);
+t_glist *clone_get_nth(t_gobj *x, int n);
+
+extern t_class *dac_class, *adc_class;
+
+    /* check whether a box's DSP code touches nothing but its own signals,
+    so that it can run alongside others.  A subpatch or clone is safe if
+    everything inside it is.  If "iook" is set, also accept dac~ and adc~;
+    they don't refer to other objects, so a toplevel with nothing else
+    needn't be recompiled when others are edited. */
+static int ugen_parallelsafe(t_object *obj, int iook)
+{
+    t_class *c = pd_class(&obj->ob_pd);
+    t_gobj *g;
+    int i, n;
+    if (c == canvas_class)
+    {
+        for (g = ((t_glist *)obj)->gl_list; g; g = g->g_next)
+        {
+            t_object *ob = pd_checkobject(&g->g_pd);
+            if (ob && zgetfn(&g->g_pd, gensym("dsp")) &&
+                !ugen_parallelsafe(ob, iook))
+                    return (0);
+        }
+        return (1);
+    }
+    else if (c == clone_class)
+    {
+        for (i = 0, n = clone_get_n(&obj->te_g); i < n; i++)
+            if (!ugen_parallelsafe(&clone_get_nth(&obj->te_g, i)->gl_obj,
+                iook))
+                return (0);
+        return (1);
+    }
+    else if (iook && (c == dac_class || c == adc_class))
+        return (1);
+    else return ((class_getdspflags(c) & CLASS_PARALLELSAFE) != 0);
+}
+
+    /* while building a parallel region, start a new segment at the current
+    end of the chain.  Routines in different segments may not be fused
+    since the segments run separately. */
+static void ugen_regionmark(int unsafe)
+{
+    THIS->u_lastonset = -1;
+    dspregion_mark(THIS->u_region,
+        THIS->u_dspchainsize - 1 - THIS->u_regiononset, unsafe);
+}
+
+static void ugen_regiontouch(t_signal *sig, int write)
+{
+    if (sig->s_vec && !sig->s_isscalar)
+        dspregion_touch(THIS->u_region, sig->s_vec, (sig->s_nalloc ?
+            sig->s_nalloc : sig->s_length * sig->s_nchans) *
+                sizeof(*sig->s_vec), write);
+}
+
+    /* Each toplevel box in a parallel region gets private free lists so
+    that buffers it frees aren't picked up by its neighbours, which would
+    make them wait for it.  When it's done we hand them back. */
+static void ugen_regionrestore(t_signal **saved)
+{
+    int i;
+    for (i = 0; i <= MAXLOGSIG; i++)
+    {
+        t_signal *sig = THIS->u_freelist[i];
+        if (sig)
+        {
+            while (sig->s_nextfree)
+                sig = sig->s_nextfree;
+            sig->s_nextfree = saved[i];
+        }
+        else THIS->u_freelist[i] = saved[i];
+    }
+}
+
+    /* A clone directly in a toplevel that's being compiled into a parallel
+    region may put each of its instances in a segment of its own, so that
+    they can run alongside each other (see g_clone.c).  Each instance gets
+    private free lists, as toplevel boxes do, and reads but doesn't write
+    the clone's inputs.  When they're all done, ugen_forkjoin() starts a
+    segment for combining their outputs; call it with each instance's
+    outputs in turn. */
+int ugen_canfork(void)
+{
+    return (THIS->u_region && THIS->u_context == THIS->u_regioncontext);
+}
+
+    /* start a segment for a clone instance "obj" reading signals "in" */
+void ugen_forkbranch(t_object *obj, t_signal **in, int nin)
+{
+    int i;
+    ugen_regionmark(!ugen_parallelsafe(obj, 0));
+    for (i = 0; i <= MAXLOGSIG; i++)
+    {
+        t_signal *sig = THIS->u_freelist[i];
+        if (sig)
+        {
+            while (sig->s_nextfree)
+                sig = sig->s_nextfree;
+            sig->s_nextfree = THIS->u_forkfree[i];
+            THIS->u_forkfree[i] = THIS->u_freelist[i];
+            THIS->u_freelist[i] = 0;
+        }
+    }
+    for (i = 0; i < nin; i++)
+        ugen_regiontouch(in[i], 0);
+}
+
+void ugen_forkjoin(t_signal **out, int nout)
+{
+    int i;
+    ugen_regionmark(0);
+    ugen_regionrestore(THIS->u_forkfree);
+    memset(THIS->u_forkfree, 0, sizeof(THIS->u_forkfree));
+    for (i = 0; i < nout; i++)
+        ugen_regiontouch(out[i], 0);
+}
 
     /* put a ugenbox on the chain, recursively putting any others on that
     this one might uncover. */
@@ -861,6 +2123,10 @@ static void ugen_doit(t_dspcontext *dc, t_ugenbox *u)
         ((class == voutlet_class) &&  !(dc->dc_reblock || dc->dc_switched)));
     t_signal **insig, **outsig, **sig, *s1, *s2, *s3;
     t_ugenbox *u2;
+    int inregion = (THIS->u_region && dc == THIS->u_regioncontext);
+    t_signal *savedfree[MAXLOGSIG+1];
+    t_signal **savedstretchin = THIS->u_stretchin, *summed[2];
+    int savednstretchin = THIS->u_nstretchin;
 
         /* if CLASS_MULTICHANNEL isn't set, check that all input signals
         are one-channel, and if not, just return without doing anything. */
@@ -877,6 +2143,14 @@ static void ugen_doit(t_dspcontext *dc, t_ugenbox *u)
 
     if (THIS->u_loud) post("doit %s %d %d", class_getname(class), nofreesigs,
         nonewsigs);
+    ugen_profilemark(dc, u->u_obj);
+
+    if (inregion)
+    {
+        ugen_regionmark(!ugen_parallelsafe(u->u_obj, 0));
+        memcpy(savedfree, THIS->u_freelist, sizeof(savedfree));
+        memset(THIS->u_freelist, 0, sizeof(savedfree));
+    }
 
         /* Fill in unconnected inlets.  Normally we create a signal for it and
         add a scalar-to-vector copy to the DSP chain to fill it in from the
@@ -912,6 +2186,8 @@ static void ugen_doit(t_dspcontext *dc, t_ugenbox *u)
     for (sig = insig, uin = u->u_in, i = u->u_nin; i--; sig++, uin++)
     {
         *sig = uin->i_signal;
+        if (inregion)
+            ugen_regiontouch(*sig, 0);
         if (1)
         {
                 /* if scalar or borrowed, put on free-after-dsp-call list -
@@ -940,7 +2216,12 @@ static void ugen_doit(t_dspcontext *dc, t_ugenbox *u)
         where the output data actually is, to avoid having to copy it.
         Otherwise, in case the CLASS_MULTICHANNEL flag is set for the object,
         we pass "null" signal and expect the DSP routine to replace it..
-        In any other case, we just allocate a new output vector. */
+        In any other case, we just allocate a new output vector.
+        Outputs may go in larger free vectors than they need, but not
+        in a subcanvas (whose contents we'd also be sorting) and not in
+        one this box's inputs just gave up. */
+    if (!nofreesigs)
+        THIS->u_stretchin = insig, THIS->u_nstretchin = u->u_nin;
     for (sig = outsig, uout = u->u_out, i = u->u_nout; i--; sig++, uout++)
     {
         if (nonewsigs)
@@ -955,11 +2236,15 @@ static void ugen_doit(t_dspcontext *dc, t_ugenbox *u)
         routine must fill in "borrowed" signal outputs in case it's either
         a subcanvas or a signal inlet. */
     mess1(&u->u_obj->ob_pd, gensym("dsp"), insig);
+    THIS->u_stretchin = savedstretchin;
+    THIS->u_nstretchin = savednstretchin;
 
     for (sig = outsig, uout = u->u_out, i = u->u_nout; i--; sig++, uout++)
     {
         uout->o_signal = *sig;
         (*sig)->s_refcount = uout->o_nconnect;
+        if (inregion)
+            ugen_regiontouch(*sig, 1);
 
             /* if any output signals aren't connected to anyone, free them
             now; otherwise they'll either get freed when the reference count
@@ -990,6 +2275,8 @@ static void ugen_doit(t_dspcontext *dc, t_ugenbox *u)
         signal_dereference(freelater);
         freelater = stmp;
     }
+    if (inregion)
+        ugen_regionrestore(savedfree);
         /* pass it on and add anyone whose last inlet was filled */
     for (uout = u->u_out, i = u->u_nout; i--; uout++)
     {
@@ -1003,7 +2290,19 @@ static void ugen_doit(t_dspcontext *dc, t_ugenbox *u)
             {
                 s1->s_refcount--;
                 s2->s_refcount--;
+                if (inregion)
+                    ugen_regionmark(0);
+                ugen_profilemark(dc, u2->u_obj);
+                summed[0] = s1, summed[1] = s2;
+                THIS->u_stretchin = summed, THIS->u_nstretchin = 2;
                 s3 = signal_newlike(s1);
+                THIS->u_stretchin = savedstretchin;
+                THIS->u_nstretchin = savednstretchin;
+                if (inregion)
+                {
+                    ugen_regiontouch(s1, 0);
+                    ugen_regiontouch(s2, 0);
+                }
                 if (s1->s_nchans != s2->s_nchans ||
                     s1->s_length != s2->s_length)
                 {
@@ -1196,6 +2495,7 @@ void ugen_done_graph(t_dspcontext *dc)
         if any.  Outlets will also need pointers, unless we're switched, in
         which case outlet epilog code will kick in. */
 
+    ugen_profilemark(dc, (blk ? &blk->x_obj : 0));
     for (u = dc->dc_ugenlist; u; u = u->u_next)
     {
         t_pd *zz = &u->u_obj->ob_pd;
@@ -1216,7 +2516,20 @@ void ugen_done_graph(t_dspcontext *dc)
     if (blk && (reblock || switched))   /* add the block DSP prolog */
     {
         dsp_add(block_prolog, 1, blk);
+        blk->x_fragment = THIS->u_building;
         blk->x_chainonset = THIS->u_dspchainsize - 1;
+    }
+        /* if DSP threads are on, frame a toplevel canvas's code in a region
+        so that independent boxes can run in parallel.  (Not if there's a
+        block~ here, whose prolog might jump over the region, nor while
+        profiling, which has to time the boxes one by one.) */
+    else if (!parent_context && !blk && !THIS->u_region &&
+        dspregion_nthreads() && !THIS->u_profiling)
+    {
+        THIS->u_region = dspregion_new(&THIS->u_regions);
+        THIS->u_regioncontext = dc;
+        dsp_add(dspregion_perform, 2, THIS->u_region, 0);
+        THIS->u_regiononset = THIS->u_dspchainsize - 1;
     }
         /* Initialize for sorting */
     for (u = dc->dc_ugenlist; u; u = u->u_next)
@@ -1269,7 +2582,18 @@ void ugen_done_graph(t_dspcontext *dc)
         }
         break;   /* don't need to keep looking. */
     }
+    if (THIS->u_region && THIS->u_regioncontext == dc)
+    {
+        int length = THIS->u_dspchainsize - 1 - THIS->u_regiononset;
+        dspregion_finish(THIS->u_region, length);
+            /* fill in the region's length, the second argument above */
+        THIS->u_dspchain[THIS->u_regiononset - 1] = length;
+        THIS->u_region = 0;
+        THIS->u_lastonset = -1;
+        THIS->u_regioncontext = 0;
+    }
 
+    ugen_profilemark(dc, (blk ? &blk->x_obj : 0));
     if (blk && (reblock || switched))    /* add block DSP epilog */
         dsp_add(block_epilog, 1, blk);
     chainblockend = THIS->u_dspchainsize;
@@ -1306,7 +2630,9 @@ void ugen_done_graph(t_dspcontext *dc)
                     post("chain %lx", *ip);
         post("... ugen_done_graph done.");
     }
-        /* now delete everything. */
+        /* now delete everything, unless it belongs to a plan. */
+    if (dc->dc_plan)
+        dc->dc_plan->p_busy = 0, dc->dc_ugenlist = 0;
     while (dc->dc_ugenlist)
     {
         for (uout = dc->dc_ugenlist->u_out, n = dc->dc_ugenlist->u_nout;
@@ -1331,6 +2657,7 @@ void ugen_done_graph(t_dspcontext *dc)
     if (THIS->u_context == dc)
         THIS->u_context = dc->dc_parentcontext;
     else bug("THIS->u_context");
+    freebytes(dc->dc_hash, dc->dc_hashsize * sizeof(*dc->dc_hash));
     freebytes(dc, sizeof(*dc));
 }
 
@@ -55,6 +55,7 @@ static void canvas_bind(t_canvas *x);
 static void canvas_unbind(t_canvas *x);
 void canvas_declare(t_canvas *x, t_symbol *s, int argc, t_atom *argv);
 void sys_expandpath(const char *from, char *to, int bufsize);
+void ugen_forgetcanvas(t_canvas *x);
 
 /* ---------------- generic widget behavior ------------------------- */
 
@@ -902,7 +903,7 @@ void canvas_free(t_canvas *x)
 {
     t_gobj *y;
     t_canvas_private*private = x->gl_privatedata;
-    int dspstate = canvas_suspend_dsp();
+    int dspstate = canvas_suspend_dsp_for(x);
     canvas_noundo(x);
     if (canvas_whichfind == x)
         canvas_whichfind = 0;
@@ -922,13 +923,16 @@ void canvas_free(t_canvas *x)
     }
     canvas_undo_free(x);
     freebytes(private, sizeof(*private));
-    canvas_resume_dsp(dspstate);
+    canvas_resume_dsp_for(dspstate);
     freebytes(x->gl_xlabel, x->gl_nxlabels * sizeof(*(x->gl_xlabel)));
     freebytes(x->gl_ylabel, x->gl_nylabels * sizeof(*(x->gl_ylabel)));
     gstub_cutoff(x->gl_stub);
     pdgui_stub_deleteforkey(x);        /* probably unnecessary */
     if (!x->gl_owner && !x->gl_isclone)
+    {
         canvas_takeofflist(x);
+        ugen_forgetcanvas(x);
+    }
 }
 
 /* ----------------- lines ---------- */
@@ -1326,12 +1330,22 @@ EXTERN_STRUCT _dspcontext;
 
 void ugen_start(void);
 void ugen_stop(void);
+void ugen_startupdate(void);
+int ugen_keepfragment(t_canvas *x);
+void ugen_finishupdate(void);
+void ugen_startfragment(t_canvas *x);
+void ugen_endfragment(void);
+void ugen_dirtycanvas(t_canvas *x);
+void ugen_holdcanvas(t_canvas *x);
+void ugen_fadecanvas(t_canvas *x, t_float msec, int out);
 
 t_dspcontext *ugen_start_graph(int toplevel, t_signal **sp,
     int ninlets, int noutlets);
+void ugen_setcanvas(t_dspcontext *dc, t_canvas *x);
 void ugen_add(t_dspcontext *dc, t_object *x);
 void ugen_connect(t_dspcontext *dc, t_object *x1, int outno,
     t_object *x2, int inno);
+int ugen_addcanvas(t_dspcontext *dc, t_canvas *x);
 void ugen_done_graph(t_dspcontext *dc);
 
     /* schedule one canvas for DSP.  This is called below for all "root"
@@ -1363,18 +1377,23 @@ void canvas_dodsp(t_canvas *x, int toplevel, t_signal **sp)
     dc = ugen_start_graph(toplevel, sp,
         obj_nsiginlets(&x->gl_obj),
         obj_nsigoutlets(&x->gl_obj));
+    ugen_setcanvas(dc, x);
 
-        /* find all the "dsp" boxes and add them to the graph */
-
-    for (y = x->gl_list; y; y = y->g_next)
-        if ((ob = pd_checkobject(&y->g_pd)) && zgetfn(&y->g_pd, dspsym))
-            ugen_add(dc, ob);
+        /* if the same graph was sorted before (in another copy of this
+        abstraction, say) reuse it; otherwise find all the "dsp" boxes and
+        add them to the graph */
+    if (!ugen_addcanvas(dc, x))
+    {
+        for (y = x->gl_list; y; y = y->g_next)
+            if ((ob = pd_checkobject(&y->g_pd)) && zgetfn(&y->g_pd, dspsym))
+                ugen_add(dc, ob);
 
-        /* ... and all dsp interconnections */
-    linetraverser_start(&t, x);
-    while ((oc = linetraverser_next(&t)))
-        if (obj_issignaloutlet(t.tr_ob, t.tr_outno))
-            ugen_connect(dc, t.tr_ob, t.tr_outno, t.tr_ob2, t.tr_inno);
+            /* ... and all dsp interconnections */
+        linetraverser_start(&t, x);
+        while ((oc = linetraverser_next(&t)))
+            if (obj_issignaloutlet(t.tr_ob, t.tr_outno))
+                ugen_connect(dc, t.tr_ob, t.tr_outno, t.tr_ob2, t.tr_inno);
+    }
 
         /* finally, sort them and add them to the DSP chain */
     ugen_done_graph(dc);
@@ -1387,6 +1406,14 @@ static void canvas_dsp(t_canvas *x, t_signal **sp)
 
 int canvas_dspstate;    /* for back compatibility with externs - don't use */
 
+    /* compile one root canvas into its own piece of the DSP chain */
+static void canvas_compiledsp(t_canvas *x)
+{
+    ugen_startfragment(x);
+    canvas_dodsp(x, 1, 0);
+    ugen_endfragment();
+}
+
     /* this routine starts DSP for all root canvases. */
 static void canvas_start_dsp(void)
 {
@@ -1396,7 +1423,7 @@ static void canvas_start_dsp(void)
     ugen_start();
 
     for (x = pd_getcanvaslist(); x; x = x->gl_next)
-        canvas_dodsp(x, 1, 0);
+        canvas_compiledsp(x);
 
     canvas_dspstate = THISGUI->i_dspstate = 1;
     if (gensym("pd-dsp-started")->s_thing)
@@ -1423,6 +1450,10 @@ static void canvas_stop_dsp(void)
 int canvas_suspend_dsp(void)
 {
     int rval = THISGUI->i_dspstate;
+        /* inside canvas_suspend_dsp_for() the edited toplevel gets
+        recompiled anyway when the outermost caller resumes. */
+    if (THISGUI->i_dsplocal)
+        return (0);
     if (rval) canvas_stop_dsp();
     return (rval);
 }
@@ -1435,13 +1466,75 @@ void canvas_resume_dsp(int oldstate)
     /* this is equivalent to suspending and resuming in one step. */
 void canvas_update_dsp(void)
 {
-    if (THISGUI->i_dspstate)
+    if (THISGUI->i_dsplocal)
+        THISGUI->i_dspfull = 1;
+    else if (THISGUI->i_dspstate)
     {
         canvas_stop_dsp();
         canvas_start_dsp();
     }
 }
 
+    /* the same, for a change that only affects the toplevel of the
+    object being changed, such as making or breaking a signal connection.
+    If that toplevel is already marked for recompiling we needn't do
+    anything. */
+void canvas_update_dsp_edit(void)
+{
+    if (!THISGUI->i_dsplocal)
+        canvas_update_dsp();
+}
+
+    /* recompile the toplevels that were edited, keeping the DSP chains
+    of all the others.  The new chain replaces the old one between two
+    DSP ticks, so the rest of the patch keeps playing without a gap. */
+static void canvas_refresh_dsp(void)
+{
+    t_canvas *x;
+    ugen_startupdate();
+    for (x = pd_getcanvaslist(); x; x = x->gl_next)
+        if (!ugen_keepfragment(x))
+            canvas_compiledsp(x);
+    ugen_finishupdate();
+    if (gensym("pd-dsp-started")->s_thing)
+        pd_bang(gensym("pd-dsp-started")->s_thing);
+}
+
+    /* suspend and resume DSP around an edit to the canvas x (or anything
+    inside it).  Unlike canvas_suspend_dsp(), DSP isn't stopped; only x's
+    toplevel is recompiled on resume.  Brackets may nest.  Anything that
+    calls canvas_update_dsp() in between (arrays, send~, sample rate...)
+    still gets the whole chain rebuilt. */
+int canvas_suspend_dsp_for(t_canvas *x)
+{
+    if (!THISGUI->i_dspstate)
+        return (0);
+    while (x->gl_owner)
+        x = x->gl_owner;
+    ugen_dirtycanvas(x);
+    THISGUI->i_dsplocal++;
+    return (1);
+}
+
+void canvas_resume_dsp_for(int oldstate)
+{
+    if (!oldstate || --THISGUI->i_dsplocal)
+        return;
+    if (!THISGUI->i_dspstate)
+        THISGUI->i_dspfull = 0;
+    else if (THISGUI->i_dspfull)
+    {
+        THISGUI->i_dspfull = 0;
+        canvas_update_dsp();
+    }
+    else canvas_refresh_dsp();
+}
+
+void canvas_update_dsp_for(t_canvas *x)
+{
+    canvas_resume_dsp_for(canvas_suspend_dsp_for(x));
+}
+
 /* the "dsp" message to pd starts and stops DSP computation, and, if
 appropriate, also opens and closes the audio device. On exclusive-access
 APIs such as ALSA, MMIO, and ASIO (I think) it's appropriate to close the
@@ -2164,6 +2257,7 @@ void g_canvas_newpdinstance(void)
     THISGUI->i_newargv = 0;
     THISGUI->i_reloadingabstraction = 0;
     THISGUI->i_dspstate = 0;
+    THISGUI->i_dsplocal = THISGUI->i_dspfull = 0;
     THISGUI->i_dollarzero = 1000;
     g_editor_newpdinstance();
     g_template_newpdinstance();
@@ -2229,3 +2323,58 @@ void glob_open(t_pd *ignore, t_symbol *name, t_symbol *dir, t_floatarg f)
     if (!glob_evalfile(ignore, name, dir))
         pdgui_vmess("::pdwindow::busyrelease", 0);
 }
+
+    /* "pd prepare <file> <dir>": open a patch without interrupting DSP.
+    Only the new patch's DSP chain is compiled, and it stays silent until
+    "pd commit" fades it in (see ugen_holdcanvas() in d_ugen.c). */
+void glob_prepare(t_pd *ignore, t_symbol *name, t_symbol *dir)
+{
+    t_pd *x;
+    int dspstate = THISGUI->i_dspstate;
+        /* as canvas_suspend_dsp_for() would, for a canvas yet to come */
+    if (dspstate)
+        THISGUI->i_dsplocal++;
+    if ((x = glob_evalfile(ignore, name, dir)) && pd_class(x) == canvas_class)
+        ugen_holdcanvas((t_canvas *)x);
+    else pdgui_vmess("::pdwindow::busyrelease", 0);
+    canvas_resume_dsp_for(dspstate);
+}
+
+static t_canvas *canvas_findtoplevel(t_symbol *s)
+{
+    t_canvas *x;
+    for (x = pd_getcanvaslist(); x; x = x->gl_next)
+        if (x->gl_name == s)
+            return (x);
+    return (0);
+}
+
+    /* "pd commit <patch> [fade-ms] [patch ...]": at the next tick, fade in
+    the first patch (typically opened with "pd prepare") while fading out
+    the others, which are closed when they're silent. */
+void glob_commit(t_pd *ignore, t_symbol *s, int argc, t_atom *argv)
+{
+    t_canvas *x, *y;
+    t_float msec = 0;
+    int i;
+    if (argc < 1 || argv[0].a_type != A_SYMBOL)
+    {
+        pd_error(0, "usage: commit <patch> [fade-ms] [patch to close ...]");
+        return;
+    }
+    if (!(x = canvas_findtoplevel(argv[0].a_w.w_symbol)))
+    {
+        pd_error(0, "commit: %s: no such patch", argv[0].a_w.w_symbol->s_name);
+        return;
+    }
+    if (argc > 1 && argv[1].a_type == A_FLOAT)
+        msec = argv[1].a_w.w_float, argc--, argv++;
+    ugen_fadecanvas(x, msec, 0);
+    for (i = 1; i < argc; i++)
+    {
+        t_symbol *name = atom_getsymbol(argv + i);
+        if (!(y = canvas_findtoplevel(name)) || y == x)
+            pd_error(0, "commit: %s: no such patch", name->s_name);
+        else ugen_fadecanvas(y, msec, 1);
+    }
+}
@@ -281,6 +281,8 @@ struct _instancecanvas
     t_atom *i_newargv;
     t_glist *i_reloadingabstraction;
     int i_dspstate;
+    int i_dsplocal;         /* nesting of canvas_suspend_dsp_for() */
+    int i_dspfull;          /* whole chain must be rebuilt on resume */
     int i_dollarzero;
     t_float i_graph_lastxpix, i_graph_lastypix;
 };
@@ -57,6 +57,7 @@ typedef struct _clone
     unsigned int x_suppressvoice:1; /* suppress voice number as $1 arg */
     unsigned int x_distributein:1;  /* distribute input signals across clones */
     unsigned int x_packout:1;       /* pack output signals */
+    unsigned int x_parallel:1;      /* let instances run in parallel */
 } t_clone;
 
 int clone_match(t_pd *z, t_symbol *name, t_symbol *dir)
@@ -162,6 +163,16 @@ static void clone_in_resize(t_in *x, t_floatarg f)
         canvas_loadbang(x->i_owner->x_vec[i].c_gl);
 }
 
+    /* turn parallel DSP for the instances on or off */
+static void clone_in_parallel(t_in *x, t_floatarg f)
+{
+    if (x->i_owner->x_parallel != (f != 0))
+    {
+        x->i_owner->x_parallel = (f != 0);
+        canvas_update_dsp();
+    }
+}
+
 static void clone_out_anything(t_outproxy *x, t_symbol *s, int argc, t_atom *argv)
 {
     t_atom *outv;
@@ -299,10 +310,120 @@ static void clone_loadbang(t_clone *x, t_floatarg f)
 void canvas_dodsp(t_canvas *x, int toplevel, t_signal **sp);
 t_signal *signal_newfromcontext(int borrowed, int nchans);
 void signal_makereusable(t_signal *sig);
+int ugen_canfork(void);
+void ugen_forkbranch(t_object *obj, t_signal **in, int nin);
+void ugen_forkjoin(t_signal **out, int nout);
+
+    /* put one instance's DSP code on the chain.  The first nin signals in
+    "tempio" are set to the inputs it should see, and the next nout are
+    made into borrowed signals that it fills in with its outputs.  If
+    "fork" is set, the instance gets a segment of its own in the parallel
+    region being built (see ugen_canfork() in d_ugen.c.) */
+static void clone_dspinstance(t_clone *x, int j, t_signal **sp, int nin,
+    int nout, t_signal **tempio, int fork)
+{
+    int i;
+    for (i = 0; i < nin; i++)
+    {
+        if (x->x_distributein)
+        {
+                /* distribute multi-channel signal over instances;
+                wrap around if channel count is lower than instance count */
+            int offset = j % sp[i]->s_nchans;
+            tempio[i] = signal_new(0, 1, sp[i]->s_sr, 0);
+            signal_setborrowed(tempio[i], sp[i]);
+            tempio[i]->s_nchans = 1;
+            tempio[i]->s_vec = sp[i]->s_vec + offset * sp[i]->s_length;
+            tempio[i]->s_refcount = 1;
+        }
+        else
+            tempio[i] = sp[i];
+    }
+    for (i = 0; i < nout; i++)
+        tempio[nin + i] = signal_newfromcontext(1, 1);
+    if (fork)
+        ugen_forkbranch(&x->x_vec[j].c_gl->gl_obj, tempio, nin);
+    canvas_dodsp(x->x_vec[j].c_gl, 0, tempio);
+    if (x->x_distributein)
+    {
+        for (i = 0; i < nin; i++)
+        {
+            if (!--tempio[i]->s_refcount)
+                signal_makereusable(tempio[i]);
+            else
+                bug("clone 1: %d", tempio[i]->s_refcount);
+        }
+    }
+}
+
+    /* copy or add one instance's outputs into the clone's */
+static void clone_dspoutput(t_clone *x, int j, t_signal **sp, int nin,
+    int nout, t_signal **tempout, int *noutchans)
+{
+    int i;
+    for (i = 0; i < nout; i++)
+    {
+        int nchans = tempout[i]->s_nchans;
+        int length = tempout[i]->s_length;
+        t_sample *to, *from = tempout[i]->s_vec;
+        if (x->x_packout)
+        {
+                /* pack individual mono outputs to a multichannel one */
+            if (j == 0) /* now we can the create the output signal */
+            {
+                signal_setmultiout(&sp[nin + i], nchans * x->x_n);
+                noutchans[i] = nchans;
+            }
+                /* NB: it is possible for instances to have different
+                output channel counts. In this case we always take the
+                channel count of the first instance. */
+            to = sp[nin + i]->s_vec + j * length * noutchans[i];
+            if (nchans == noutchans[i])
+                dsp_add_copy(from, to, length * nchans);
+            else
+            {
+                if (nchans > noutchans[i]) /* ignore extra channels */
+                    dsp_add_copy(from, to, noutchans[i] * length);
+                else /* fill missing channels with zeros */
+                {
+                    dsp_add_copy(from, to, nchans * length);
+                    dsp_add_zero(to + length * nchans,
+                        length * (noutchans[i] - nchans));
+                }
+            #if 1
+                pd_error(x, "warning: clone instance %d: channel count "
+                    "of outlet %d (%d) does not match first instance (%d)",
+                        j, i, nchans, noutchans[i]);
+            #endif
+            }
+        }
+        else if (j == 0)
+        {
+                /* first instance: create output signal and copy content */
+            signal_setmultiout(&sp[nin + i], nchans);
+            dsp_add_copy(from, sp[nin + i]->s_vec, length * nchans);
+            noutchans[i] = nchans;
+        }
+        else /* add to existing signal */
+        {
+            int nsamples = nchans > noutchans[i] ?
+                noutchans[i] * length : nchans * length;
+        #if 1
+            if (nchans != noutchans[i])
+                pd_error(x, "warning: clone instance %d: channel count "
+                    "of outlet %d (%d) does not match first instance (%d)",
+                        j, i, nchans, noutchans[i]);
+        #endif
+            dsp_add_plus(from, sp[nin + i]->s_vec,
+                sp[nin + i]->s_vec, nsamples);
+        }
+        signal_makereusable(tempout[i]);
+    }
+}
 
 static void clone_dsp(t_clone *x, t_signal **sp)
 {
-    int i, j, nin, nout, *noutchans;
+    int i, j, nin, nout, *noutchans, fork, ntempio;
     t_signal **tempio;
     if (!x->x_n)
         return;
@@ -330,142 +451,32 @@ static void clone_dsp(t_clone *x, t_signal **sp)
             return;
         }
     }
-    tempio = (nin + nout) > 0 ?
-        (t_signal **)alloca((nin + nout) * sizeof(*tempio)) : 0;
     noutchans = nout > 0 ? (int *)alloca(nout * sizeof(*noutchans)) : 0;
-        /* load input signals into signal vector to send subpatches */
-    if (x->x_packout)   /* pack individual mono outputs to a multichannel one */
+        /* with "-parallel", compile every instance, each in its own segment
+        of the region, holding on to their outputs; then combine them all.
+        Otherwise combine each one's outputs as we go. */
+    fork = (x->x_parallel && x->x_n > 1 && ugen_canfork());
+    ntempio = (nin + nout) * (fork ? x->x_n : 1);
+    tempio = ntempio > 0 ?
+        (t_signal **)getbytes(ntempio * sizeof(*tempio)) : 0;
+    if (fork)
     {
         for (j = 0; j < x->x_n; j++)
-        {
-            for (i = 0; i < nin; i++)
-            {
-                if (x->x_distributein)
-                {
-                        /* distribute multi-channel signal over instances;
-                        wrap around if channel count is lower than instance
-                        count */
-                    int offset = j % sp[i]->s_nchans;
-                    tempio[i] = signal_new(0, 1, sp[i]->s_sr, 0);
-                    signal_setborrowed(tempio[i], sp[i]);
-                    tempio[i]->s_nchans = 1;
-                    tempio[i]->s_vec = sp[i]->s_vec + offset * sp[i]->s_length;
-                    tempio[i]->s_refcount = 1;
-                }
-                else
-                    tempio[i] = sp[i];
-            }
-            for (i = 0; i < nout; i++)
-                tempio[nin + i] = signal_newfromcontext(1, 1);
-            canvas_dodsp(x->x_vec[j].c_gl, 0, tempio);
-            if (x->x_distributein)
-            {
-                for (i = 0; i < nin; i++)
-                {
-                    if (!--tempio[i]->s_refcount)
-                        signal_makereusable(tempio[i]);
-                    else
-                        bug("clone 1: %d", tempio[i]->s_refcount);
-                }
-            }
-            for (i = 0; i < nout; i++)
-            {
-                int nchans = tempio[nin + i]->s_nchans;
-                int length = tempio[nin + i]->s_length;
-                t_sample *to, *from = tempio[nin + i]->s_vec;
-                if (j == 0) /* now we can the create the output signal */
-                {
-                    signal_setmultiout(&sp[nin + i], nchans * x->x_n);
-                    noutchans[i] = nchans;
-                }
-                    /* NB: it is possible for instances to have different
-                    output channel counts. In this case we always take the
-                    channel count of the first instance. */
-                to = sp[nin + i]->s_vec + j * length * noutchans[i];
-                if (nchans == noutchans[i])
-                    dsp_add_copy(from, to, length * nchans);
-                else
-                {
-                    if (nchans > noutchans[i]) /* ignore extra channels */
-                        dsp_add_copy(from, to, noutchans[i] * length);
-                    else /* fill missing channels with zeros */
-                    {
-                        dsp_add_copy(from, to, nchans * length);
-                        dsp_add_zero(to + length * nchans,
-                            length * (noutchans[i] - nchans));
-                    }
-                #if 1
-                    pd_error(x, "warning: clone instance %d: channel count "
-                        "of outlet %d (%d) does not match first instance (%d)",
-                            j, i, nchans, noutchans[i]);
-                #endif
-                }
-                signal_makereusable(tempio[nin + i]);
-            }
-        }
+            clone_dspinstance(x, j, sp, nin, nout,
+                tempio + j * (nin + nout), 1);
+        for (j = 0; j < x->x_n; j++)
+            ugen_forkjoin(tempio + j * (nin + nout) + nin, nout);
+        for (j = 0; j < x->x_n; j++)
+            clone_dspoutput(x, j, sp, nin, nout,
+                tempio + j * (nin + nout) + nin, noutchans);
     }
-    else    /* otherwise add the individual outputs */
+    else for (j = 0; j < x->x_n; j++)
     {
-        for (j = 0; j < x->x_n; j++)
-        {
-            for (i = 0; i < nin; i++)
-            {
-                if (x->x_distributein)
-                {
-                        /* distribute multi-channel signal over instances;
-                        wrap around if channel count is lower than instance count */
-                    int offset = j % sp[i]->s_nchans;
-                    tempio[i] = signal_new(0, 1, sp[i]->s_sr, 0);
-                    signal_setborrowed(tempio[i], sp[i]);
-                    tempio[i]->s_nchans = 1;
-                    tempio[i]->s_vec = sp[i]->s_vec + offset * sp[i]->s_length;
-                    tempio[i]->s_refcount = 1;
-                }
-                else
-                    tempio[i] = sp[i];
-            }
-            for (i = 0; i < nout; i++)
-                tempio[nin + i] = signal_newfromcontext(1, 1);
-            canvas_dodsp(x->x_vec[j].c_gl, 0, tempio);
-            if (x->x_distributein)
-            {
-                for (i = 0; i < nin; i++)
-                {
-                    if (!--tempio[i]->s_refcount)
-                        signal_makereusable(tempio[i]);
-                    else
-                        bug("clone 2: %d", tempio[i]->s_refcount);
-                }
-            }
-            for (i = 0; i < nout; i++)
-            {
-                int nchans = tempio[nin + i]->s_nchans;
-                int length = tempio[nin + i]->s_length;
-                if (j == 0)
-                {
-                        /* first instance: create output signal and copy content */
-                    signal_setmultiout(&sp[nin + i], nchans);
-                    dsp_add_copy(tempio[nin + i]->s_vec,
-                        sp[nin + i]->s_vec, length * nchans);
-                    noutchans[i] = nchans;
-                }
-                else /* add to existing signal */
-                {
-                    int nsamples = nchans > noutchans[i] ?
-                        noutchans[i] * length : nchans * length;
-                #if 1
-                    if (nchans != noutchans[i])
-                        pd_error(x, "warning: clone instance %d: channel count "
-                            "of outlet %d (%d) does not match first instance (%d)",
-                                j, i, nchans, noutchans[i]);
-                #endif
-                    dsp_add_plus(tempio[nin + i]->s_vec, sp[nin + i]->s_vec,
-                        sp[nin + i]->s_vec, nsamples);
-                }
-                signal_makereusable(tempio[nin + i]);
-            }
-        }
+        clone_dspinstance(x, j, sp, nin, nout, tempio, 0);
+        clone_dspoutput(x, j, sp, nin, nout, tempio + nin, noutchans);
     }
+    if (tempio)
+        freebytes(tempio, ntempio * sizeof(*tempio));
     for (i = 0; i < nin; i++)
     {
         if (sp[i]->s_refcount <= 0)
@@ -486,6 +497,7 @@ static void *clone_new(t_symbol *s, int argc, t_atom *argv)
     x->x_suppressvoice = 0;
     x->x_distributein = 0;
     x->x_packout = 0;
+    x->x_parallel = 0;
     clone_voicetovis = -1;
     if (argc == 0)
     {
@@ -511,6 +523,8 @@ static void *clone_new(t_symbol *s, int argc, t_atom *argv)
             x->x_distributein = 1, argc--, argv++;
         else if (!strcmp(argv[0].a_w.w_symbol->s_name, "-do"))
             x->x_packout = 1, argc--, argv++;
+        else if (!strcmp(argv[0].a_w.w_symbol->s_name, "-parallel"))
+            x->x_parallel = 1, argc--, argv++;
         else goto usage;
     }
     if (argc >= 2 && (wantn = atom_getfloatarg(0, argc, argv)) >= 0
@@ -638,6 +652,8 @@ void clone_setup(void)
         A_GIMME, 0);
     class_addmethod(clone_in_class, (t_method)clone_in_resize, gensym("resize"),
         A_FLOAT, 0);
+    class_addmethod(clone_in_class, (t_method)clone_in_parallel,
+        gensym("parallel"), A_FLOAT, 0);
     class_addlist(clone_in_class, (t_method)clone_in_list);
 
     clone_out_class = class_new(gensym("clone-outlet"), 0, 0,
@@ -668,3 +684,14 @@ t_glist *clone_get_instance(t_gobj *x, int n)
     return  c->x_vec[n].c_gl;
 }
 
+
+    /* get the nth copy counting from zero, regardless of x_startvoice */
+t_glist *clone_get_nth(t_gobj *x, int n)
+{
+    t_clone *c;
+
+    if (pd_class(&x->g_pd) != clone_class) return NULL;
+
+    c = (t_clone *)x;
+    return ((n >= 0 && n < c->x_n) ? c->x_vec[n].c_gl : NULL);
+}
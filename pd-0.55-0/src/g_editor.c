@@ -160,7 +160,7 @@ void glist_deselect(t_glist *x, t_gobj *y)
             gobj_activate(y, x, 0);
         }
         if (zgetfn(&y->g_pd, gensym("dsp")))
-            fixdsp = canvas_suspend_dsp();
+            fixdsp = canvas_suspend_dsp_for(x);
     }
     if ((sel = x->gl_editor->e_selection)->sel_what == y)
     {
@@ -194,7 +194,7 @@ void glist_deselect(t_glist *x, t_gobj *y)
         canvas_undo_add(x, UNDO_SEQUENCE_END, "typing", 0);
     }
     if (fixdsp)
-        canvas_resume_dsp(1);
+        canvas_resume_dsp_for(1);
 }
 
 void glist_noselect(t_glist *x)
@@ -355,7 +355,7 @@ void canvas_noundo(t_canvas *x)
 
 static void canvas_undo(t_canvas *x)
 {
-    int dspwas = canvas_suspend_dsp();
+    int dspwas = canvas_suspend_dsp_for(x);
     if (x != EDITOR->canvas_undo_canvas)
         bug("canvas_undo 1");
     else if (EDITOR->canvas_undo_whatnext != UNDO_UNDO)
@@ -372,12 +372,12 @@ static void canvas_undo(t_canvas *x)
             pdgui_vmess("pdtk_undomenu", "^ss", x, "no", EDITOR->canvas_undo_name);
         EDITOR->canvas_undo_whatnext = UNDO_REDO;
     }
-    canvas_resume_dsp(dspwas);
+    canvas_resume_dsp_for(dspwas);
 }
 
 static void canvas_redo(t_canvas *x)
 {
-    int dspwas = canvas_suspend_dsp();
+    int dspwas = canvas_suspend_dsp_for(x);
     if (x != EDITOR->canvas_undo_canvas)
         bug("canvas_undo 1");
     else if (EDITOR->canvas_undo_whatnext != UNDO_REDO)
@@ -394,7 +394,7 @@ static void canvas_redo(t_canvas *x)
             pdgui_vmess("pdtk_undomenu", "^ss", x, EDITOR->canvas_undo_name, "no");
         EDITOR->canvas_undo_whatnext = UNDO_UNDO;
     }
-    canvas_resume_dsp(dspwas);
+    canvas_resume_dsp_for(dspwas);
 }
 
 /* ------- specific undo methods: 1. connect -------- */
@@ -454,6 +454,7 @@ void canvas_disconnect(t_canvas *x,
 {
     t_linetraverser t;
     t_outconnect *oc;
+    int dspstate;
     linetraverser_start(&t, x);
     while ((oc = linetraverser_next(&t)))
     {
@@ -468,7 +469,9 @@ void canvas_disconnect(t_canvas *x,
                 sprintf(tag, "l%p", oc);
                 pdgui_vmess(0, "crs", x, "delete", tag);
             }
+            dspstate = canvas_suspend_dsp_for(x);
             obj_disconnect(t.tr_ob, t.tr_outno, t.tr_ob2, t.tr_inno);
+            canvas_resume_dsp_for(dspstate);
             break;
         }
     }
@@ -3749,7 +3752,7 @@ static void canvas_doclear(t_canvas *x)
     t_gobj *y, *y2;
     int dspstate;
 
-    dspstate = canvas_suspend_dsp();
+    dspstate = canvas_suspend_dsp_for(x);
     if (x->gl_editor->e_selectedline)
     {
         canvas_disconnect_with_undo(x,
@@ -3788,7 +3791,7 @@ static void canvas_doclear(t_canvas *x)
     next: ;
     }
 restore:
-    canvas_resume_dsp(dspstate);
+    canvas_resume_dsp_for(dspstate);
     canvas_dirty(x, 1);
 }
 
@@ -3939,7 +3942,7 @@ static int binbuf_getpos(t_binbuf*b, int *x0, int *y0, t_symbol**type)
 static void canvas_dopaste(t_canvas *x, t_binbuf *b)
 {
     t_gobj *g2;
-    int dspstate = canvas_suspend_dsp(), nbox, count;
+    int dspstate = canvas_suspend_dsp_for(x), nbox, count;
     t_symbol *asym = gensym("#A");
         /* save and clear bindings to symbols #A, #N, #X; restore when done */
     t_pd *boundx = s__X.s_thing, *bounda = asym->s_thing,
@@ -3960,7 +3963,7 @@ static void canvas_dopaste(t_canvas *x, t_binbuf *b)
         if (count >= nbox)
             glist_select(x, g2);
     EDITOR->paste_canvas = 0;
-    canvas_resume_dsp(dspstate);
+    canvas_resume_dsp_for(dspstate);
     canvas_dirty(x, 1);
     if (x->gl_mapped)
         pdgui_vmess("pdtk_canvas_getscroll", "c", x);
@@ -4385,7 +4388,7 @@ void canvas_connect(t_canvas *x, t_floatarg fwhoout, t_floatarg foutno,
     t_gobj *src = 0, *sink = 0;
     t_object *objsrc, *objsink;
     t_outconnect *oc;
-    int nin = whoin, nout = whoout;
+    int nin = whoin, nout = whoout, dspstate;
     if (EDITOR->paste_canvas == x) whoout += EDITOR->paste_onset,
         whoin += EDITOR->paste_onset;
     for (src = x->gl_list; whoout; src = src->g_next, whoout--)
@@ -4423,7 +4426,10 @@ void canvas_connect(t_canvas *x, t_floatarg fwhoout, t_floatarg foutno,
         while (inno >= obj_ninlets(objsink))
             inlet_new(objsink, &objsink->ob_pd, 0, 0);
 
-    if (!(oc = obj_connect(objsrc, outno, objsink, inno))) goto bad;
+    dspstate = canvas_suspend_dsp_for(x);
+    oc = obj_connect(objsrc, outno, objsink, inno);
+    canvas_resume_dsp_for(dspstate);
+    if (!oc) goto bad;
     if (glist_isvisible(x) && x->gl_havewindow)
     {
         char tag[128];
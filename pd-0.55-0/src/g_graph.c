@@ -139,7 +139,7 @@ void glist_delete(t_glist *x, t_gobj *y)
     pd_free(&y->g_pd);
     if (rtext)
         rtext_free(rtext);
-    if (chkdsp) canvas_update_dsp();
+    if (chkdsp) canvas_update_dsp_for(x);
     if (drawcommand)
         canvas_redrawallfortemplate(template_findbyname(canvas_makebindsym(
             glist_getcanvas(x)->gl_name)), 1);
@@ -67,6 +67,7 @@ typedef struct _vinlet
     int x_write;            /* write position in reblocker */
     int x_read;             /* read position in reblocker */
     int x_hop;
+    int x_base;             /* where the buffer starts in the ring, below */
     int x_updownmethod;
             /* if not reblocking, the next slot communicates the parent's
                 inlet signal from the prolog to the DSP routine: */
@@ -82,6 +83,7 @@ static void *vinlet_new(t_symbol *s)
     x->x_canvas = canvas_getcurrent();
     x->x_inlet = canvas_addinlet(x->x_canvas, &x->x_obj.ob_pd, 0);
     x->x_buflength = 0;
+    x->x_base = 0;
     x->x_nchans = 0;
     x->x_rb = 0;
     outlet_new(&x->x_obj, 0);
@@ -125,7 +127,7 @@ static void vinlet_free(t_vinlet *x)
     if (x->x_rb)
         for (i = 0; i < x->x_nchans; i++)
     {
-        freebytes((x->x_rb)[i].r_buf, x->x_buflength * sizeof(t_sample));
+        freebytes((x->x_rb)[i].r_buf, 2 * x->x_buflength * sizeof(t_sample));
         resample_free(&(x->x_rb)[i].r_updown);
     }
 }
@@ -137,6 +139,14 @@ t_inlet *vinlet_getit(t_pd *x)
 }
 
 /* ------------------------- signal inlet -------------------------- */
+
+/* When reblocking, the inlet keeps the last x_buflength samples from the
+parent in a ring, starting at x_base, from which the subpatch reads its
+block.  Every sample is stored twice, x_buflength apart, so that the block
+is always contiguous in memory no matter where the ring starts.  Advancing
+by a hop is then just a matter of moving x_base, instead of shifting the
+whole buffer down as we used to. */
+
 int vinlet_issignal(t_vinlet *x)
 {
     return (x->x_rb != 0);
@@ -148,7 +158,7 @@ t_int *vinlet_perform(t_int *w)
     t_sample *out = (t_sample *)(w[2]);
     t_reblocker *rb = (t_reblocker *)(w[3]);
     int advance = (int)(w[4]), n = (int)(w[5]), read = x->x_read;
-    t_sample *in = rb->r_buf + read;
+    t_sample *in = rb->r_buf + x->x_base + read;
     while (n--)
         *out++ = *in++;
     if (advance)    /* only on last channel */
@@ -198,22 +208,30 @@ static void vinlet_dsp(t_vinlet *x, t_signal **sp)
 t_int *vinlet_doprolog(t_int *w)
 {
     t_vinlet *x = (t_vinlet *)(w[1]);
-    t_sample *in = (t_sample *)(w[2]), *out;
+    t_sample *in = (t_sample *)(w[2]);
     t_sample *buf = (t_sample *)(w[3]);
     int lastone = (int)(w[4]), n = (int)(w[5]), write = x->x_write;
+    int length = x->x_buflength, base = x->x_base, pos;
 
-    if (write == x->x_buflength)
+    if (write == length)    /* drop the oldest hop */
     {
-        t_sample *f1 = buf, *f2 = buf + x->x_hop;
-        int nshift = x->x_buflength - x->x_hop;
-        while (nshift--) *f1++ = *f2++;
+        if ((base += x->x_hop) >= length)
+            base -= length;
         write -= x->x_hop;
     }
-    out = buf + write;
     if (lastone)    /* only advance write position on last channel! */
-        x->x_write = write + n;
-    while (n--)
-        *out++ = *in++;
+        x->x_write = write + n, x->x_base = base;
+    if ((pos = base + write) >= length)
+        pos -= length;
+    while (n)   /* in at most two pieces if we wrap around */
+    {
+        int chunk = (length - pos < n ? length - pos : n);
+        t_sample *out1 = buf + pos, *out2 = out1 + length;
+        n -= chunk;
+        while (chunk--)
+            *out1++ = *out2++ = *in++;
+        pos = 0;
+    }
     return (w+6);
 }
 
@@ -246,7 +264,7 @@ void vinlet_dspprolog(struct _vinlet *x, t_signal **parentsigs,
             parentvecsize = insig->s_length;
             re_parentvecsize = parentvecsize * upsample / downsample;
             reblocker_resize(&x->x_rb, x->x_nchans, insig->s_nchans,
-                x->x_buflength);
+                2 * x->x_buflength);
             x->x_nchans = insig->s_nchans;
         }
         else
@@ -263,10 +281,13 @@ void vinlet_dspprolog(struct _vinlet *x, t_signal **parentsigs,
             for (i = 0; i < x->x_nchans; i++)
             {
                 x->x_rb[i].r_buf = (t_sample *)t_resizebytes(x->x_rb[i].r_buf,
-                    oldbufsize * sizeof(t_sample), bufsize * sizeof(t_sample));
-                memset((char *)x->x_rb[i].r_buf, 0, bufsize * sizeof(t_sample));
+                    2 * oldbufsize * sizeof(t_sample),
+                        2 * bufsize * sizeof(t_sample));
+                memset((char *)x->x_rb[i].r_buf, 0,
+                    2 * bufsize * sizeof(t_sample));
             }
             x->x_buflength = bufsize;
+            x->x_base = 0;
         }
         if (parentsigs)
         {
@@ -299,7 +320,8 @@ void vinlet_dspprolog(struct _vinlet *x, t_signal **parentsigs,
             }
         }
         else for (i = 0; i < x->x_nchans; i++)
-            memset((char *)(x->x_rb[i].r_buf), 0, bufsize * sizeof(t_sample));
+            memset((char *)(x->x_rb[i].r_buf), 0,
+                2 * bufsize * sizeof(t_sample));
         x->x_directsignal = 0;
     }
     else
@@ -317,6 +339,7 @@ static void *vinlet_newsig(t_symbol *s, int argc, t_atom *argv)
     x->x_inlet = canvas_addinlet(x->x_canvas, &x->x_obj.ob_pd, &s_signal);
     x->x_nchans = 1;
     x->x_buflength = 0;
+    x->x_base = 0;
     x->x_rb = (t_reblocker *)getbytes(sizeof(*x->x_rb));
     reblocker_init(x->x_rb, x->x_buflength);
     x->x_directsignal = 0;
@@ -348,7 +371,8 @@ static void vinlet_setup(void)
 {
     vinlet_class = class_new(gensym("inlet"), (t_newmethod)vinlet_new,
         (t_method)vinlet_free, sizeof(t_vinlet),
-            CLASS_NOINLET | CLASS_MULTICHANNEL, A_DEFSYM, 0);
+            CLASS_NOINLET | CLASS_MULTICHANNEL | CLASS_PARALLELSAFE,
+                A_DEFSYM, 0);
     class_addcreator((t_newmethod)vinlet_newsig, gensym("inlet~"), A_GIMME, 0);
     class_addbang(vinlet_class, vinlet_bang);
     class_addpointer(vinlet_class, vinlet_pointer);
@@ -453,19 +477,23 @@ int voutlet_issignal(t_voutlet *x)
     return (x->x_rb != 0);
 }
 
-    /* LATER optimize for non-overlapped case where the "+=" isn't needed */
+    /* overlap-add the block into the ring the epilog reads from, in at
+    most two pieces if it wraps around.
+    LATER optimize for non-overlapped case where the "+=" isn't needed */
 t_int *voutlet_perform(t_int *w)
 {
     t_voutlet *x = (t_voutlet *)(w[1]);
     t_sample *in = (t_sample *)(w[2]), *buf= (t_sample *)(w[3]);
     int lastone = (int)(w[4]), n = (int)(w[5]), write = x->x_write;
-    t_sample *out = buf + write,
-        *endbuf = buf + x->x_buflength;
-    while (n--)
+    int pos = write;
+    while (n)
     {
-        *out++ += *in++;
-        if (out == endbuf)
-            out = buf;
+        int chunk = (x->x_buflength - pos < n ? x->x_buflength - pos : n);
+        t_sample *out = buf + pos;
+        n -= chunk;
+        while (chunk--)
+            *out++ += *in++;
+        pos = 0;
     }
     if (lastone)    /* only advance write position on last channel! */
     {
@@ -702,7 +730,8 @@ static void voutlet_setup(void)
 {
     voutlet_class = class_new(gensym("outlet"), (t_newmethod)voutlet_new,
         (t_method)voutlet_free, sizeof(t_voutlet),
-            CLASS_NOINLET | CLASS_MULTICHANNEL, A_DEFSYM, 0);
+            CLASS_NOINLET | CLASS_MULTICHANNEL | CLASS_PARALLELSAFE,
+                A_DEFSYM, 0);
     class_addcreator((t_newmethod)voutlet_newsig, gensym("outlet~"), A_DEFSYM, 0);
     class_addbang(voutlet_class, voutlet_bang);
     class_addpointer(voutlet_class, voutlet_pointer);
@@ -257,7 +257,7 @@ void canvas_undo_undo(t_canvas *x)
     int dspwas;
 
     if (!udo) return;
-    dspwas = canvas_suspend_dsp();
+    dspwas = canvas_suspend_dsp_for(x);
     DEBUG_UNDO(post("%s: %p != %p", __FUNCTION__, udo->u_queue, udo->u_last));
     if (udo->u_queue && udo->u_last != udo->u_queue)
     {
@@ -308,7 +308,7 @@ void canvas_undo_undo(t_canvas *x)
             canvas_dirty(x, canvas_undo_isdirty(x));
         }
     }
-    canvas_resume_dsp(dspwas);
+    canvas_resume_dsp_for(dspwas);
 }
 
 void canvas_undo_redo(t_canvas *x)
@@ -316,7 +316,7 @@ void canvas_undo_redo(t_canvas *x)
     int dspwas;
     t_undo *udo = canvas_undo_get(x);
     if (!udo) return;
-    dspwas = canvas_suspend_dsp();
+    dspwas = canvas_suspend_dsp_for(x);
     if (udo->u_queue && udo->u_last->next)
     {
         char *undo_action, *redo_action;
@@ -362,7 +362,7 @@ void canvas_undo_redo(t_canvas *x)
         canvas_show_undomenu(x, undo_action, redo_action);
         canvas_dirty(x, canvas_undo_isdirty(x));
     }
-    canvas_resume_dsp(dspwas);
+    canvas_resume_dsp_for(dspwas);
 }
 
 void canvas_undo_rebranch(t_canvas *x)
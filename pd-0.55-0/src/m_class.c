@@ -50,6 +50,8 @@ void g_canvas_newpdinstance( void);
 void g_canvas_freepdinstance( void);
 void d_ugen_newpdinstance( void);
 void d_ugen_freepdinstance( void);
+void m_sched_newpdinstance( void);
+void m_sched_freepdinstance( void);
 void new_anything(void *dummy, t_symbol *s, int argc, t_atom *argv);
 
 void s_stuff_newpdinstance(void)
@@ -61,10 +63,16 @@ void s_stuff_newpdinstance(void)
     STUFF->st_dacsr = DEFDACSAMPLERATE;
     STUFF->st_printhook = sys_printhook;
     STUFF->st_impdata = NULL;
+    STUFF->st_clockheap = 0;
+    STUFF->st_nclocks = STUFF->st_clockheapsize = 0;
+    STUFF->st_clockserial = 0;
 }
 
 void s_stuff_freepdinstance(void)
 {
+    if (STUFF->st_clockheap)
+        freebytes(STUFF->st_clockheap,
+            STUFF->st_clockheapsize * sizeof(*STUFF->st_clockheap));
     freebytes(STUFF, sizeof(*STUFF));
 }
 
@@ -110,6 +118,7 @@ static t_pdinstance *pdinstance_init(t_pdinstance *x)
     g_canvas_newpdinstance();
     d_ugen_newpdinstance();
     s_stuff_newpdinstance();
+    m_sched_newpdinstance();
     return (x);
 }
 
@@ -255,6 +264,7 @@ void pdinstance_free(t_pdinstance *x)
     x_midi_freepdinstance();
     g_canvas_freepdinstance();
     d_ugen_freepdinstance();
+    m_sched_freepdinstance();
     s_stuff_freepdinstance();
     for (i = instanceno; i < pd_ninstances-1; i++)
         pd_instances[i] = pd_instances[i+1];
@@ -501,6 +511,7 @@ t_class *class_new(t_symbol *s, t_newmethod newmethod, t_method freemethod,
     c->c_multichannel = (flags & CLASS_MULTICHANNEL) != 0;
     c->c_nopromotesig = (flags & CLASS_NOPROMOTESIG) != 0;
     c->c_nopromoteleft = (flags & CLASS_NOPROMOTELEFT) != 0;
+    c->c_parallelsafe = (flags & CLASS_PARALLELSAFE) != 0;
     c->c_drawcommand = 0;
     c->c_floatsignalin = 0;
     c->c_externdir = class_extern_dir;
@@ -956,7 +967,18 @@ void *pdfloat_new(t_pd *dummy, t_float f);
 void *pdsymbol_new(t_pd *dummy, t_symbol *s);
 void *list_new(t_pd *dummy, t_symbol *s, int argc, t_atom *argv);
 
+#ifdef MEMSTATS
+static void pd_dotypedmess(t_pd *x, t_symbol *s, int argc, t_atom *argv);
+
 void pd_typedmess(t_pd *x, t_symbol *s, int argc, t_atom *argv)
+{
+    MEMSTATS_DISPATCH(x, pd_dotypedmess(x, s, argc, argv));
+}
+
+static void pd_dotypedmess(t_pd *x, t_symbol *s, int argc, t_atom *argv)
+#else
+void pd_typedmess(t_pd *x, t_symbol *s, int argc, t_atom *argv)
+#endif
 {
     t_method *f;
     t_class *c = *x;
@@ -1258,5 +1280,6 @@ int class_getdspflags(const t_class *c)
 {
     return ((c->c_multichannel ? CLASS_MULTICHANNEL : 0) |
             (c->c_nopromotesig ? CLASS_NOPROMOTESIG : 0) |
-            (c->c_nopromoteleft ? CLASS_NOPROMOTELEFT : 0) );
+            (c->c_nopromoteleft ? CLASS_NOPROMOTELEFT : 0) |
+            (c->c_parallelsafe ? CLASS_PARALLELSAFE : 0) );
 }
@@ -17,8 +17,14 @@ over.  Some others are prototyped in m_imp.h as well. */
 void glob_menunew(void *dummy, t_symbol *name, t_symbol *dir);
 void glob_verifyquit(void *dummy, t_floatarg f);
 void glob_dsp(void *dummy, t_symbol *s, int argc, t_atom *argv);
+void glob_dspthreads(void *dummy, t_floatarg f);
+void glob_dspcpus(void *dummy, t_symbol *s, int argc, t_atom *argv);
+void glob_iocpus(void *dummy, t_symbol *s, int argc, t_atom *argv);
+void glob_flushdenormals(void *dummy, t_floatarg f);
+void glob_profile(void *dummy, t_symbol *s, int argc, t_atom *argv);
 void glob_key(void *dummy, t_symbol *s, int ac, t_atom *av);
 void glob_audiostatus(void *dummy);
+void glob_dspload(void *dummy, t_symbol *s, int argc, t_atom *argv);
 void glob_finderror(t_pd *dummy);
 void glob_findinstance(t_pd *dummy, t_symbol*s);
 void glob_start_preference_dialog(t_pd *dummy, t_symbol*s);
@@ -40,6 +46,8 @@ void glob_loadpreferences(t_pd *dummy, t_symbol *s);
 void glob_savepreferences(t_pd *dummy, t_symbol *s);
 void glob_forgetpreferences(t_pd *dummy);
 void glob_open(t_pd *ignore, t_symbol *name, t_symbol *dir, t_floatarg f);
+void glob_prepare(t_pd *ignore, t_symbol *name, t_symbol *dir);
+void glob_commit(t_pd *ignore, t_symbol *s, int argc, t_atom *argv);
 void glob_fastforward(t_pd *ignore, t_floatarg f);
 void glob_settracing(void *dummy, t_float f);
 
@@ -62,7 +70,7 @@ void glob_audio(void *dummy, t_floatarg adc, t_floatarg dac);
 /* a method you add for debugging printout */
 void glob_foo(void *dummy, t_symbol *s, int argc, t_atom *argv);
 
-#if 1
+#ifndef DEBUGMEM    /* otherwise m_memory.c's "foo" reports memory use */
 void glob_foo(void *dummy, t_symbol *s, int argc, t_atom *argv)
 {
 #ifdef USEAPI_ALSA
@@ -131,14 +139,32 @@ void glob_init(void)
         A_SYMBOL, A_SYMBOL, 0);
     class_addmethod(glob_pdobject, (t_method)glob_open, gensym("open"),
         A_SYMBOL, A_SYMBOL, A_DEFFLOAT, 0);
+    class_addmethod(glob_pdobject, (t_method)glob_prepare, gensym("prepare"),
+        A_SYMBOL, A_SYMBOL, 0);
+    class_addmethod(glob_pdobject, (t_method)glob_commit, gensym("commit"),
+        A_GIMME, 0);
     class_addmethod(glob_pdobject, (t_method)glob_exit, gensym("quit"), A_DEFFLOAT, 0);
     class_addmethod(glob_pdobject, (t_method)glob_verifyquit,
         gensym("verifyquit"), A_DEFFLOAT, 0);
     class_addmethod(glob_pdobject, (t_method)glob_foo, gensym("foo"), A_GIMME, 0);
     class_addmethod(glob_pdobject, (t_method)glob_dsp, gensym("dsp"), A_GIMME, 0);
+    class_addmethod(glob_pdobject, (t_method)glob_dspthreads,
+        gensym("dsp-threads"), A_FLOAT, 0);
+    class_addmethod(glob_pdobject, (t_method)glob_dspcpus,
+        gensym("dsp-cpus"), A_GIMME, 0);
+    class_addmethod(glob_pdobject, (t_method)glob_iocpus,
+        gensym("io-cpus"), A_GIMME, 0);
+    class_addmethod(glob_pdobject, (t_method)glob_flushdenormals,
+        gensym("flush-denormals"), A_FLOAT, 0);
+    class_addmethod(glob_pdobject, (t_method)glob_memstats,
+        gensym("memstats"), A_GIMME, 0);
+    class_addmethod(glob_pdobject, (t_method)glob_profile,
+        gensym("profile"), A_GIMME, 0);
     class_addmethod(glob_pdobject, (t_method)glob_key, gensym("key"), A_GIMME, 0);
     class_addmethod(glob_pdobject, (t_method)glob_audiostatus,
         gensym("audiostatus"), 0);
+    class_addmethod(glob_pdobject, (t_method)glob_dspload,
+        gensym("dspload"), A_GIMME, 0);
     class_addmethod(glob_pdobject, (t_method)glob_finderror,
         gensym("finderror"), 0);
     class_addmethod(glob_pdobject, (t_method)glob_findinstance,
@@ -66,6 +66,7 @@ struct _class
     unsigned int c_multichannel:1;      /* can deal with multichannel sigs */
     unsigned int c_nopromotesig:1;      /* don't promote scalars to signals */
     unsigned int c_nopromoteleft:1;     /* not even the main (left) inlet */
+    unsigned int c_parallelsafe:1;      /* may run on a DSP worker thread */
     t_classfreefn c_classfreefn;    /* function to call before freeing class */
 };
 
@@ -112,5 +113,21 @@ EXTERN void glob_exit(void *dummy, t_float status);
 EXTERN void glob_watchdog(void *dummy); /* glob_exit(0); */
 EXTERN void open_via_helppath(const char *name, const char *dir);
 
+/* ----------- memory accounting, from m_memory.c (see MEMSTATS) ---------- */
+#ifdef MEMSTATS
+EXTERN t_class *memstats_setowner(t_class *c);
+EXTERN t_class *memstats_newobject(t_class *c);
+EXTERN void memstats_endnewobject(t_class *was);
+    /* call a method with allocations charged to the receiver's class */
+#define MEMSTATS_DISPATCH(x, call) do { \
+    t_class *memstats_was = memstats_setowner(*(x)); \
+    call; \
+    memstats_setowner(memstats_was); \
+} while (0)
+#else
+#define MEMSTATS_DISPATCH(x, call) call
+#endif
+EXTERN void glob_memstats(void *dummy, t_symbol *s, int argc, t_atom *argv);
+
 #define __m_imp_h_
 #endif /* __m_imp_h_ */
@@ -5,20 +5,45 @@
 #include <stdlib.h>
 #include <string.h>
 #include "m_pd.h"
+#include "m_imp.h"
 #if (defined LOUD) || (defined DEBUGMEM)
 # include <stdio.h>
 #endif
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <windows.h>
+#endif
+#ifdef MEMSTATS
+#include <pthread.h>
+#endif
 
 /* #define DEBUGMEM */
 #ifdef DEBUGMEM
 static int totalmem = 0;
+static void rtmem_checkdsp(const char *fn);
+#endif
+
+/* #define MEMSTATS */
+#ifdef MEMSTATS
+static void *memstats_alloc(size_t nbytes);
+static void *memstats_realloc(void *old, size_t newsize);
+static void memstats_free(void *x, size_t nbytes);
+#define MEM_CALLOC(n) memstats_alloc(n)
+#define MEM_REALLOC(p, n) memstats_realloc(p, n)
+#define MEM_FREE(p, n) memstats_free(p, n)
+#else
+#define MEM_CALLOC(n) calloc(n, 1)
+#define MEM_REALLOC(p, n) realloc(p, n)
+#define MEM_FREE(p, n) free(p)
 #endif
 
 void *getbytes(size_t nbytes)
 {
     void *ret;
+#ifdef DEBUGMEM
+    rtmem_checkdsp("getbytes");
+#endif
     if (nbytes < 1) nbytes = 1;
-    ret = (void *)calloc(nbytes, 1);
+    ret = (void *)MEM_CALLOC(nbytes);
 #ifdef LOUD
     fprintf(stderr, "new  %lx %d\n", (int)ret, nbytes);
 #endif /* LOUD */
@@ -47,9 +72,12 @@ void *copybytes(const void *src, size_t nbytes)
 void *resizebytes(void *old, size_t oldsize, size_t newsize)
 {
     void *ret;
+#ifdef DEBUGMEM
+    rtmem_checkdsp("resizebytes");
+#endif
     if (newsize < 1) newsize = 1;
     if (oldsize < 1) oldsize = 1;
-    ret = (void *)realloc((char *)old, newsize);
+    ret = (void *)MEM_REALLOC((char *)old, newsize);
     if (newsize > oldsize && ret)
         memset(((char *)ret) + oldsize, 0, newsize - oldsize);
 #ifdef LOUD
@@ -65,6 +93,9 @@ void *resizebytes(void *old, size_t oldsize, size_t newsize)
 
 void freebytes(void *fatso, size_t nbytes)
 {
+#ifdef DEBUGMEM
+    rtmem_checkdsp("freebytes");
+#endif
     if (nbytes == 0)
         nbytes = 1;
 #ifdef LOUD
@@ -73,10 +104,467 @@ void freebytes(void *fatso, size_t nbytes)
 #ifdef DEBUGMEM
     totalmem -= nbytes;
 #endif
-    free(fatso);
+    MEM_FREE(fatso, nbytes);
+}
+
+/* ------------------- real-time-safe small blocks --------------------- */
+
+    /* rt_getbytes() and rt_freebytes() hand out small blocks from pools of
+    fixed size classes, so that code running under the DSP lock or in a DSP
+    helper thread doesn't wait on malloc's own lock, which GUI or network
+    threads may be holding.  Each thread keeps a cache of free blocks per
+    class.  When a cache grows past RTMEM_CACHEMAX, its blocks go to a global
+    list for that class, and a thread whose cache runs dry takes the whole
+    global list at once.  Since blocks only go onto a global list by
+    compare-and-swap and come off it all together by an atomic exchange,
+    the lists need no lock and don't suffer from the ABA problem.  Only when
+    both are empty do we call malloc, for a slab of new blocks; so after a
+    short warm-up the pools stop touching malloc at all.  Requests above the
+    largest class just use getbytes().
+
+    Compiled with DEBUGMEM, each block carries a header that catches double
+    frees, frees with the wrong size and pointers that didn't come from
+    rt_getbytes(); and getbytes(), resizebytes() and freebytes() complain
+    if they're called from within a DSP tick. */
+
+#if defined(_MSC_VER) && !defined(__clang__)
+#define RTMEM_PERTHREAD __declspec(thread)
+#define RTMEM_CAS(p, old, new) \
+    (InterlockedCompareExchangePointer((PVOID volatile *)(p), (new), (old)) \
+        == (old))
+#define RTMEM_EXCHANGE(p, new) \
+    InterlockedExchangePointer((PVOID volatile *)(p), (new))
+#else
+#define RTMEM_PERTHREAD __thread
+#define RTMEM_CAS(p, old, new) __sync_bool_compare_and_swap((p), (old), (new))
+#define RTMEM_EXCHANGE(p, new) __sync_lock_test_and_set((p), (new))
+#endif
+
+#define RTMEM_MINSIZE 16        /* smallest class, in bytes */
+#define RTMEM_NCLASS 8          /* classes of 16, 32, ... 2048 bytes */
+#define RTMEM_CACHEMAX 64       /* free blocks a thread keeps per class */
+#define RTMEM_SLABSIZE 16384    /* bytes of blocks per malloc */
+
+#ifdef DEBUGMEM
+#define RTMEM_HEADER 16         /* keeps the blocks 16-byte aligned */
+#define RTMEM_INUSE 0x5254494eu
+#define RTMEM_FREE 0x52544652u
+typedef struct _rthead
+{
+    unsigned int h_magic;
+    int h_class;
+} t_rthead;
+#define RTMEM_HEAD(b) ((t_rthead *)((char *)(b) - RTMEM_HEADER))
+#else
+#define RTMEM_HEADER 0
+#endif
+
+    /* a free block, pointing past the header if any */
+typedef struct _rtblock
+{
+    struct _rtblock *b_next;
+} t_rtblock;
+
+typedef struct _rtcache
+{
+    t_rtblock *c_list;
+    int c_count;
+} t_rtcache;
+
+static RTMEM_PERTHREAD t_rtcache rtmem_cache[RTMEM_NCLASS];
+static t_rtblock *volatile rtmem_global[RTMEM_NCLASS];
+
+static int rtmem_class(size_t nbytes)
+{
+    int class = 0;
+    size_t size = RTMEM_MINSIZE;
+    while (size < nbytes)
+        size <<= 1, class++;
+    return (class);
+}
+
+    /* carve a new slab into blocks for this thread's cache */
+static int rtmem_newslab(int class)
+{
+    size_t size = ((size_t)RTMEM_MINSIZE << class) + RTMEM_HEADER;
+    int i, n = RTMEM_SLABSIZE / size;
+    char *slab = (char *)malloc(n * size);
+    t_rtcache *c = &rtmem_cache[class];
+    if (!slab)
+        return (0);
+    for (i = 0; i < n; i++)
+    {
+        t_rtblock *b = (t_rtblock *)(slab + i * size + RTMEM_HEADER);
+#ifdef DEBUGMEM
+        RTMEM_HEAD(b)->h_magic = RTMEM_FREE;
+        RTMEM_HEAD(b)->h_class = class;
+#endif
+        b->b_next = c->c_list;
+        c->c_list = b;
+    }
+    c->c_count += n;
+    return (1);
+}
+
+void *rt_getbytes(size_t nbytes)
+{
+    int class;
+    t_rtcache *c;
+    t_rtblock *b;
+    if (nbytes > ((size_t)RTMEM_MINSIZE << (RTMEM_NCLASS-1)))
+        return (getbytes(nbytes));
+    class = rtmem_class(nbytes);
+    c = &rtmem_cache[class];
+    if (!c->c_list)
+    {
+        t_rtblock *got =
+            (t_rtblock *)RTMEM_EXCHANGE(&rtmem_global[class], 0);
+        if (got)
+        {
+            c->c_list = got;
+            for (c->c_count = 0; got; got = got->b_next)
+                c->c_count++;
+        }
+        else if (!rtmem_newslab(class))
+        {
+            post("pd: rt_getbytes() failed -- out of memory");
+            return (0);
+        }
+    }
+    b = c->c_list;
+    c->c_list = b->b_next;
+    c->c_count--;
+#ifdef DEBUGMEM
+    if (RTMEM_HEAD(b)->h_magic != RTMEM_FREE ||
+        RTMEM_HEAD(b)->h_class != class)
+            bug("rt_getbytes: free list corrupted");
+    RTMEM_HEAD(b)->h_magic = RTMEM_INUSE;
+    totalmem += nbytes;
+#endif
+    memset(b, 0, (size_t)RTMEM_MINSIZE << class);
+    return (b);
+}
+
+void rt_freebytes(void *x, size_t nbytes)
+{
+    int class;
+    t_rtcache *c;
+    t_rtblock *b;
+    if (nbytes > ((size_t)RTMEM_MINSIZE << (RTMEM_NCLASS-1)))
+    {
+        freebytes(x, nbytes);
+        return;
+    }
+    if (!x)
+        return;
+    class = rtmem_class(nbytes);
+    c = &rtmem_cache[class];
+    b = (t_rtblock *)x;
+#ifdef DEBUGMEM
+    if (RTMEM_HEAD(b)->h_magic == RTMEM_FREE)
+    {
+        bug("rt_freebytes: block freed twice");
+        return;
+    }
+    else if (RTMEM_HEAD(b)->h_magic != RTMEM_INUSE)
+    {
+        bug("rt_freebytes: block didn't come from rt_getbytes");
+        return;
+    }
+    else if (RTMEM_HEAD(b)->h_class != class)
+    {
+        bug("rt_freebytes: freed with size %d, allocated as %d",
+            (int)nbytes, RTMEM_MINSIZE << RTMEM_HEAD(b)->h_class);
+        c = &rtmem_cache[(class = RTMEM_HEAD(b)->h_class)];
+    }
+    RTMEM_HEAD(b)->h_magic = RTMEM_FREE;
+    totalmem -= nbytes;
+#endif
+    b->b_next = c->c_list;
+    c->c_list = b;
+    if (++c->c_count > RTMEM_CACHEMAX)
+    {
+            /* hand the whole cache over to the global list */
+        t_rtblock *head = c->c_list, *tail = head, *old;
+        while (tail->b_next)
+            tail = tail->b_next;
+        do
+        {
+            old = rtmem_global[class];
+            tail->b_next = old;
+        } while (!RTMEM_CAS(&rtmem_global[class], old, head));
+        c->c_list = 0;
+        c->c_count = 0;
+    }
+}
+
+/* ------------------------- memory accounting ------------------------- */
+
+    /* Compiled with MEMSTATS, getbytes() and friends put a small header in
+    front of each block recording its size and the class it's charged to:
+    the class of the object currently receiving a message (see
+    MEMSTATS_DISPATCH in m_imp.h), or of the object being created, whose
+    constructor's allocations are its own.  Live bytes, blocks and the peak
+    are kept per class and reported by "pd memstats".  Blocks are charged to
+    the class that allocated them even if another frees them, and since the
+    header knows the size, freebytes() no longer has to trust its caller;
+    it counts the times the two disagree.  Without MEMSTATS none of this is
+    compiled and the allocator is just calloc/realloc/free as always. */
+
+#ifdef MEMSTATS
+
+#define MEMSTATS_MAGIC 0x4d454d53u
+#define MEMSTATS_HEADER 16      /* keeps blocks 16-byte aligned */
+
+typedef struct _memhead
+{
+    size_t h_size;              /* bytes the caller asked for */
+    int h_owner;                /* index into memstats_vec */
+    unsigned int h_magic;
+} t_memhead;
+
+typedef struct _memstat
+{
+    t_class *m_class;           /* zero for allocations outside messages */
+    size_t m_live;              /* bytes allocated now */
+    size_t m_peak;              /* most ever allocated at once */
+    size_t m_nblocks;           /* blocks allocated now */
+} t_memstat;
+
+static PERTHREAD t_class *memstats_owner;
+static pthread_mutex_t memstats_lock = PTHREAD_MUTEX_INITIALIZER;
+static t_memstat *memstats_vec;
+static int memstats_n, memstats_size;
+static int *memstats_hash;      /* open hash of index+1 by class pointer */
+static int memstats_hashsize;
+static size_t memstats_live, memstats_peak, memstats_badsize;
+
+t_class *memstats_setowner(t_class *c)
+{
+    t_class *was = memstats_owner;
+    memstats_owner = c;
+    return (was);
+}
+
+    /* called from pd_new() around allocating the object.  A new patchable
+    object is charged to its own class, but an inlet or proxy made as part
+    of another object stays charged to that object's class. */
+t_class *memstats_newobject(t_class *c)
+{
+    t_class *was = memstats_owner;
+    if (!was || c->c_patchable)
+        memstats_owner = c;
+    return (was);
+}
+
+    /* ... and after.  If we're in a creator called by the object or canvas
+    maker, the new object keeps ownership so that whatever its constructor
+    allocates is charged to it; the message dispatch to the maker puts the
+    old owner back once the creator returns.  Otherwise the object is being
+    made directly by some other code, whose owner we restore right away. */
+void memstats_endnewobject(t_class *was)
+{
+    if (was != pd_objectmaker && was != pd_canvasmaker)
+        memstats_owner = was;
+}
+
+static int memstats_hashof(t_class *c, int size)
+{
+    return ((int)(((size_t)c >> 4) * 2654435761u) & (size - 1));
 }
 
+    /* find or add the entry for a class; called with the lock held.  The
+    tables are grown with plain malloc so as not to count themselves. */
+static int memstats_index(t_class *c)
+{
+    int h, i;
+    if (!memstats_vec)
+    {
+        memstats_vec = (t_memstat *)calloc(64, sizeof(t_memstat));
+        memstats_size = 64;
+        memstats_n = 1;     /* entry 0 is for allocations outside messages */
+        memstats_hash = (int *)calloc(128, sizeof(int));
+        memstats_hashsize = 128;
+    }
+    if (!c)
+        return (0);
+    for (h = memstats_hashof(c, memstats_hashsize); (i = memstats_hash[h]);
+        h = (h + 1) & (memstats_hashsize - 1))
+            if (memstats_vec[i-1].m_class == c)
+                return (i-1);
+    if (memstats_n == memstats_size)
+    {
+        memstats_vec = (t_memstat *)realloc(memstats_vec,
+            2 * memstats_size * sizeof(t_memstat));
+        memset(memstats_vec + memstats_size, 0,
+            memstats_size * sizeof(t_memstat));
+        memstats_size *= 2;
+    }
+    if (2 * (memstats_n + 1) > memstats_hashsize)
+    {
+            /* keep the hash at most half full */
+        int j;
+        free(memstats_hash);
+        memstats_hashsize *= 2;
+        memstats_hash = (int *)calloc(memstats_hashsize, sizeof(int));
+        for (j = 1; j < memstats_n; j++)
+        {
+            for (h = memstats_hashof(memstats_vec[j].m_class,
+                memstats_hashsize); memstats_hash[h];
+                    h = (h + 1) & (memstats_hashsize - 1))
+                        ;
+            memstats_hash[h] = j + 1;
+        }
+        for (h = memstats_hashof(c, memstats_hashsize); memstats_hash[h];
+            h = (h + 1) & (memstats_hashsize - 1))
+                ;
+    }
+    memstats_hash[h] = memstats_n + 1;
+    memstats_vec[memstats_n].m_class = c;
+    return (memstats_n++);
+}
+
+static void memstats_charge(t_memhead *h, size_t oldsize, size_t newsize,
+    int nblocks)
+{
+    t_memstat *m = &memstats_vec[h->h_owner];
+    m->m_live += newsize - oldsize;
+    m->m_nblocks += nblocks;
+    if (m->m_live > m->m_peak)
+        m->m_peak = m->m_live;
+    memstats_live += newsize - oldsize;
+    if (memstats_live > memstats_peak)
+        memstats_peak = memstats_live;
+}
+
+static void *memstats_alloc(size_t nbytes)
+{
+    t_memhead *h = (t_memhead *)calloc(nbytes + MEMSTATS_HEADER, 1);
+    if (!h)
+        return (0);
+    pthread_mutex_lock(&memstats_lock);
+    h->h_size = nbytes;
+    h->h_owner = memstats_index(memstats_owner);
+    h->h_magic = MEMSTATS_MAGIC;
+    memstats_charge(h, 0, nbytes, 1);
+    pthread_mutex_unlock(&memstats_lock);
+    return ((char *)h + MEMSTATS_HEADER);
+}
+
+static void *memstats_realloc(void *old, size_t newsize)
+{
+    t_memhead *h;
+    size_t oldsize;
+    if (!old)
+        return (memstats_alloc(newsize));
+    h = (t_memhead *)((char *)old - MEMSTATS_HEADER);
+    if (h->h_magic != MEMSTATS_MAGIC)   /* not ours; leave it alone */
+        return (realloc(old, newsize));
+    oldsize = h->h_size;
+    if (!(h = (t_memhead *)realloc(h, newsize + MEMSTATS_HEADER)))
+        return (0);
+    pthread_mutex_lock(&memstats_lock);
+    h->h_size = newsize;
+    memstats_charge(h, oldsize, newsize, 0);
+    pthread_mutex_unlock(&memstats_lock);
+    return ((char *)h + MEMSTATS_HEADER);
+}
+
+static void memstats_free(void *x, size_t nbytes)
+{
+    t_memhead *h;
+    if (!x)
+        return;
+    h = (t_memhead *)((char *)x - MEMSTATS_HEADER);
+    if (h->h_magic != MEMSTATS_MAGIC)
+    {
+        free(x);
+        return;
+    }
+    pthread_mutex_lock(&memstats_lock);
+    if (nbytes != h->h_size)
+        memstats_badsize++;
+    memstats_charge(h, h->h_size, 0, -1);
+    pthread_mutex_unlock(&memstats_lock);
+    h->h_magic = 0;
+    free(h);
+}
+
+static int memstats_compare(const void *a, const void *b)
+{
+    size_t la = ((const t_memstat *)a)->m_live,
+        lb = ((const t_memstat *)b)->m_live;
+    return (la < lb ? 1 : (la > lb ? -1 : 0));
+}
+
+    /* "pd memstats" - post memory use by class, largest first */
+void glob_memstats(void *dummy, t_symbol *s, int argc, t_atom *argv)
+{
+    t_memstat *sorted;
+    int i, n;
+    size_t live, peak, badsize;
+    pthread_mutex_lock(&memstats_lock);
+    memstats_index(0);
+    n = memstats_n;
+    if ((sorted = (t_memstat *)malloc(n * sizeof(t_memstat))))
+        memcpy(sorted, memstats_vec, n * sizeof(t_memstat));
+    live = memstats_live;
+    peak = memstats_peak;
+    badsize = memstats_badsize;
+    pthread_mutex_unlock(&memstats_lock);
+    if (!sorted)
+        return;
+    qsort(sorted, n, sizeof(t_memstat), memstats_compare);
+    post("memory use by class: bytes now (peak) in blocks");
+    for (i = 0; i < n; i++)
+        if (sorted[i].m_peak)
+            post("  %s: %lu (%lu) in %lu",
+                (sorted[i].m_class ?
+                    class_getname(sorted[i].m_class) : "(no object)"),
+                (unsigned long)sorted[i].m_live,
+                (unsigned long)sorted[i].m_peak,
+                (unsigned long)sorted[i].m_nblocks);
+    post("total: %lu bytes (peak %lu)", (unsigned long)live,
+        (unsigned long)peak);
+    if (badsize)
+        post("warning: %lu blocks freed with the wrong size",
+            (unsigned long)badsize);
+    free(sorted);
+}
+
+#else /* MEMSTATS */
+
+void glob_memstats(void *dummy, t_symbol *s, int argc, t_atom *argv)
+{
+    post("pd memstats: compiled without memory accounting (MEMSTATS)");
+}
+
+#endif /* MEMSTATS */
+
 #ifdef DEBUGMEM
+static RTMEM_PERTHREAD int rtmem_indsp;
+
+    /* called by dsp_tick() and the DSP helper threads around the chain */
+void rtmem_dspenter(void)
+{
+    rtmem_indsp = 1;
+}
+
+void rtmem_dspexit(void)
+{
+    rtmem_indsp = 0;
+}
+
+static void rtmem_checkdsp(const char *fn)
+{
+    if (rtmem_indsp)
+    {
+        rtmem_indsp = 0;    /* posting the complaint may allocate too */
+        bug("%s() called from a perform routine; use rt_getbytes()", fn);
+        rtmem_indsp = 1;
+    }
+}
+
 void glob_foo(void *dummy, t_symbol *s, int argc, t_atom *argv)
 {
     fprintf(stderr, "total mem %d\n", totalmem);
@@ -702,7 +702,7 @@ doit:
         oc2->oc_next = oc;
     }
     else *ochead = oc;
-    if (o->o_sym == &s_signal) canvas_update_dsp();
+    if (o->o_sym == &s_signal) canvas_update_dsp_edit();
 
     return (oc);
 }
@@ -748,7 +748,7 @@ doit:
         oc = oc2;
     }
 done:
-    if (o->o_sym == &s_signal) canvas_update_dsp();
+    if (o->o_sym == &s_signal) canvas_update_dsp_edit();
 }
 
 /* ------ traversal routines for code that can't see our structures ------ */
@@ -15,7 +15,17 @@ t_pd *pd_new(t_class *c)
         bug ("pd_new: apparently called before setup routine");
         return NULL;
     }
+#ifdef MEMSTATS
+    {
+            /* charge the object, and what its constructor allocates if it's
+            being made by the object maker, to its class */
+        t_class *was = memstats_newobject(c);
+        x = (t_pd *)t_getbytes(c->c_size);
+        memstats_endnewobject(was);
+    }
+#else
     x = (t_pd *)t_getbytes(c->c_size);
+#endif
     *x = c;
     if (c->c_patchable)
     {
@@ -272,7 +282,7 @@ void pd_doloadbang(void)
 
 void pd_bang(t_pd *x)
 {
-    (*(*x)->c_bangmethod)(x);
+    MEMSTATS_DISPATCH(x, (*(*x)->c_bangmethod)(x));
 }
 
 void pd_float(t_pd *x, t_float f)
@@ -280,27 +290,27 @@ void pd_float(t_pd *x, t_float f)
     if (x == &pd_objectmaker)
         ((t_floatmethodr)(*(*x)->c_floatmethod))(x, f);
     else
-        (*(*x)->c_floatmethod)(x, f);
+        MEMSTATS_DISPATCH(x, (*(*x)->c_floatmethod)(x, f));
 }
 
 void pd_pointer(t_pd *x, t_gpointer *gp)
 {
-    (*(*x)->c_pointermethod)(x, gp);
+    MEMSTATS_DISPATCH(x, (*(*x)->c_pointermethod)(x, gp));
 }
 
 void pd_symbol(t_pd *x, t_symbol *s)
 {
-    (*(*x)->c_symbolmethod)(x, s);
+    MEMSTATS_DISPATCH(x, (*(*x)->c_symbolmethod)(x, s));
 }
 
 void pd_list(t_pd *x, t_symbol *s, int argc, t_atom *argv)
 {
-    (*(*x)->c_listmethod)(x, &s_list, argc, argv);
+    MEMSTATS_DISPATCH(x, (*(*x)->c_listmethod)(x, &s_list, argc, argv));
 }
 
 void pd_anything(t_pd *x, t_symbol *s, int argc, t_atom *argv)
 {
-    (*(*x)->c_anymethod)(x, s, argc, argv);
+    MEMSTATS_DISPATCH(x, (*(*x)->c_anymethod)(x, s, argc, argv));
 }
 
 void mess_init(void);
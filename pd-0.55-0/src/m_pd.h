@@ -360,6 +360,10 @@ EXTERN void *getzbytes(size_t nbytes);
 EXTERN void *copybytes(const void *src, size_t nbytes);
 EXTERN void freebytes(void *x, size_t nbytes);
 EXTERN void *resizebytes(void *x, size_t oldsize, size_t newsize);
+    /* small blocks that are safe to get and free under the DSP lock or in
+    a perform routine, without waiting on malloc */
+EXTERN void *rt_getbytes(size_t nbytes);
+EXTERN void rt_freebytes(void *x, size_t nbytes);
 
 /* -------------------- atoms ----------------------------- */
 
@@ -519,6 +523,8 @@ EXTERN const t_parentwidgetbehavior *pd_getparentwidget(t_pd *x);
 #define CLASS_MULTICHANNEL 0x10     /* can deal with multichannel sigs */
 #define CLASS_NOPROMOTESIG 0x20     /* don't promote scalars to signals */
 #define CLASS_NOPROMOTELEFT 0x40    /* not even the main (left) inlet */
+#define CLASS_PARALLELSAFE 0x80     /* perform routine touches only its own
+                                        state and its signal vectors */
 
 /*
     Setting a tilde object's CLASS_MULTICHANNEL flag declares that it can
@@ -537,6 +543,13 @@ EXTERN const t_parentwidgetbehavior *pd_getparentwidget(t_pd *x);
     opt to supply a faster routine; for example, "+" can do a vector-scalar
     add.  In any case, signal outputs are all vectors, and are allocated
     automatically unless the CLASS_MULTICHANNEL flag is also set.
+
+    Setting CLASS_PARALLELSAFE promises that the object's perform routines
+    read and write nothing but the object's own fields and the signal vectors
+    passed to them: no arrays, no send~/receive~ style buses, no clocks or
+    outlets, no other global state.  When DSP threads are enabled ("pd
+    dsp-threads"), top-level subpatches made only of such objects may be
+    run concurrently with each other.
 */
 
 EXTERN t_class *class_new(t_symbol *name, t_newmethod newmethod,
@@ -723,6 +736,10 @@ EXTERN void mayer_realifft(int n, t_sample *real);
 EXTERN int canvas_suspend_dsp(void);
 EXTERN void canvas_resume_dsp(int oldstate);
 EXTERN void canvas_update_dsp(void);
+EXTERN int canvas_suspend_dsp_for(t_canvas *x);
+EXTERN void canvas_resume_dsp_for(int oldstate);
+EXTERN void canvas_update_dsp_for(t_canvas *x);
+EXTERN void canvas_update_dsp_edit(void);
 EXTERN int canvas_dspstate;
 
 /*   up/downsampling */
@@ -750,6 +767,41 @@ EXTERN void resample_dsp(t_resample *x, t_sample *in, int insize, t_sample *out,
 EXTERN void resamplefrom_dsp(t_resample *x, t_sample *in, int insize, int outsize, int method);
 EXTERN void resampleto_dsp(t_resample *x, t_sample *out, int insize, int outsize, int method);
 
+/*   sample-accurate events.  A signal object that wants to apply control
+messages at the sample they were sent at (rather than at the next block
+boundary) queues them with sigeventq_add() from its message methods, and in
+its perform routine calls sigeventq_startblock() and then sigeventq_next()
+until that returns the block size, filling in the output up to each
+returned offset before applying the event. */
+
+typedef struct _sigevent
+{
+    double e_time;              /* logical time, msec since queue started */
+    int e_which;                /* what to change - up to the object */
+    t_float e_f;                /* new value */
+} t_sigevent;
+
+typedef struct _sigeventq
+{
+    t_sigevent *q_vec;          /* ring of pending events */
+    int q_size;                 /* allocated size, a power of two */
+    int q_head;                 /* next event to deliver */
+    int q_tail;                 /* where to put the next one queued */
+    double q_referencetime;     /* logical time the queue was started */
+    double q_lastlogicaltime;   /* logical time at the last block */
+    double q_blocktime;         /* time at the start of this block */
+    double q_nextblocktime;     /* time at the start of the next block */
+    double q_msecpersamp;       /* set from the sample rate at DSP time */
+} t_sigeventq;
+
+EXTERN void sigeventq_init(t_sigeventq *x);
+EXTERN void sigeventq_free(t_sigeventq *x);
+EXTERN void sigeventq_dsp(t_sigeventq *x, t_float sr);
+EXTERN int sigeventq_add(t_sigeventq *x, int which, t_float f);
+EXTERN void sigeventq_clear(t_sigeventq *x);
+EXTERN void sigeventq_startblock(t_sigeventq *x, int n);
+EXTERN int sigeventq_next(t_sigeventq *x, int n, t_sigevent *e);
+
 /* ----------------------- utility functions for signals -------------- */
 EXTERN t_float mtof(t_float);
 EXTERN t_float ftom(t_float);
@@ -976,7 +1028,7 @@ EXTERN_STRUCT _instancestuff;
 struct _pdinstance
 {
     double pd_systime;          /* global time in Pd ticks */
-    t_clock *pd_clock_setlist;  /* list of set clocks */
+    t_clock *pd_clock_setlist;  /* earliest set clock */
     t_canvas *pd_canvaslist;    /* list of all root canvases */
     struct _template *pd_templatelist;  /* list of all templates */
     int pd_instanceno;          /* ordinal number of this instance */
@@ -12,9 +12,21 @@
 #include <sys/timeb.h>
 #else
 #include <sys/time.h>
+#include <unistd.h>
 #endif
 #include <errno.h>
+#include <math.h>
 #include <pthread.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#define SCHED_BARRIER() MemoryBarrier()
+#else
+#define SCHED_BARRIER() __sync_synchronize()
+#endif
 
     /* LATER consider making this variable.  It's now the LCM of all sample
     rates we expect to see: 32000, 44100, 48000, 88200, 96000. */
@@ -47,10 +59,13 @@ struct _clock
     double c_settime;       /* in TIMEUNITS; <0 if unset */
     void *c_owner;
     t_clockmethod c_fn;
-    struct _clock *c_next;
+    int c_index;            /* position in the heap if set */
+    double c_serial;        /* when it was set, to order equal times */
     t_float c_unit;         /* >0 if in TIMEUNITS; <0 if in samples */
 };
 
+#define CLOCKHEAPMIN 64     /* initial size of the heap of set clocks */
+
 #ifdef HAVE_UNISTD_H
 #include <unistd.h>
 #endif
@@ -61,24 +76,81 @@ t_clock *clock_new(void *owner, t_method fn)
     x->c_settime = -1;
     x->c_owner = owner;
     x->c_fn = (t_clockmethod)fn;
-    x->c_next = 0;
+    x->c_index = -1;
+    x->c_serial = 0;
     x->c_unit = TIMEUNITPERMSEC;
     return (x);
 }
 
+    /* Set clocks are kept in a binary heap ordered by time, so that setting,
+    unsetting, and finding the earliest one cost log(n) however many are
+    set.  Clocks set for the same time go off in the order they were set,
+    as they did when this was a sorted list; c_serial keeps track of that.
+    pd_clock_setlist always points to the earliest one. */
+static int clock_before(t_clock *a, t_clock *b)
+{
+    return (a->c_settime < b->c_settime ||
+        (a->c_settime == b->c_settime && a->c_serial < b->c_serial));
+}
+
+static void clock_heapput(t_clock **heap, int i, t_clock *x)
+{
+    heap[i] = x;
+    x->c_index = i;
+}
+
+static void clock_siftup(int i)
+{
+    t_clock **heap = STUFF->st_clockheap, *x = heap[i];
+    while (i > 0)
+    {
+        int parent = (i - 1) / 2;
+        if (!clock_before(x, heap[parent]))
+            break;
+        clock_heapput(heap, i, heap[parent]);
+        i = parent;
+    }
+    clock_heapput(heap, i, x);
+}
+
+static void clock_siftdown(int i)
+{
+    t_clock **heap = STUFF->st_clockheap, *x = heap[i];
+    int n = STUFF->st_nclocks;
+    while (1)
+    {
+        int child = 2 * i + 1;
+        if (child >= n)
+            break;
+        if (child + 1 < n && clock_before(heap[child + 1], heap[child]))
+            child++;
+        if (!clock_before(heap[child], x))
+            break;
+        clock_heapput(heap, i, heap[child]);
+        i = child;
+    }
+    clock_heapput(heap, i, x);
+}
+
 void clock_unset(t_clock *x)
 {
     if (x->c_settime >= 0)
     {
-        if (x == pd_this->pd_clock_setlist)
-            pd_this->pd_clock_setlist = x->c_next;
-        else
+        t_clock **heap = STUFF->st_clockheap;
+        int i = x->c_index, n = --STUFF->st_nclocks;
+        if (i < n)
         {
-            t_clock *x2 = pd_this->pd_clock_setlist;
-            while (x2->c_next != x) x2 = x2->c_next;
-            x2->c_next = x->c_next;
+                /* move the last one into the hole; it may have to go
+                either way from there */
+            t_clock *last = heap[n];
+            clock_heapput(heap, i, last);
+            clock_siftdown(i);
+            if (last->c_index == i)
+                clock_siftup(i);
         }
+        pd_this->pd_clock_setlist = (n ? heap[0] : 0);
         x->c_settime = -1;
+        x->c_index = -1;
     }
 }
 
@@ -88,23 +160,19 @@ void clock_set(t_clock *x, double setticks)
     if (setticks < pd_this->pd_systime) setticks = pd_this->pd_systime;
     clock_unset(x);
     x->c_settime = setticks;
-    if (pd_this->pd_clock_setlist &&
-        pd_this->pd_clock_setlist->c_settime <= setticks)
+    x->c_serial = STUFF->st_clockserial++;
+    if (STUFF->st_nclocks == STUFF->st_clockheapsize)
     {
-        t_clock *cbefore, *cafter;
-        for (cbefore = pd_this->pd_clock_setlist,
-            cafter = pd_this->pd_clock_setlist->c_next;
-                cbefore; cbefore = cafter, cafter = cbefore->c_next)
-        {
-            if (!cafter || cafter->c_settime > setticks)
-            {
-                cbefore->c_next = x;
-                x->c_next = cafter;
-                return;
-            }
-        }
+        int newsize = (STUFF->st_clockheapsize ?
+            2 * STUFF->st_clockheapsize : CLOCKHEAPMIN);
+        STUFF->st_clockheap = (t_clock **)resizebytes(STUFF->st_clockheap,
+            STUFF->st_clockheapsize * sizeof(*STUFF->st_clockheap),
+                newsize * sizeof(*STUFF->st_clockheap));
+        STUFF->st_clockheapsize = newsize;
     }
-    else x->c_next = pd_this->pd_clock_setlist, pd_this->pd_clock_setlist = x;
+    clock_heapput(STUFF->st_clockheap, STUFF->st_nclocks++, x);
+    clock_siftup(x->c_index);
+    pd_this->pd_clock_setlist = STUFF->st_clockheap[0];
 }
 
     /* set the clock to call back after a delay in msec */
@@ -183,11 +251,6 @@ void clock_free(t_clock *x)
 }
 
 
-void glob_audiostatus(void)
-{
-    /* rewrite me */
-}
-
 static int sched_diored;
 static int sched_dioredtime;
 static int sched_meterson;
@@ -196,8 +259,259 @@ static int sched_counter;
 static void sys_addhist(int n) {}   /* maybe revive this later for profiling */
 static void sys_clearhist(void) {}
 
+/* ------------------------ DSP load telemetry --------------------------- */
+
+    /* Every sched_tick() logs how long it took in all, how much of that
+    was dsp_tick(), and the real time one tick is worth (the deadline), in a
+    ring holding the last SCHED_LOADSIZE ticks.  Only the tick writes the
+    ring and the running totals, so it never waits for anyone; "pd dspload"
+    reads the ring from the message side, discarding any entries the tick
+    may have overwritten while it was copying them.  Since the audio I/O
+    computes a whole buffer of ticks at once, a tick may overrun its own
+    share as long as the buffer is done in time; so the "late" count is of
+    buffers whose ticks together took longer than the buffer's length.
+    All this is kept per instance.  Times are in microseconds. */
+
+#define SCHED_LOADSIZE 4096
+
+typedef struct _tickload
+{
+    float l_tick;           /* whole tick, clocks and DSP */
+    float l_dsp;            /* dsp_tick() alone */
+    float l_deadline;       /* real time the tick stands for */
+} t_tickload;
+
+typedef struct _schedload
+{
+    t_tickload sl_ring[SCHED_LOADSIZE];
+    volatile unsigned int sl_head;  /* ticks ever logged */
+    volatile int sl_clear;          /* ask the tick to clear totals */
+    unsigned int sl_from;           /* first tick since "reset" */
+    double sl_max;                  /* longest tick since "reset" */
+    unsigned int sl_late;           /* buffers that overran since "reset" */
+    volatile unsigned int sl_xruns; /* errors from audio I/O */
+    unsigned int sl_xrunbase;
+    double sl_buftime;              /* ticks so far in this buffer */
+    int sl_bufticks;                /* number of them */
+} t_schedload;
+
+#define LOAD (STUFF->st_schedload)
+
+void m_sched_newpdinstance(void)
+{
+    LOAD = (t_schedload *)getbytes(sizeof(t_schedload));
+}
+
+void m_sched_freepdinstance(void)
+{
+    freebytes(LOAD, sizeof(t_schedload));
+}
+
+static void sched_logtick(double start, double dspstart, double end)
+{
+    t_schedload *sl = LOAD;
+    unsigned int head = sl->sl_head;
+    t_tickload *l = &sl->sl_ring[head % SCHED_LOADSIZE];
+    int perbuf = STUFF->st_blocksize / STUFF->st_schedblocksize;
+    if (sl->sl_clear)
+    {
+        sl->sl_max = 0;
+        sl->sl_late = 0;
+        sl->sl_from = head;
+        sl->sl_buftime = 0;
+        sl->sl_bufticks = 0;
+        sl->sl_clear = 0;
+    }
+    l->l_tick = 1e6 * (end - start);
+    l->l_dsp = 1e6 * (end - dspstart);
+    l->l_deadline = 1e6 * STUFF->st_schedblocksize / STUFF->st_dacsr;
+    if (l->l_tick > sl->sl_max)
+        sl->sl_max = l->l_tick;
+    sl->sl_buftime += l->l_tick;
+    if (++sl->sl_bufticks >= (perbuf > 1 ? perbuf : 1))
+    {
+        if (sl->sl_buftime > sl->sl_bufticks * l->l_deadline)
+            sl->sl_late++;
+        sl->sl_buftime = 0;
+        sl->sl_bufticks = 0;
+    }
+    SCHED_BARRIER();
+    sl->sl_head = head + 1;
+}
+
+typedef struct _loadstats
+{
+    int s_n;                /* ticks in the window */
+    double s_mean, s_p99, s_max;        /* whole tick */
+    double s_dspmean, s_dspp99, s_dspmax;   /* dsp_tick() alone */
+    double s_deadline;
+    double s_minslack;      /* least time to spare in the window */
+    double s_load;          /* mean tick as a percentage of the deadline */
+    double s_maxever;       /* longest tick since "reset" */
+    unsigned int s_ticks, s_late, s_xruns;  /* counts since "reset" */
+} t_loadstats;
+
+static int sched_floatcmp(const void *a, const void *b)
+{
+    float f1 = *(const float *)a, f2 = *(const float *)b;
+    return (f1 < f2 ? -1 : (f1 > f2 ? 1 : 0));
+}
+
+    /* value at fraction "q" of the way up a sorted array */
+static double sched_quantile(float *vec, int n, double q)
+{
+    int i = (int)(q * n);
+    qsort(vec, n, sizeof(*vec), sched_floatcmp);
+    return (vec[i < n ? i : n - 1]);
+}
+
+static void sched_getloadstats(t_loadstats *st)
+{
+    t_schedload *sl = LOAD;
+    unsigned int head, from, i;
+    float *tick, *dsp;
+    int n = 0;
+
+    head = sl->sl_head;
+    SCHED_BARRIER();
+    from = sl->sl_from;
+    if (head - from > SCHED_LOADSIZE)
+        from = head - SCHED_LOADSIZE;
+    st->s_ticks = head - sl->sl_from;
+    st->s_late = sl->sl_late;
+    st->s_maxever = sl->sl_max;
+    st->s_xruns = sl->sl_xruns - sl->sl_xrunbase;
+    st->s_mean = st->s_p99 = st->s_max = 0;
+    st->s_dspmean = st->s_dspp99 = st->s_dspmax = 0;
+    st->s_deadline = st->s_minslack = st->s_load = 0;
+
+    tick = (float *)getbytes(SCHED_LOADSIZE * sizeof(*tick));
+    dsp = (float *)getbytes(SCHED_LOADSIZE * sizeof(*dsp));
+    for (i = from; i != head; i++)
+    {
+        t_tickload *l = &sl->sl_ring[i % SCHED_LOADSIZE];
+        tick[n] = l->l_tick;
+        dsp[n] = l->l_dsp;
+        st->s_deadline = l->l_deadline;
+        n++;
+    }
+        /* drop whatever the tick overwrote, or may be overwriting now,
+        while we were reading */
+    SCHED_BARRIER();
+    if (sl->sl_head + 1 - from > SCHED_LOADSIZE)
+    {
+        int lost = sl->sl_head + 1 - from - SCHED_LOADSIZE;
+        if (lost > n)
+            lost = n;
+        memmove(tick, tick + lost, (n - lost) * sizeof(*tick));
+        memmove(dsp, dsp + lost, (n - lost) * sizeof(*dsp));
+        n -= lost;
+    }
+    st->s_n = n;
+    if (n)
+    {
+        for (i = 0; i < (unsigned int)n; i++)
+        {
+            st->s_mean += tick[i];
+            st->s_dspmean += dsp[i];
+            if (tick[i] > st->s_max)
+                st->s_max = tick[i];
+            if (dsp[i] > st->s_dspmax)
+                st->s_dspmax = dsp[i];
+        }
+        st->s_mean /= n;
+        st->s_dspmean /= n;
+        st->s_p99 = sched_quantile(tick, n, 0.99);
+        st->s_dspp99 = sched_quantile(dsp, n, 0.99);
+        st->s_minslack = st->s_deadline - st->s_max;
+        if (st->s_deadline > 0)
+            st->s_load = 100 * st->s_mean / st->s_deadline;
+    }
+    freebytes(tick, SCHED_LOADSIZE * sizeof(*tick));
+    freebytes(dsp, SCHED_LOADSIZE * sizeof(*dsp));
+}
+
+static void sched_printload(t_loadstats *st)
+{
+    if (!st->s_n)
+    {
+        post("dspload: no ticks yet");
+        return;
+    }
+    post("dspload: %.1f%% of %.0f us deadline over the last %d ticks",
+        st->s_load, st->s_deadline, st->s_n);
+    post("    tick: mean %.1f p99 %.1f max %.1f us",
+        st->s_mean, st->s_p99, st->s_max);
+    post("    dsp:  mean %.1f p99 %.1f max %.1f us",
+        st->s_dspmean, st->s_dspp99, st->s_dspmax);
+    post("    least slack %.1f us; since reset: %u ticks, %u late buffers, "
+        "%u xruns, max %.1f us", st->s_minslack, st->s_ticks, st->s_late,
+            st->s_xruns, st->s_maxever);
+}
+
+static void sched_sendload(t_symbol *s, t_symbol *sel, int argc, ...)
+{
+    t_atom at[4];
+    va_list ap;
+    int i;
+    va_start(ap, argc);
+    for (i = 0; i < argc; i++)
+        SETFLOAT(at + i, va_arg(ap, double));
+    va_end(ap);
+    if (s->s_thing)
+        pd_typedmess(s->s_thing, sel, argc, at);
+}
+
+    /* "pd dspload" sends the statistics to "pd-dspload" as messages
+    "load <percent>", "tick <mean> <p99> <max>", "dsp <mean> <p99> <max>",
+    "deadline <us>", "slack <least>", "late <buffers>", "xruns <n>" and
+    "ticks <n>", or posts them if nobody is listening there.  "pd dspload
+    print" always posts them and "pd dspload reset" starts counting over. */
+void glob_dspload(void *dummy, t_symbol *s, int argc, t_atom *argv)
+{
+    t_symbol *how = atom_getsymbolarg(0, argc, argv), *dest;
+    t_loadstats st;
+    if (how == gensym("reset"))
+    {
+        LOAD->sl_xrunbase = LOAD->sl_xruns;
+        LOAD->sl_clear = 1;
+        return;
+    }
+    else if (*how->s_name && how != gensym("print"))
+    {
+        pd_error(0, "dspload: unknown argument '%s'", how->s_name);
+        return;
+    }
+    sched_getloadstats(&st);
+    dest = gensym("pd-dspload");
+    if (how == gensym("print") || !dest->s_thing)
+        sched_printload(&st);
+    else
+    {
+        sched_sendload(dest, gensym("load"), 1, st.s_load);
+        sched_sendload(dest, gensym("tick"), 3,
+            st.s_mean, st.s_p99, st.s_max);
+        sched_sendload(dest, gensym("dsp"), 3,
+            st.s_dspmean, st.s_dspp99, st.s_dspmax);
+        sched_sendload(dest, gensym("deadline"), 1, st.s_deadline);
+        sched_sendload(dest, gensym("slack"), 1, st.s_minslack);
+        sched_sendload(dest, gensym("late"), 1, (double)st.s_late);
+        sched_sendload(dest, gensym("xruns"), 1, (double)st.s_xruns);
+        sched_sendload(dest, gensym("ticks"), 1, (double)st.s_ticks);
+    }
+}
+
+void glob_audiostatus(void)
+{
+    t_loadstats st;
+    sched_getloadstats(&st);
+    sched_printload(&st);
+}
+
 void sys_log_error(int type)
 {
+    if (type != ERR_NOTHING)
+        LOAD->sl_xruns++;
     if (type != ERR_NOTHING && !sched_diored &&
         (sched_counter >= sched_dioredtime))
     {
@@ -285,10 +599,10 @@ int sched_get_using_audio(void)
     return sched_useaudio;
 }
 
-    /* take the scheduler forward one DSP tick, also handling clock timeouts */
-void sched_tick(void)
+    /* run the clocks due before "next_sys_time"; returns nonzero if Pd is
+    quitting */
+static int sched_runclocks(double next_sys_time)
 {
-    double next_sys_time = pd_this->pd_systime + SYSTIMEPERTICK;
     int countdown = 5000;
     while (pd_this->pd_clock_setlist &&
         pd_this->pd_clock_setlist->c_settime < next_sys_time)
@@ -305,10 +619,22 @@ void sched_tick(void)
         }
             /* ignore SYS_QUIT_REOPEN and SYS_QUIT_CLOSE! */
         if (sys_quit == SYS_QUIT_QUIT)
-            return;
+            return (1);
     }
+    return (0);
+}
+
+    /* take the scheduler forward one DSP tick, also handling clock timeouts */
+void sched_tick(void)
+{
+    double next_sys_time = pd_this->pd_systime + SYSTIMEPERTICK;
+    double starttime = sys_getrealtime(), dsptime;
+    if (sched_runclocks(next_sys_time))
+        return;
     pd_this->pd_systime = next_sys_time;
+    dsptime = sys_getrealtime();
     dsp_tick();
+    sched_logtick(starttime, dsptime, sys_getrealtime());
     sched_counter++;
 }
 
@@ -389,6 +715,10 @@ int sched_idletask(void)
 
 static void m_pollingscheduler(void)
 {
+    static int placed;
+        /* place this thread (if asked to) before it builds any DSP chain so
+        that the memory it allocates for it is close by */
+    sys_updateplacement(CPUS_DSP, 0, &placed);
     sys_lock();
         /* NB: we don't need to lock the scheduler mutex because sys_quit
         will only be modified from this thread */
@@ -453,8 +783,108 @@ static void m_pollingscheduler(void)
 
 static volatile int callback_inprogress;
 
+    /* With "-rtcallback" the audio callback only runs clocks and DSP, and
+    never blocks on sys_lock().  Everything else that used to run there
+    afterward -- polling the GUI and sockets, and whatever those messages
+    set off, like opening files or redrawing arrays -- runs on the
+    scheduler thread instead, which the callback wakes after each tick so
+    that it gets the whole gap until the next one.  If that thread is
+    still holding the lock when the next callback comes, the callback
+    raises sched_rtwaiting and keeps trying for up to SCHED_RTBUDGET of a
+    tick; meanwhile the scheduler thread hands the lock over at the next
+    point where it safely can (see sched_rtyield(), called between file
+    descriptors in sys_pollgui()).  Only if that fails does the callback let
+    the tick go by silent, and it doesn't wait again until it has had the
+    lock back.  Logical time still moves on: the next callback that gets
+    the lock first runs the clocks for the ticks it missed, so that timing
+    stays locked to the audio device.  The scheduler thread reports misses
+    like any other audio I/O error. */
+int sys_rtcallback;
+static volatile int sched_rtwaiting;    /* callback wants the lock */
+static volatile int sched_rtmissed;     /* ticks dropped, ever */
+static int sched_rtdebt;                /* of which not yet caught up on */
+
+    /* fraction of a tick the callback may spend waiting for the lock */
+#define SCHED_RTBUDGET 0.5
+    /* most missed ticks to catch up on in one callback */
+#define SCHED_RTCATCHUP 16
+
+static void sched_rtpause(void)
+{
+#ifdef _WIN32
+    Sleep(0);
+#else
+    usleep(20);
+#endif
+}
+
+    /* the callback's way of getting sys_lock(): returns 1 if it got it */
+static int sched_rtlock(void)
+{
+    double giveup;
+    if (!sys_trylock())
+        return (1);
+    if (sched_rtdebt)   /* missed last time; don't hold up the device again */
+        return (0);
+    giveup = sys_getrealtime() +
+        SCHED_RTBUDGET * STUFF->st_schedblocksize / STUFF->st_dacsr;
+    sched_rtwaiting = 1;
+    SCHED_BARRIER();
+    while (sys_trylock())
+    {
+        if (sys_getrealtime() > giveup)
+        {
+            sched_rtwaiting = 0;
+            return (0);
+        }
+            /* the lock holder may need this CPU to get to a yield point */
+        sched_rtpause();
+    }
+    sched_rtwaiting = 0;
+    return (1);
+}
+
+    /* called by the scheduler thread, holding sys_lock(), wherever it's free
+    to let go of it for a moment: if the callback is waiting, step aside
+    until it has the lock, then wait our turn again. */
+void sched_rtyield(void)
+{
+    if (!sched_rtwaiting)
+        return;
+    sys_unlock();
+    while (sched_rtwaiting)
+        sched_rtpause();
+    sys_lock();
+}
+
 void sched_audio_callbackfn(void)
 {
+    if (sys_rtcallback)
+    {
+        int catchup = SCHED_RTCATCHUP;
+        if (!sched_rtlock())
+        {
+            sched_rtmissed++;
+            sched_rtdebt++;
+            return;
+        }
+        callback_inprogress = 1;
+            /* run the clocks for ticks we missed before this one */
+        while (sched_rtdebt && catchup--)
+        {
+            double next_sys_time = pd_this->pd_systime + SYSTIMEPERTICK;
+            if (!sched_runclocks(next_sys_time))
+                pd_this->pd_systime = next_sys_time;
+            sched_rtdebt--;
+        }
+        sched_tick();
+        sys_pollmidiqueue();
+        sys_unlock();
+        callback_inprogress = 0;
+            /* no need for the mutex; a lost wakeup only costs a sleepgrain */
+        pthread_cond_signal(&sched_cond);
+        return;
+    }
     callback_inprogress = 1;
     sys_lock();
     sys_addhist(0);
@@ -473,31 +903,83 @@ void sched_audio_callbackfn(void)
 
 int sys_try_reopen_audio(void);
 
+    /* absolute time "timeout" seconds from now, for pthread_cond_timedwait */
+static void sched_gettimeout(struct timespec *ts, double timeout)
+{
+#ifdef _WIN32
+    struct __timeb64 tb;
+    _ftime64(&tb);
+        /* add fractional part to timeout */
+    timeout += tb.millitm * 0.001;
+    ts->tv_sec = tb.time + (time_t)timeout;
+    ts->tv_nsec = (timeout - (time_t)timeout) * 1000000000;
+#else
+    struct timeval now;
+    gettimeofday(&now, 0);
+        /* add fractional part to timeout */
+    timeout += now.tv_usec * 0.000001;
+    ts->tv_sec = now.tv_sec + (time_t)timeout;
+    ts->tv_nsec = (timeout - (time_t)timeout) * 1000000000;
+#endif
+}
+
+    /* the scheduler thread's loop for "-rtcallback" (see above): do the
+    idle work after each tick, and see that the callback keeps coming. */
+static void m_rtcallbackscheduler(void)
+{
+    double timewas = pd_this->pd_systime, lastadvance = sys_getrealtime();
+    int missed = sched_rtmissed;
+    pthread_mutex_lock(&sched_mutex);
+    while (!sys_quit)
+    {
+        struct timespec ts;
+        sched_gettimeout(&ts, 0.000001 * sched_get_sleepgrain());
+        pthread_cond_timedwait(&sched_cond, &sched_mutex, &ts);
+        if (sys_quit)
+            break;
+        pthread_mutex_unlock(&sched_mutex);
+        (void)sched_idletask();
+        if (missed != sched_rtmissed)
+        {
+            missed = sched_rtmissed;
+            sys_lock();
+            sys_log_error(ERR_DATALATE);
+            sys_unlock();
+        }
+        if (pd_this->pd_systime != timewas)
+        {
+            timewas = pd_this->pd_systime;
+            lastadvance = sys_getrealtime();
+        }
+        else if (!callback_inprogress &&
+            sys_getrealtime() - lastadvance > CALLBACK_TIMEOUT)
+        {
+                /* the audio device got stuck or disconnected */
+            if (!sys_try_reopen_audio())
+                return;
+            lastadvance = sys_getrealtime();
+        }
+        pthread_mutex_lock(&sched_mutex);
+    }
+    pthread_mutex_unlock(&sched_mutex);
+}
+
 static void m_callbackscheduler(void)
 {
+    if (sys_rtcallback)
+    {
+        m_rtcallbackscheduler();
+        return;
+    }
         /* wait in a loop until the audio callback asks us to quit. */
     pthread_mutex_lock(&sched_mutex);
     while (!sys_quit)
     {
         int wasinprogress;
-            /* get current system time and add timeout */
-        double timewas, timeout = CALLBACK_TIMEOUT;
+        double timewas;
         struct timespec ts;
-    #ifdef _WIN32
-        struct __timeb64 tb;
-        _ftime64(&tb);
-            /* add fractional part to timeout */
-        timeout += tb.millitm * 0.001;
-        ts.tv_sec = tb.time + (time_t)timeout;
-        ts.tv_nsec = (timeout - (time_t)timeout) * 1000000000;
-    #else
-        struct timeval now;
-        gettimeofday(&now, 0);
-            /* add fractional part to timeout */
-        timeout += now.tv_usec * 0.000001;
-        ts.tv_sec = now.tv_sec + (time_t)timeout;
-        ts.tv_nsec = (timeout - (time_t)timeout) * 1000000000;
-    #endif
+            /* get current system time and add timeout */
+        sched_gettimeout(&ts, CALLBACK_TIMEOUT);
             /* sleep on condition variable (with timeout) */
         timewas = pd_this->pd_systime;
         wasinprogress = callback_inprogress;
@@ -557,8 +1039,54 @@ int m_mainloop(void)
     return (sys_exitcode);
 }
 
+    /* from d_soundfile.c */
+int soundfile_render_open(const char *filename, int nchannels,
+    int samplerate);
+int soundfile_render_write(t_sample *vec, int nframes);
+int soundfile_render_close(void);
+void glob_dsp(void *dummy, t_symbol *s, int argc, t_atom *argv);
+
+    /* "-render": run as fast as we can, writing what goes to the dac~ to a
+    file until "-duration" seconds are done or the patch quits.  No audio
+    device is opened; the channel count and sample rate are the ones that
+    would have been used for it. */
+static int m_rendermain(void)
+{
+    int nchans = STUFF->st_outchannels, err = 0;
+    size_t outbytes = nchans * DEFDACBLKSIZE * sizeof(t_sample);
+    double nframes = floor(sys_renderduration * STUFF->st_dacsr + 0.5),
+        done = 0;
+    if (soundfile_render_open(sys_renderfile, nchans,
+        (int)STUFF->st_dacsr))
+            return (1);
+    if (!pd_getdspstate())
+    {
+        t_atom a;
+        SETFLOAT(&a, 1);
+        glob_dsp(0, gensym("dsp"), 1, &a);
+    }
+    memset(STUFF->st_soundout, 0, outbytes);
+    while (sys_quit != SYS_QUIT_QUIT &&
+        (sys_renderduration <= 0 || done < nframes))
+    {
+        int n = DEFDACBLKSIZE;
+        if (sys_renderduration > 0 && nframes - done < n)
+            n = nframes - done;
+        sched_tick();
+        if ((err = soundfile_render_write(STUFF->st_soundout, n)))
+            break;
+        memset(STUFF->st_soundout, 0, outbytes);
+        done += n;
+    }
+    if (soundfile_render_close())
+        err = 1;
+    return (sys_quit == SYS_QUIT_QUIT ? sys_exitcode : err);
+}
+
 int m_batchmain(void)
 {
+    if (sys_renderfile)
+        return (m_rendermain());
     while (sys_quit != SYS_QUIT_QUIT)
         sched_tick();
     return (sys_exitcode);
@@ -123,7 +123,8 @@ SRC = g_canvas.c g_graph.c g_text.c g_rtext.c g_array.c g_template.c g_io.c \
     s_main.c s_inter.c s_inter_gui.c s_print.c s_loader.c s_path.c s_entry.c \
     s_audio.c s_audio_paring.c s_midi.c s_net.c s_utf8.c \
     d_ugen.c d_ctl.c d_arithmetic.c d_osc.c d_filter.c d_dac.c d_misc.c \
-    d_math.c d_fft.c d_fft_fftsg.c d_array.c d_global.c \
+    d_math.c d_fft.c d_fft_fftsg.c d_array.c d_global.c d_parallel.c \
+    d_profile.c \
     d_delay.c d_resample.c d_soundfile.c d_soundfile_aiff.c d_soundfile_caf.c \
     d_soundfile_next.c d_soundfile_wave.c \
     x_arithmetic.c x_connective.c x_interface.c x_midi.c x_misc.c \
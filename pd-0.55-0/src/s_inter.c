@@ -5,6 +5,9 @@
 /* Pd side of the Pd/Pd-gui interface.  Also, some system interface routines
 that didn't really belong anywhere. */
 
+#ifdef __linux__
+#define _GNU_SOURCE     /* for sched_setaffinity() */
+#endif
 #include "m_pd.h"
 #include "s_stuff.h"
 #include "m_imp.h"
@@ -242,6 +245,8 @@ static int sys_domicrosleep(int microsec)
                 (INTER->i_fdpoll[i].fdp_ptr,
                     INTER->i_fdpoll[i].fdp_fd);
             didsomething = 1;
+                /* the audio callback may run here and change the fds */
+            sched_rtyield();
         }
         if (didsomething)
             return (1);
@@ -412,6 +417,249 @@ void sys_set_priority(int mode)
 
 #endif /* !__linux__ */
 
+/* --------------------- placing threads on CPUs ---------------------- */
+
+    /* "-dspcpus" and "-iocpus" (or "pd dsp-cpus" and "pd io-cpus") give
+    lists of CPUs like "2,3,6-9".  The thread computing DSP is pinned to
+    the first DSP CPU and each DSP helper thread (see d_parallel.c) to the
+    next one, round robin.  File I/O threads and the watchdog go on the I/O
+    CPUs, or if there are none, on any CPU but the DSP ones.  "Any CPU"
+    means any that Pd was allowed to begin with, so that limits set by
+    "taskset" or a cpuset still hold; and an empty list puts the threads
+    back there.  Each kind of thread notices a change to its own list (or,
+    for I/O threads without a list, to the DSP one) the next time it calls
+    sys_updateplacement().
+        As for memory, Linux puts each page on the NUMA node of the thread
+    that first touches it.  Signal buffers are first touched while the DSP
+    chain is built, which (with the polling scheduler) happens in the DSP
+    thread; since that thread is placed before it starts, the buffers it
+    works on end up local to it. */
+
+#define MAXCPUS 1024
+
+static int sys_dspcpu[MAXCPUS], sys_ndspcpu;
+static int sys_iocpu[MAXCPUS], sys_niocpu;
+static int sys_placement[2];        /* per kind, bumped on each change */
+static volatile int sys_placefailed[2]; /* last placement that failed */
+static volatile int sys_placeerrno[2];  /* ... and why */
+static int sys_placereported[2];    /* last failure we posted */
+
+static int sys_ncpus(void)
+{
+#ifdef _SC_NPROCESSORS_CONF
+    int n = (int)sysconf(_SC_NPROCESSORS_CONF);
+    return (n < 1 ? 1 : (n > MAXCPUS ? MAXCPUS : n));
+#else
+    return (MAXCPUS);
+#endif
+}
+
+#ifdef __linux__
+#include <sched.h>
+
+static cpu_set_t sys_allowedcpus;   /* what we were given at startup */
+
+    /* note the CPUs we may run on.  Called before any thread is placed, so
+    the calling thread still has the mask the process started with. */
+static void sys_getallowedcpus(void)
+{
+    static int gotit;
+    int i, n = sys_ncpus();
+    if (gotit)
+        return;
+    gotit = 1;
+    if (sched_getaffinity(0, sizeof(sys_allowedcpus), &sys_allowedcpus))
+    {
+        CPU_ZERO(&sys_allowedcpus);
+        for (i = 0; i < n; i++)
+            CPU_SET(i, &sys_allowedcpus);
+    }
+}
+#endif
+
+    /* add CPUs from a string like "2,3,6-9" to a list; return 0 if
+    it's malformed or names CPUs we don't have. */
+static int sys_parsecpus(const char *s, int *cpus, int *ncpus)
+{
+    int ncpu = sys_ncpus();
+    while (*s)
+    {
+        char *end;
+        long lo = strtol(s, &end, 10), hi = lo;
+        if (end == s || lo < 0)
+            return (0);
+        if (*(s = end) == '-')
+        {
+            hi = strtol(s + 1, &end, 10);
+            if (end == s + 1 || hi < lo)
+                return (0);
+            s = end;
+        }
+        if (hi >= ncpu)
+            return (0);
+        for (; lo <= hi && *ncpus < MAXCPUS; lo++)
+            cpus[(*ncpus)++] = (int)lo;
+        if (*s == ',')
+            s++;
+        else if (*s)
+            return (0);
+    }
+    return (1);
+}
+
+static void sys_copycpus(int kind, int *cpus, int ncpus)
+{
+#ifdef __linux__
+    int i;
+    sys_getallowedcpus();
+    for (i = 0; i < ncpus; i++)
+        if (!CPU_ISSET(cpus[i], &sys_allowedcpus))
+    {
+        pd_error(0, "%s: CPU %d isn't available to Pd here "
+            "(see taskset or cpusets)",
+                (kind == CPUS_IO ? "io-cpus" : "dsp-cpus"), cpus[i]);
+        break;
+    }
+#endif
+    if (kind == CPUS_IO)
+    {
+        memcpy(sys_iocpu, cpus, ncpus * sizeof(*cpus));
+        sys_niocpu = ncpus;
+    }
+    else
+    {
+        memcpy(sys_dspcpu, cpus, ncpus * sizeof(*cpus));
+        sys_ndspcpu = ncpus;
+            /* I/O threads without a list of their own keep off these */
+        if (!sys_niocpu)
+            sys_placement[CPUS_IO]++;
+    }
+    sys_placement[kind]++;
+}
+
+    /* set a list from the command line; return 0 if it's bad */
+int sys_setcpus(int kind, const char *list)
+{
+    int cpus[MAXCPUS], ncpus = 0;
+    if (!sys_parsecpus(list, cpus, &ncpus))
+        return (0);
+    sys_copycpus(kind, cpus, ncpus);
+    return (1);
+}
+
+    /* "pd dsp-cpus ..." and "pd io-cpus ..."; no arguments unpins */
+static void sys_cpusmess(int kind, t_symbol *s, int argc, t_atom *argv)
+{
+    int cpus[MAXCPUS], ncpus = 0, i;
+    char buf[MAXPDSTRING];
+    for (i = 0; i < argc; i++)
+    {
+        atom_string(argv + i, buf, MAXPDSTRING);
+        if (!sys_parsecpus(buf, cpus, &ncpus))
+        {
+            pd_error(0, "%s: bad CPU list ('%s'; we have %d CPUs)",
+                s->s_name, buf, sys_ncpus());
+            return;
+        }
+    }
+#ifndef __linux__
+    post("%s: not supported on this platform", s->s_name);
+#endif
+    sys_copycpus(kind, cpus, ncpus);
+}
+
+void glob_dspcpus(void *dummy, t_symbol *s, int argc, t_atom *argv)
+{
+    sys_cpusmess(CPUS_DSP, s, argc, argv);
+}
+
+void glob_iocpus(void *dummy, t_symbol *s, int argc, t_atom *argv)
+{
+    sys_cpusmess(CPUS_IO, s, argc, argv);
+}
+
+#ifdef __linux__
+    /* restrict the calling thread to the given CPUs; if there are none,
+    to the ones we started with but the "except" ones (or all of them if
+    that leaves nothing.)  Returns 0 or an error number. */
+static int sys_setaffinity(const int *cpus, int ncpus,
+    const int *except, int nexcept)
+{
+    cpu_set_t set;
+    int i;
+    sys_getallowedcpus();
+    if (ncpus)
+    {
+        CPU_ZERO(&set);
+        for (i = 0; i < ncpus; i++)
+            CPU_SET(cpus[i], &set);
+    }
+    else
+    {
+        set = sys_allowedcpus;
+        for (i = 0; i < nexcept; i++)
+        {
+            if (CPU_ISSET(except[i], &set) && CPU_COUNT(&set) == 1)
+                break;
+            CPU_CLR(except[i], &set);
+        }
+    }
+    return (sched_setaffinity(0, sizeof(set), &set) ? errno : 0);
+}
+#endif
+
+    /* place the calling thread, which is of the given kind.  DSP helper
+    threads are numbered from 1 by "index"; the DSP thread itself is 0.
+    Returns 0 on success. */
+int sys_placethread(int kind, int index)
+{
+#ifdef __linux__
+    if (kind == CPUS_IO)
+        return (sys_setaffinity(sys_iocpu, sys_niocpu,
+            sys_dspcpu, sys_ndspcpu));
+    else if (sys_ndspcpu)
+        return (sys_setaffinity(&sys_dspcpu[index % sys_ndspcpu], 1, 0, 0));
+    else return (sys_setaffinity(0, 0, 0, 0));
+#else
+    return (-1);
+#endif
+}
+
+    /* threads call this from time to time, passing a place to remember
+    which placement they're in; it's redone if their list has changed.
+    Nothing happens until CPUs have been given, so by default threads stay
+    wherever the system (or "taskset") put them.  Other threads can't post,
+    so the DSP thread, which holds sys_lock(), reports any failures, once
+    for each change of the lists. */
+void sys_updateplacement(int kind, int index, int *placed)
+{
+    int placement = sys_placement[kind], err;
+    if (*placed != placement)
+    {
+        *placed = placement;
+        if ((err = sys_placethread(kind, index)))
+        {
+            sys_placeerrno[kind] = err;
+            sys_placefailed[kind] = placement;
+        }
+    }
+#ifdef __linux__
+    if (kind == CPUS_DSP && !index)
+    {
+        int k;
+        for (k = 0; k < 2; k++)
+            if (sys_placefailed[k] != sys_placereported[k])
+        {
+            sys_placereported[k] = sys_placefailed[k];
+            pd_error(0, "%s: can't place %s thread: %s",
+                (k == CPUS_IO ? "io-cpus" : "dsp-cpus"),
+                    (k == CPUS_IO ? "an I/O" : "a DSP"),
+                        strerror(sys_placeerrno[k]));
+        }
+    }
+#endif
+}
+
 /* ------------------ receiving incoming messages over sockets ------------- */
 
 unsigned char *sys_getrecvbuf(unsigned int *size)
@@ -1705,7 +1953,9 @@ void sys_setrealtime(const char *libdir)
         }
         else if (!watchpid)             /* we're the child */
         {
+            int placed = 0;
             sys_set_priority(MODE_WATCHDOG);
+            sys_updateplacement(CPUS_IO, 0, &placed);
             if (pipe9[1] != 0)
             {
                 dup2(pipe9[0], 0);
@@ -1967,7 +2217,10 @@ int sys_trylock(void)
     if (!(ret = pthread_mutex_trylock(&INTER->i_mutex)))
     {
         if (!(ret = pthread_rwlock_tryrdlock(&sys_rwlock)))
+        {
+            pd_this->pd_islocked = 1;
             return (0);
+        }
         else
         {
             pthread_mutex_unlock(&INTER->i_mutex);
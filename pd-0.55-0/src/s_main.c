@@ -97,6 +97,8 @@ static int sys_listplease;
 int sys_externalschedlib;
 char sys_externalschedlibname[MAXPDSTRING];
 static int sys_batch;
+const char *sys_renderfile;
+double sys_renderduration;
 const char *pd_extraflags = 0;
 int sys_run_scheduler(const char *externalschedlibname,
     const char *sys_extraflagsstring);
@@ -406,6 +408,8 @@ int sys_main(int argc, const char **argv)
         sys_loadpreferences(prefsfile, 1);  /* args to override prefs */
     if (sys_argparse(argc-1, argv+1))           /* parse cmd line args */
         return (1);
+    if (sys_renderduration > 0 && !sys_renderfile)
+        fprintf(stderr, "warning: -duration ignored without -render\n");
     if (sys_verbose || sys_version) fprintf(stderr, "%s compiled %s %s\n",
         pd_version, pd_compiletime, pd_compiledate);
     if (sys_verbose)
@@ -481,6 +485,7 @@ static char *(usagemessage[]) = {
 "-noaudio         -- suppress audio input and output (-nosound is synonym) \n",
 "-callback        -- use callbacks if possible\n",
 "-nocallback      -- use polling-mode (true by default)\n",
+"-rtcallback      -- use callbacks, running only clocks and DSP in them\n",
 "-listdev         -- list audio and MIDI devices\n",
 
 #ifdef USEAPI_OSS
@@ -574,10 +579,14 @@ static char *(usagemessage[]) = {
 #endif
 "-sleep           -- sleep when idle, don't spin (true by default)\n",
 "-nosleep         -- spin, don't sleep (may lower latency on multi-CPUs)\n",
+"-dspcpus <list>  -- run DSP and its helper threads on CPUs, e.g. \"2,3,6-7\"\n",
+"-iocpus <list>   -- run file I/O threads on CPUs (default: not the DSP ones)\n",
 "-schedlib <file> -- plug in external scheduler (omit file extensions)\n",
 "-extraflags <s>  -- string argument to send schedlib\n",
 "-batch           -- run off-line as a batch process\n",
 "-nobatch         -- run interactively (true by default)\n",
+"-render <file>   -- run as a batch process, writing audio output to a file\n",
+"-duration <n>    -- stop rendering after n seconds\n",
 "-autopatch       -- enable auto-patching to new objects (true by default)\n",
 "-noautopatch     -- defeat auto-patching\n",
 "-compatibility <f> -- set back-compatibility to version <f>\n",
@@ -787,6 +796,12 @@ int sys_argparse(int argc, const char **argv)
             as.a_callback = 0;
             argc--; argv++;
         }
+        else if (!strcmp(*argv, "-rtcallback"))
+        {
+            as.a_callback = 1;
+            sys_rtcallback = 1;
+            argc--; argv++;
+        }
         else if (!strcmp(*argv, "-blocksize"))
         {
             as.a_blocksize = atoi(argv[1]);
@@ -1368,6 +1383,21 @@ int sys_argparse(int argc, const char **argv)
             sys_batch = 0;
             argc--; argv++;
         }
+        else if (!strcmp(*argv, "-render"))
+        {
+            if (argc < 2)
+                goto usage;
+            sys_renderfile = argv[1];
+            sys_batch = 1;
+            argc -= 2; argv += 2;
+        }
+        else if (!strcmp(*argv, "-duration"))
+        {
+            if (argc < 2)
+                goto usage;
+            sys_renderduration = atof(argv[1]);
+            argc -= 2; argv += 2;
+        }
         else if (!strcmp(*argv, "-autopatch"))
         {
             sys_noautopatch = 0;
@@ -1420,6 +1450,17 @@ int sys_argparse(int argc, const char **argv)
             sys_nosleep = 1;
             argc--; argv++;
         }
+        else if ((!strcmp(*argv, "-dspcpus") || !strcmp(*argv, "-iocpus"))
+            && argc > 1)
+        {
+            if (!sys_setcpus((argv[0][1] == 'd' ? CPUS_DSP : CPUS_IO),
+                argv[1]))
+            {
+                fprintf(stderr, "%s: bad CPU list '%s'\n", argv[0], argv[1]);
+                goto usage;
+            }
+            argc -= 2; argv += 2;
+        }
         else if (!strcmp(*argv, "-noprefs")) /* did this earlier */
             argc--, argv++;
         else if (!strcmp(*argv, "-prefsfile") && argc > 1) /* this too */
@@ -316,6 +316,7 @@ void sched_set_using_audio(int flag);
 int sched_get_using_audio(void);
 extern int sys_sleepgrain;      /* override value set in command line */
 EXTERN int sched_get_sleepgrain( void);     /* returns actual value */
+void sched_rtyield(void);   /* let a waiting "-rtcallback" callback in */
 
 /* s_inter.c */
 
@@ -350,7 +351,16 @@ void sys_setalarm(int microsec);
 #endif
 
 void sys_set_priority(int higher);
+    /* kinds of thread for sys_placethread() */
+#define CPUS_DSP 0      /* the thread computing DSP, or a helper */
+#define CPUS_IO 1       /* file I/O and other non-real-time threads */
+int sys_setcpus(int kind, const char *list);
+int sys_placethread(int kind, int index);
+void sys_updateplacement(int kind, int index, int *placed);
 EXTERN int sys_hipriority;      /* real-time flag, true if priority boosted */
+EXTERN int sys_rtcallback;      /* keep the audio callback off sys_lock() */
+EXTERN const char *sys_renderfile;  /* "-render" output file, if any */
+EXTERN double sys_renderduration;   /* "-duration" in seconds, 0 if none */
 
 /* s_print.c */
 
@@ -414,6 +424,11 @@ struct _instancestuff
     double st_time_per_dsp_tick;    /* obsolete - included for GEM?? */
     t_printhook st_printhook;   /* set this to override per-instance printing */
     void *st_impdata; /* optional implementation-specific data for libpd, etc */
+    struct _clock **st_clockheap;   /* set clocks, earliest first (m_sched.c) */
+    int st_nclocks;             /* number of clocks in the heap */
+    int st_clockheapsize;       /* number allocated */
+    double st_clockserial;      /* counts clock_set() calls to order ties */
+    struct _schedload *st_schedload;    /* DSP load telemetry (m_sched.c) */
 };
 
 #define STUFF (pd_this->pd_stuff)